@@ -0,0 +1,406 @@
+#include "../TranslucentTB/arch.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <fileapi.h>
+#include <winreg.h>
+#include <WinUser.h>
+
+#include "../TranslucentTB/blacklist.hpp"
+#include "../TranslucentTB/config.hpp"
+#include "../TranslucentTB/monitortopology.hpp"
+#include "../TranslucentTB/util.hpp"
+#include "../TranslucentTB/win32.hpp"
+#include "../TranslucentTB/window.hpp"
+
+// Microbenchmarks for the hot paths, on synthetic data.
+// Usage: Benchmarks [output.json] [baseline.json]
+// Results are printed, and written as JSON to the output file. The difference with a baseline written by
+// a previous run is printed too, by default the baseline.json copied next to the executable.
+
+struct Result {
+	std::string name;
+	uint64_t iterations;
+	double nanoseconds;
+};
+
+static std::vector<Result> results;
+static volatile std::size_t sink; // Keeps the compiler from optimizing the benchmarked code away.
+
+template<typename T>
+void Benchmark(const std::string &name, T &&function)
+{
+	using clock = std::chrono::steady_clock;
+	static constexpr auto MINIMUM_TIME = std::chrono::milliseconds(250);
+
+	function(); // Warm up
+
+	uint64_t iterations = 0;
+	uint64_t batch = 1;
+	const clock::time_point start = clock::now();
+	clock::duration elapsed;
+	do
+	{
+		for (uint64_t i = 0; i < batch; i++)
+		{
+			function();
+		}
+
+		iterations += batch;
+		batch *= 2;
+		elapsed = clock::now() - start;
+	}
+	while (elapsed < MINIMUM_TIME);
+
+	const double nanoseconds = std::chrono::duration<double, std::nano>(elapsed).count() / iterations;
+	results.push_back({ name, iterations, nanoseconds });
+	std::cout << std::left << std::setw(60) << name << std::right << std::setw(14) << std::fixed << std::setprecision(1) << nanoseconds << " ns" << std::endl;
+}
+
+// Same, but with another thread running the same code the whole time.
+template<typename T>
+void BenchmarkContended(const std::string &name, T &&function)
+{
+	std::atomic_bool stop = false;
+	std::thread contender([&stop, &function]
+	{
+		while (!stop)
+		{
+			function();
+		}
+	});
+
+	Benchmark(name + " (contended)", function);
+
+	stop = true;
+	contender.join();
+}
+
+std::wstring GetTempFile(const wchar_t *const name)
+{
+	wchar_t folder[MAX_PATH + 1];
+	GetTempPath(MAX_PATH + 1, folder);
+	return std::wstring(folder) + name;
+}
+
+std::wstring WriteExcludeFile(const std::size_t &rules)
+{
+	// Split between the three kinds of rules, none of them matching so that every rule gets looked at.
+	std::wostringstream classes, titles, files;
+	classes << L"class,";
+	titles << L"title,";
+	files << L"exename,";
+	for (std::size_t i = 0; i < rules; i++)
+	{
+		switch (i % 3)
+		{
+		case 0:
+			classes << L"Excluded class " << i << L',';
+			break;
+		case 1:
+			titles << L"Excluded title " << i << L',';
+			break;
+		case 2:
+			files << L"excluded" << i << L".exe,";
+			break;
+		}
+	}
+
+	const std::wstring file = GetTempFile(L"ttb-benchmark-exclude.csv");
+	std::wofstream stream(file);
+	stream << classes.str() << L'\n' << titles.str() << L'\n' << files.str() << L'\n';
+	return file;
+}
+
+std::wstring WriteLargeConfigFile(const std::size_t &copies)
+{
+	const std::wstring file = GetTempFile(L"ttb-benchmark-config.cfg");
+	Config::Save(file);
+
+	std::wstring contents;
+	{
+		std::wifstream stream(file);
+		contents.assign(std::istreambuf_iterator<wchar_t>(stream), std::istreambuf_iterator<wchar_t>());
+	}
+
+	std::wofstream stream(file);
+	for (std::size_t i = 0; i < copies; i++)
+	{
+		stream << contents;
+	}
+
+	return file;
+}
+
+// Only ASCII is expected in there.
+std::string ReadMachineString(const wchar_t *const key, const wchar_t *const value)
+{
+	wchar_t buffer[256];
+	DWORD size = sizeof(buffer);
+	if (RegGetValue(HKEY_LOCAL_MACHINE, key, value, RRF_RT_REG_SZ, NULL, buffer, &size) != ERROR_SUCCESS)
+	{
+		return "unknown";
+	}
+
+	std::string result;
+	for (const wchar_t *character = buffer; *character != L'\0'; character++)
+	{
+		result += *character < 0x80 && *character != L'"' ? static_cast<char>(*character) : '?';
+	}
+
+	result.erase(result.find_last_not_of(' ') + 1);
+	return result;
+}
+
+// Recorded with the results, so that a baseline from another machine or build can be recognized.
+std::string MachineDescription()
+{
+	return ReadMachineString(LR"(HARDWARE\DESCRIPTION\System\CentralProcessor\0)", L"ProcessorNameString") + ", " +
+		std::to_string(std::thread::hardware_concurrency()) + " logical processors, Windows build " +
+		ReadMachineString(LR"(SOFTWARE\Microsoft\Windows NT\CurrentVersion)", L"CurrentBuild");
+}
+
+std::string BuildConfiguration()
+{
+#ifdef _DEBUG
+	std::string configuration = "Debug";
+#else
+	std::string configuration = "Release";
+#endif
+
+#ifdef _WIN64
+	return configuration + " x64";
+#else
+	return configuration + " x86";
+#endif
+}
+
+void WriteResults(const std::wstring &file)
+{
+	std::ofstream stream(file);
+	stream << "{\n\t\"machine\": \"" << MachineDescription() << "\",\n\t\"configuration\": \"" << BuildConfiguration() << "\",\n\t\"results\": [\n";
+	for (std::size_t i = 0; i < results.size(); i++)
+	{
+		const Result &result = results[i];
+		stream << "\t\t{ \"name\": \"" << result.name << "\", \"iterations\": " << result.iterations << ", \"nanoseconds\": " << result.nanoseconds << " }" << (i + 1 != results.size() ? ",\n" : "\n");
+	}
+	stream << "\t]\n}\n";
+}
+
+// Only understands files written by WriteResults.
+std::unordered_map<std::string, double> ReadResults(const std::wstring &file)
+{
+	static constexpr std::string_view NAME = "\"name\": \"";
+	static constexpr std::string_view NANOSECONDS = "\"nanoseconds\": ";
+
+	std::unordered_map<std::string, double> baseline;
+	std::ifstream stream(file);
+	for (std::string line; std::getline(stream, line);)
+	{
+		const std::size_t name = line.find(NAME);
+		const std::size_t nanoseconds = line.find(NANOSECONDS);
+		if (name != std::string::npos && nanoseconds != std::string::npos)
+		{
+			const std::size_t name_start = name + NAME.length();
+			baseline[line.substr(name_start, line.find('"', name_start) - name_start)] = std::strtod(line.c_str() + nanoseconds + NANOSECONDS.length(), nullptr);
+		}
+	}
+
+	return baseline;
+}
+
+// Same, for one of the top level string fields.
+std::string ReadField(const std::wstring &file, const std::string_view &field)
+{
+	const std::string key = '"' + std::string(field) + "\": \"";
+
+	std::ifstream stream(file);
+	for (std::string line; std::getline(stream, line);)
+	{
+		if (const std::size_t position = line.find(key); position != std::string::npos)
+		{
+			const std::size_t start = position + key.length();
+			return line.substr(start, line.find('"', start) - start);
+		}
+	}
+
+	return { };
+}
+
+int wmain(int argc, wchar_t *argv[])
+{
+	// Don't benchmark the logging.
+	Config::Update([](Config &config)
+	{
+		config.VERBOSE = false;
+	});
+
+	MonitorTopology::Rebuild();
+
+	// A few classes, with a lot of windows each, like real applications.
+	static constexpr std::size_t CLASS_COUNT = 8;
+	static constexpr std::size_t WINDOW_COUNT = 256;
+
+	std::vector<std::wstring> classes;
+	for (std::size_t i = 0; i < CLASS_COUNT; i++)
+	{
+		classes.push_back(L"TTBBenchmarkClass" + std::to_wstring(i));
+
+		WNDCLASSEX window_class = { sizeof(window_class) };
+		window_class.lpfnWndProc = DefWindowProc;
+		window_class.hInstance = GetModuleHandle(NULL);
+		window_class.lpszClassName = classes.back().c_str();
+		RegisterClassEx(&window_class);
+	}
+
+	std::vector<Window> windows;
+	for (std::size_t i = 0; i < WINDOW_COUNT; i++)
+	{
+		windows.push_back(Window::Create(0, classes[i % CLASS_COUNT], L"Benchmark window " + std::to_wstring(i), WS_OVERLAPPEDWINDOW));
+	}
+
+	// The contended benchmarks run this from two threads at once, so each gets its own position.
+	const auto next_window = [&windows]() -> const Window &
+	{
+		static thread_local std::size_t next = 0;
+		return windows[next++ % windows.size()];
+	};
+
+	// Window property cache
+	const auto classname_hit = [&next_window]
+	{
+		sink = sink + next_window().classname().length();
+	};
+	Benchmark("Window::classname hit", classname_hit);
+	BenchmarkContended("Window::classname hit", classname_hit);
+
+	const auto filename_hit = [&next_window]
+	{
+		sink = sink + next_window().filename().length();
+	};
+	Benchmark("Window::filename hit", filename_hit);
+	BenchmarkContended("Window::filename hit", filename_hit);
+
+	const auto monitor_miss = [&windows]
+	{
+		Window::ClearMonitorCache();
+		for (const Window &window : windows)
+		{
+			sink = sink + reinterpret_cast<std::uintptr_t>(window.monitor());
+		}
+	};
+	Benchmark("Window::monitor miss, 256 windows", monitor_miss);
+	BenchmarkContended("Window::monitor miss, 256 windows", monitor_miss);
+
+	// Blacklist
+	for (const std::size_t rules : { 10, 100, 1000 })
+	{
+		const std::wstring exclude_file = WriteExcludeFile(rules);
+		Blacklist::Parse(exclude_file); // Also writes the index
+		const std::string suffix = ", " + std::to_string(rules) + " rules";
+
+		Benchmark("Blacklist::Parse from index" + suffix, [&exclude_file]
+		{
+			Blacklist::Parse(exclude_file);
+		});
+
+		Benchmark("Blacklist::IsBlacklisted cached" + suffix, [&next_window]
+		{
+			sink = sink + Blacklist::IsBlacklisted(next_window());
+		});
+
+		Benchmark("Blacklist::IsBlacklisted uncached, 256 windows" + suffix, [&windows]
+		{
+			Blacklist::ClearCache();
+			for (const Window &window : windows)
+			{
+				sink = sink + Blacklist::IsBlacklisted(window);
+			}
+		});
+	}
+
+	// String helpers
+	const std::wstring lowercase = L"windows.ui.core.corewindow";
+	const std::wstring mixedcase = L"Windows.UI.Core.CoreWindow";
+	Benchmark("Util::IgnoreCaseStringEquals", [&lowercase, &mixedcase]
+	{
+		sink = sink + Util::IgnoreCaseStringEquals(lowercase, mixedcase);
+	});
+
+	Benchmark("Util::ToLower", [&mixedcase]
+	{
+		sink = sink + Util::ToLower(mixedcase).length();
+	});
+
+	Benchmark("Util::IgnoreCaseStringHash", [&mixedcase]
+	{
+		sink = sink + Util::IgnoreCaseStringHash(mixedcase);
+	});
+
+	const std::wstring padded = L"      Windows.UI.Core.CoreWindow      ";
+	Benchmark("Util::Trim", [&padded]
+	{
+		sink = sink + Util::Trim(padded).length();
+	});
+
+	// Configuration
+	const std::wstring config_file = WriteLargeConfigFile(500);
+	Benchmark("Config::Parse, 500 copies of the default file", [&config_file]
+	{
+		Config::Parse(config_file);
+	});
+
+	for (const Window &window : windows)
+	{
+		DestroyWindow(window);
+	}
+
+	if (argc > 1)
+	{
+		WriteResults(argv[1]);
+	}
+
+	std::wstring baseline_file;
+	if (argc > 2)
+	{
+		baseline_file = argv[2];
+	}
+	else
+	{
+		baseline_file = win32::GetExeLocation();
+		baseline_file.erase(baseline_file.find_last_of(LR"(/\)") + 1);
+		baseline_file += L"baseline.json";
+	}
+
+	const auto baseline = ReadResults(baseline_file);
+	std::cout << std::endl << "Compared to baseline (" << ReadField(baseline_file, "configuration") << ", on " << ReadField(baseline_file, "machine") << "):" << std::endl;
+	std::cout << "This run: " << BuildConfiguration() << ", on " << MachineDescription() << std::endl;
+	std::size_t compared = 0;
+	for (const Result &result : results)
+	{
+		if (const auto it = baseline.find(result.name); it != baseline.end() && it->second != 0)
+		{
+			std::cout << std::left << std::setw(60) << result.name << std::right << std::setw(13) << std::showpos << std::setprecision(1) << (result.nanoseconds / it->second - 1.0) * 100.0 << std::noshowpos << " %" << std::endl;
+			compared++;
+		}
+	}
+
+	if (compared == 0)
+	{
+		std::cout << "Nothing to compare to, regenerate the baseline by passing it as the output file." << std::endl;
+	}
+
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
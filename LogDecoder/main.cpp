@@ -0,0 +1,70 @@
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "../TranslucentTB/binarylog.hpp"
+
+// Turns a binary TranslucentTB log back into the same text the regular log would have had.
+int wmain(int argc, wchar_t *argv[])
+{
+	if (argc < 2 || argc > 3)
+	{
+		std::wcerr << L"Usage: LogDecoder <log" << BinaryLog::EXTENSION << L"> [output.log]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const std::wstring input = argv[1];
+	std::wstring output;
+	if (argc == 3)
+	{
+		output = argv[2];
+	}
+	else
+	{
+		output = input.substr(0, input.find_last_of(L'.')) + L".log";
+	}
+
+	std::ifstream in(input, std::ios::binary);
+	if (!in)
+	{
+		std::wcerr << L"Failed to open " << input << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+
+	BinaryLog::Decoder decoder(data.data(), data.size());
+	if (!decoder.valid())
+	{
+		std::wcerr << input << L" is not a binary log, or was written by an unsupported version." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::ofstream out(output, std::ios::binary);
+	if (!out)
+	{
+		std::wcerr << L"Failed to create " << output << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const auto write = [&out](const std::wstring &text)
+	{
+		out.write(reinterpret_cast<const char *>(text.data()), text.length() * sizeof(wchar_t));
+	};
+
+	// Same encoding as the text log, UTF-16 with a byte-order marker.
+	write(L"\uFEFF");
+
+	std::size_t count = 0;
+	for (std::wstring line; decoder.next(line); count++)
+	{
+		write(line + L"\r\n");
+	}
+
+	std::wcout << L"Decoded " << count << L" messages to " << output << std::endl;
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,411 @@
+#include "../TranslucentTB/arch.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "../TranslucentTB/config.hpp"
+#include "../TranslucentTB/evaluator.hpp"
+#include "../TranslucentTB/eventtrace.hpp"
+#include "../TranslucentTB/window.hpp"
+
+// Feeds a trace recorded with record-events back to the Evaluator, with what the windows said at the time
+// instead of real windows, so that the same workload can be compared across changes.
+// Usage: Replay <trace.ttbtrace> [--config FILE] [--mode polling|events] [--output FILE]
+// The worker is simulated on the trace's own clock: no waiting, and the same trace always gives the same
+// counts and latencies. Those latencies only include the scheduling delay, the time the Evaluator itself
+// takes is reported separately. Application rules aren't recorded, they are left out.
+
+struct Options {
+	std::wstring trace;
+	std::wstring config;
+	bool polling = false;
+	std::wstring output;
+};
+
+// What the worker would know at that point of the trace.
+struct State {
+	std::vector<Evaluator::Taskbar> taskbars;
+	std::unordered_map<uint64_t, HMONITOR> maximised;
+	std::unordered_map<HMONITOR, std::size_t> maximised_count;
+	uint64_t foreground = 0;
+	HMONITOR foreground_monitor = nullptr;
+	Window::Kind foreground_kind = Window::Kind::Normal;
+	bool foreground_cloaked = false;
+	bool start_opened = false;
+	std::vector<HMONITOR> immersive_monitors;
+	bool peek_active = false;
+
+	// Same role as the generations in the real EvaluationInputs.
+	uint64_t taskbars_generation = 0;
+	uint64_t tracker_generation = 0;
+	uint64_t visibility_generation = 0;
+};
+
+struct Inputs {
+	uint64_t taskbars_generation;
+	uint64_t tracker_generation;
+	uint64_t foreground;
+	bool foreground_cloaked;
+	bool start_opened;
+	uint64_t visibility_generation;
+	bool peek_active;
+
+	inline bool operator ==(const Inputs &right) const
+	{
+		return taskbars_generation == right.taskbars_generation &&
+			tracker_generation == right.tracker_generation &&
+			foreground == right.foreground &&
+			foreground_cloaked == right.foreground_cloaked &&
+			start_opened == right.start_opened &&
+			visibility_generation == right.visibility_generation &&
+			peek_active == right.peek_active;
+	}
+};
+
+struct Results {
+	uint64_t events = 0;
+	uint64_t evaluations = 0;
+	uint64_t evaluations_skipped = 0;
+	uint64_t swca_calls = 0;
+	std::chrono::steady_clock::duration evaluator_time = { };
+	std::vector<uint64_t> latencies; // In microseconds, one for each event an apply followed
+};
+
+static constexpr uint64_t NO_EVALUATION = (std::numeric_limits<uint64_t>::max)();
+
+bool ParseArguments(const int &argc, wchar_t *argv[], Options &options)
+{
+	if (argc < 2 || argc % 2 != 0)
+	{
+		return false;
+	}
+
+	options.trace = argv[1];
+	for (int i = 2; i < argc; i += 2)
+	{
+		const std::wstring_view name = argv[i];
+		const std::wstring_view value = argv[i + 1];
+		if (name == L"--config")
+		{
+			options.config = value;
+		}
+		else if (name == L"--mode" && (value == L"polling" || value == L"events"))
+		{
+			options.polling = value == L"polling";
+		}
+		else if (name == L"--output")
+		{
+			options.output = value;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+HMONITOR ToMonitor(const uint64_t &value)
+{
+	return reinterpret_cast<HMONITOR>(static_cast<uintptr_t>(value));
+}
+
+void SetMaximised(State &state, const uint64_t &window, const HMONITOR &monitor)
+{
+	if (const auto it = state.maximised.find(window); it != state.maximised.end())
+	{
+		state.maximised_count[it->second]--;
+		state.maximised.erase(it);
+	}
+
+	if (monitor)
+	{
+		state.maximised.emplace(window, monitor);
+		state.maximised_count[monitor]++;
+	}
+}
+
+// Applies the record at position, and the ones grouped with it. Returns the position of the next one.
+std::size_t ApplyRecord(State &state, const std::vector<EventTrace::Record> &records, std::size_t position)
+{
+	const EventTrace::Record &record = records[position++];
+	switch (record.kind)
+	{
+	case EventTrace::Kind::Foreground:
+		state.foreground = record.window;
+		state.foreground_monitor = ToMonitor(record.monitor);
+		state.foreground_kind = record.window_kind;
+		state.foreground_cloaked = record.flag;
+		break;
+
+	case EventTrace::Kind::Maximised:
+		SetMaximised(state, record.window, ToMonitor(record.monitor));
+		state.tracker_generation++;
+		break;
+
+	case EventTrace::Kind::Rescan:
+		state.maximised.clear();
+		state.maximised_count.clear();
+		for (uint32_t i = 0; i < record.count && position < records.size() && records[position].kind == EventTrace::Kind::Maximised; i++, position++)
+		{
+			SetMaximised(state, records[position].window, ToMonitor(records[position].monitor));
+		}
+		state.tracker_generation++;
+		break;
+
+	case EventTrace::Kind::Peek:
+		state.peek_active = record.flag;
+		break;
+
+	case EventTrace::Kind::Launcher:
+		state.start_opened = record.flag;
+		state.visibility_generation++;
+		break;
+
+	case EventTrace::Kind::MonitorApp:
+	{
+		auto &monitors = state.immersive_monitors;
+		const HMONITOR monitor = ToMonitor(record.monitor);
+		if (const auto it = std::find(monitors.begin(), monitors.end(), monitor); record.flag && it == monitors.end())
+		{
+			monitors.push_back(monitor);
+		}
+		else if (!record.flag && it != monitors.end())
+		{
+			monitors.erase(it);
+		}
+		state.visibility_generation++;
+		break;
+	}
+
+	case EventTrace::Kind::Taskbars:
+		state.taskbars.clear();
+		for (uint32_t i = 0; i < record.count && position < records.size() && records[position].kind == EventTrace::Kind::Taskbar; i++, position++)
+		{
+			state.taskbars.push_back({ ToMonitor(records[position].monitor), records[position].flag });
+		}
+		state.taskbars_generation++;
+		break;
+
+	default:
+		break; // A lone Taskbar record, or something newer than this tool
+	}
+
+	return position;
+}
+
+// Same as SetTaskbarBlur: skips when nothing it looks at changed (unless polling), and only counts
+// an SWCA call for the taskbars whose appearance differs from what was applied last.
+void Evaluate(const Config &config, const State &state, const bool &skip_unchanged, const uint64_t &time, std::vector<uint64_t> &pending, Results &results)
+{
+	static Inputs last_inputs = { NO_EVALUATION };
+	static std::unordered_map<HMONITOR, Config::TASKBAR_APPEARANCE> appearances;
+	static std::unordered_map<HMONITOR, Config::TASKBAR_APPEARANCE> applied;
+	static std::vector<HMONITOR> start_monitors;
+
+	const Inputs inputs = {
+		state.taskbars_generation,
+		state.tracker_generation,
+		state.foreground,
+		state.foreground_cloaked,
+		state.start_opened,
+		state.visibility_generation,
+		state.peek_active
+	};
+	if (skip_unchanged && inputs == last_inputs)
+	{
+		results.evaluations_skipped++;
+		pending.clear();
+		return;
+	}
+	last_inputs = inputs;
+	results.evaluations++;
+
+	if (config.START_ENABLED && state.start_opened)
+	{
+		if (state.foreground && state.foreground_kind == Window::Kind::StartHost)
+		{
+			start_monitors.assign(1, state.foreground_monitor);
+		}
+		else
+		{
+			start_monitors = state.immersive_monitors;
+		}
+	}
+	else
+	{
+		start_monitors.clear();
+	}
+
+	const Evaluator::Inputs evaluator_inputs = {
+		state.taskbars,
+		state.foreground ? state.foreground_monitor : nullptr,
+		state.foreground ? state.foreground_kind : Window::Kind::Normal,
+		state.foreground != 0 && state.foreground_cloaked,
+		state.start_opened,
+		start_monitors,
+		state.peek_active
+	};
+	const Evaluator::Queries queries = {
+		[&state](const HMONITOR &monitor)
+		{
+			const auto it = state.maximised_count.find(monitor);
+			return it != state.maximised_count.end() && it->second != 0;
+		}
+	};
+
+	const auto start = std::chrono::steady_clock::now();
+	Evaluator::Evaluate(config, evaluator_inputs, queries, appearances);
+	results.evaluator_time += std::chrono::steady_clock::now() - start;
+
+	bool applied_any = false;
+	for (const auto &[monitor, appearance] : appearances)
+	{
+		const auto it = applied.find(monitor);
+		if (it == applied.end() || it->second.ACCENT != appearance.ACCENT || it->second.COLOR != appearance.COLOR)
+		{
+			applied[monitor] = appearance;
+			results.swca_calls++;
+			applied_any = true;
+		}
+	}
+
+	if (applied_any)
+	{
+		for (const uint64_t event_time : pending)
+		{
+			results.latencies.push_back(time - event_time);
+		}
+	}
+	pending.clear();
+}
+
+Results Replay(const Config &config, const std::vector<EventTrace::Record> &records, const bool &polling)
+{
+	Results results;
+	State state;
+	std::vector<uint64_t> pending; // Times of the events since the last evaluation
+
+	const uint64_t sleep_time = (std::max)(static_cast<uint64_t>(config.SLEEP_TIME), static_cast<uint64_t>(1)) * 1000;
+	uint64_t next_evaluation = polling ? 0 : NO_EVALUATION;
+
+	for (std::size_t position = 0; position < records.size();)
+	{
+		const EventTrace::Record &record = records[position];
+		while (next_evaluation <= record.time)
+		{
+			Evaluate(config, state, !polling, next_evaluation, pending, results);
+			next_evaluation = polling ? next_evaluation + sleep_time : NO_EVALUATION;
+		}
+
+		position = ApplyRecord(state, records, position);
+		pending.push_back(record.time);
+		results.events++;
+
+		if (next_evaluation == NO_EVALUATION)
+		{
+			// Like the worker, Start and immersive apps don't wait for the burst to settle.
+			const bool visibility = record.kind == EventTrace::Kind::Launcher || record.kind == EventTrace::Kind::MonitorApp;
+			next_evaluation = visibility ? record.time : record.time + sleep_time;
+		}
+	}
+
+	// The last events still get their evaluation.
+	if (!pending.empty())
+	{
+		Evaluate(config, state, !polling, next_evaluation != NO_EVALUATION ? next_evaluation : records.back().time, pending, results);
+	}
+
+	return results;
+}
+
+double Percentile(const std::vector<uint64_t> &sorted, const double &percentile)
+{
+	if (sorted.empty())
+	{
+		return 0.0;
+	}
+
+	const std::size_t index = static_cast<std::size_t>(percentile / 100.0 * (sorted.size() - 1));
+	return sorted[index] / 1000.0;
+}
+
+int wmain(int argc, wchar_t *argv[])
+{
+	Options options;
+	if (!ParseArguments(argc, argv, options))
+	{
+		std::wcerr << L"Usage: Replay <trace" << EventTrace::EXTENSION << L"> [--config FILE] [--mode polling|events] [--output FILE]" << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::ifstream in(options.trace, std::ios::binary);
+	if (!in)
+	{
+		std::wcerr << L"Failed to open " << options.trace << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	const std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	std::vector<EventTrace::Record> records;
+	if (!EventTrace::Decode(data.data(), data.size(), records))
+	{
+		std::wcerr << options.trace << L" is not an event trace, or was written by an unsupported version." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	if (!options.config.empty())
+	{
+		Config::Parse(options.config);
+	}
+	const auto config = Config::Current();
+
+	Results results = Replay(*config, records, options.polling);
+	std::sort(results.latencies.begin(), results.latencies.end());
+
+	const double duration = records.empty() ? 0.0 : records.back().time / 1000000.0;
+	const double evaluator_nanoseconds = results.evaluations != 0 ? std::chrono::duration<double, std::nano>(results.evaluator_time).count() / results.evaluations : 0.0;
+
+	std::cout << std::fixed << std::setprecision(1);
+	std::cout << "Mode:                    " << (options.polling ? "polling" : "events") << std::endl;
+	std::cout << "Trace duration:          " << duration << " s" << std::endl;
+	std::cout << "Events:                  " << results.events << std::endl;
+	std::cout << "Evaluations:             " << results.evaluations << std::endl;
+	std::cout << "Evaluations skipped:     " << results.evaluations_skipped << std::endl;
+	std::cout << "SWCA calls:              " << results.swca_calls << std::endl;
+	std::cout << "Evaluator time:          " << evaluator_nanoseconds << " ns per evaluation" << std::endl;
+	std::cout << "Event to apply latency:  p50 " << Percentile(results.latencies, 50) << " ms, p90 " << Percentile(results.latencies, 90) <<
+		" ms, p99 " << Percentile(results.latencies, 99) << " ms, max " << Percentile(results.latencies, 100) << " ms" << std::endl;
+
+	if (!options.output.empty())
+	{
+		std::ofstream stream(options.output);
+		stream << "{\n\t\"mode\": \"" << (options.polling ? "polling" : "events") << "\",\n" <<
+			"\t\"events\": " << results.events << ",\n" <<
+			"\t\"evaluations\": " << results.evaluations << ",\n" <<
+			"\t\"evaluations_skipped\": " << results.evaluations_skipped << ",\n" <<
+			"\t\"swca_calls\": " << results.swca_calls << ",\n" <<
+			"\t\"evaluator_nanoseconds\": " << evaluator_nanoseconds << ",\n" <<
+			"\t\"latency_milliseconds\": { \"p50\": " << Percentile(results.latencies, 50) << ", \"p90\": " << Percentile(results.latencies, 90) <<
+			", \"p99\": " << Percentile(results.latencies, 99) << ", \"max\": " << Percentile(results.latencies, 100) << " }\n}\n";
+
+		if (!stream)
+		{
+			std::wcerr << L"Failed to write " << options.output << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,313 @@
+#include "apprules.hpp"
+#include <algorithm>
+#include <cwchar>
+#include <fstream>
+#include <utility>
+
+#include "ttblog.hpp"
+
+std::vector<AppRules::Rule> AppRules::m_Rules;
+std::unordered_map<std::wstring, uint32_t> AppRules::m_ClassRules;
+Util::string_map<uint32_t> AppRules::m_FileRules;
+PatternMatcher AppRules::m_TitleRules;
+std::vector<uint32_t> AppRules::m_TitleRuleIndices;
+
+std::mutex AppRules::m_Lock;
+std::unordered_map<Window, AppRules::Verdict> AppRules::m_Cache;
+std::atomic_bool AppRules::m_Empty = true;
+std::atomic_uint64_t AppRules::m_Generation = 0;
+uint64_t AppRules::m_Revision = 0;
+std::function<void()> AppRules::m_ChangedCallback;
+
+void AppRules::Parse(const std::wstring &file)
+{
+	enum class Key {
+		ClassName,
+		FileName,
+		Title
+	};
+
+	struct Entry {
+		Key key;
+		std::wstring value;
+		Rule rule;
+	};
+
+	std::vector<Entry> entries;
+
+	std::wifstream rulesfilestream(file);
+	for (std::wstring line; std::getline(rulesfilestream, line);)
+	{
+		if (const size_t comment_index = line.find(L';'); comment_index != std::wstring::npos)
+		{
+			line.erase(comment_index);
+		}
+
+		Util::TrimInplace(line);
+		if (line.empty())
+		{
+			continue;
+		}
+
+		// key, value, accent, color, opacity[, priority]
+		std::vector<std::wstring> fields;
+		for (size_t start = 0, end; start <= line.length(); start = end + 1)
+		{
+			end = line.find(L',', start);
+			if (end == std::wstring::npos)
+			{
+				end = line.length();
+			}
+
+			fields.push_back(Util::Trim(line.substr(start, end - start)));
+		}
+
+		Entry entry = { };
+		bool valid = fields.size() == 5 || fields.size() == 6;
+		if (valid)
+		{
+			if (Util::IgnoreCaseStringEquals(fields[0], L"class"))
+			{
+				entry.key = Key::ClassName;
+			}
+			else if (Util::IgnoreCaseStringEquals(fields[0], L"exename"))
+			{
+				entry.key = Key::FileName;
+			}
+			else if (Util::IgnoreCaseStringEquals(fields[0], L"title") || Util::IgnoreCaseStringEquals(fields[0], L"windowtitle"))
+			{
+				entry.key = Key::Title;
+			}
+			else
+			{
+				valid = false;
+			}
+		}
+
+		if (valid && fields.size() == 6)
+		{
+			wchar_t *end;
+			entry.rule.priority = static_cast<int32_t>(std::wcstol(fields[5].c_str(), &end, 10));
+			valid = !fields[5].empty() && *end == L'\0';
+		}
+
+		if (!valid || !Config::ParseAppearance(fields[2], fields[3], fields[4], entry.rule.appearance))
+		{
+			Log::OutputFormatted(L"Invalid line in application rules file: %ls", line.c_str());
+			continue;
+		}
+
+		entry.value = std::move(fields[1]);
+		entries.push_back(std::move(entry));
+	}
+
+	// Highest priority first, file order between equals. Each key then only needs the first rule that has it.
+	std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b)
+	{
+		return a.rule.priority > b.rule.priority;
+	});
+
+	std::vector<Rule> rules;
+	std::unordered_map<std::wstring, uint32_t> class_rules;
+	Util::string_map<uint32_t> file_rules;
+	std::vector<std::wstring> titles;
+	std::vector<uint32_t> title_indices;
+	for (uint32_t i = 0; i < entries.size(); i++)
+	{
+		Entry &entry = entries[i];
+		rules.push_back(entry.rule);
+
+		switch (entry.key)
+		{
+		case Key::ClassName:
+			class_rules.emplace(std::move(entry.value), i);
+			break;
+		case Key::FileName:
+			file_rules.emplace(std::move(entry.value), i);
+			break;
+		case Key::Title:
+			titles.push_back(std::move(entry.value));
+			title_indices.push_back(i);
+			break;
+		}
+	}
+
+	{
+		std::lock_guard guard(m_Lock);
+		m_Rules = std::move(rules);
+		m_ClassRules = std::move(class_rules);
+		m_FileRules = std::move(file_rules);
+		m_TitleRules = PatternMatcher(titles);
+		m_TitleRuleIndices = std::move(title_indices);
+
+		m_Cache.clear();
+		m_Empty = m_Rules.empty();
+		m_Revision++;
+	}
+
+	m_Generation++;
+
+	if (Config::Current()->VERBOSE)
+	{
+		Log::OutputFormatted(L"Loaded %zu application rules.", entries.size());
+	}
+}
+
+uint32_t AppRules::Evaluate(const std::wstring &classname, const std::wstring &filename, const std::wstring &title, bool &used_title)
+{
+	uint32_t rule = NO_RULE;
+	if (!m_ClassRules.empty())
+	{
+		if (const auto it = m_ClassRules.find(classname); it != m_ClassRules.end())
+		{
+			rule = it->second;
+		}
+	}
+
+	if (!m_FileRules.empty())
+	{
+		if (const auto it = m_FileRules.find(filename); it != m_FileRules.end())
+		{
+			rule = (std::min)(rule, it->second);
+		}
+	}
+
+	// Titles last, they are the most expensive to match.
+	used_title = false;
+	if (!m_TitleRules.empty() && rule != 0)
+	{
+		used_title = true;
+		if (const uint32_t pattern = m_TitleRules.best_match(title); pattern != PatternMatcher::NO_MATCH)
+		{
+			rule = (std::min)(rule, m_TitleRuleIndices[pattern]);
+		}
+	}
+
+	return rule;
+}
+
+std::optional<AppRules::Rule> AppRules::Lookup(const Window &window)
+{
+	if (m_Empty)
+	{
+		return std::nullopt;
+	}
+
+	uint32_t rule;
+	for (;;)
+	{
+		bool classes, files, titles;
+		uint64_t revision;
+		{
+			std::lock_guard guard(m_Lock);
+			if (const auto it = m_Cache.find(window); it != m_Cache.end() && it->second.owner == window.thread_id())
+			{
+				rule = it->second.rule;
+				break;
+			}
+
+			classes = !m_ClassRules.empty();
+			files = !m_FileRules.empty();
+			titles = !m_TitleRules.empty();
+			revision = m_Revision;
+		}
+
+		// Fetched without the lock: getting the title can block on the window, and the hook thread takes the lock
+		// to invalidate verdicts. Copied, since the window cache can change as soon as these return.
+		const std::wstring classname = classes ? window.classname() : std::wstring();
+		const std::wstring filename = files ? window.filename() : std::wstring();
+		const std::wstring title = titles ? window.title() : std::wstring();
+		const DWORD owner = window.thread_id();
+
+		std::lock_guard guard(m_Lock);
+
+		// The rules changed or the verdict got invalidated meanwhile, so what was fetched might be stale or not enough.
+		if (m_Revision != revision)
+		{
+			continue;
+		}
+
+		bool used_title;
+		rule = Evaluate(classname, filename, title, used_title);
+
+		if (m_Cache.size() >= CACHE_CAPACITY)
+		{
+			m_Cache.clear();
+		}
+
+		m_Cache[window] = { rule, used_title, owner };
+		break;
+	}
+
+	if (rule != NO_RULE)
+	{
+		return m_Rules[rule];
+	}
+	else
+	{
+		return std::nullopt;
+	}
+}
+
+void AppRules::SetChangedCallback(const std::function<void()> &callback)
+{
+	// Only set once during startup, before the message loop runs, so no locking needed.
+	m_ChangedCallback = callback;
+}
+
+uint64_t AppRules::Generation()
+{
+	return m_Generation;
+}
+
+void AppRules::ClearCache()
+{
+	std::lock_guard guard(m_Lock);
+	m_Cache = { };
+}
+
+std::size_t AppRules::MemoryUsage()
+{
+	std::lock_guard guard(m_Lock);
+	std::size_t usage = Util::NodeMemoryUsage(m_Cache) + Util::NodeMemoryUsage(m_ClassRules) + Util::NodeMemoryUsage(m_FileRules) + m_Rules.capacity() * sizeof(Rule);
+	for (const auto &[str, _] : m_ClassRules)
+	{
+		usage += Util::MemoryUsage(str);
+	}
+
+	for (const auto &[str, _] : m_FileRules)
+	{
+		usage += Util::MemoryUsage(str);
+	}
+
+	return usage;
+}
+
+void AppRules::InvalidateTitleVerdict(const Window &window)
+{
+	{
+		std::lock_guard guard(m_Lock);
+
+		// Verdicts that didn't look at the title stay valid until the window is destroyed.
+		m_Revision++; // Even without a verdict yet, one might be getting looked up with the old title.
+		const auto it = m_Cache.find(window);
+		if (it == m_Cache.end() || !it->second.title)
+		{
+			return;
+		}
+
+		m_Cache.erase(it);
+	}
+
+	m_Generation++;
+	if (m_ChangedCallback)
+	{
+		m_ChangedCallback();
+	}
+}
+
+void AppRules::Forget(const Window &window)
+{
+	std::lock_guard guard(m_Lock);
+	m_Cache.erase(window);
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "config.hpp"
+#include "patternmatcher.hpp"
+#include "util.hpp"
+#include "window.hpp"
+
+// Appearances forced by the user for some applications, read from the rules file.
+class AppRules {
+
+public:
+	struct Rule {
+		Config::TASKBAR_APPEARANCE appearance;
+		int32_t priority;
+	};
+
+	static void Parse(const std::wstring &file);
+
+	// The highest priority rule matching a window, if any.
+	static std::optional<Rule> Lookup(const Window &window);
+
+	static inline bool Empty()
+	{
+		return m_Empty;
+	}
+
+	// Called every time a verdict that was looked up before might have changed.
+	static void SetChangedCallback(const std::function<void()> &callback);
+
+	// Incremented every time a verdict might have changed.
+	static uint64_t Generation();
+
+	// Forgets the verdicts, they are the same when looked up again.
+	static void ClearCache();
+
+	// Rough heap usage of the cache and the rules, for the diagnostics report.
+	static std::size_t MemoryUsage();
+
+private:
+	static constexpr uint32_t NO_RULE = PatternMatcher::NO_MATCH;
+
+	// Compiled like the blacklist, each key maps to the index of its highest priority rule.
+	static std::vector<Rule> m_Rules; // Sorted by priority, highest first
+	static std::unordered_map<std::wstring, uint32_t> m_ClassRules;
+	static Util::string_map<uint32_t> m_FileRules;
+	static PatternMatcher m_TitleRules;
+	static std::vector<uint32_t> m_TitleRuleIndices; // Of each title pattern
+
+	struct Verdict {
+		uint32_t rule;
+		bool title;  // Depends on the title
+		DWORD owner; // Thread owning the window, a recycled handle has another one
+	};
+
+	// Cleared when full instead of evicting, since verdicts are cheap to get again.
+	static constexpr std::size_t CACHE_CAPACITY = 4096;
+
+	static std::mutex m_Lock;
+	static std::unordered_map<Window, Verdict> m_Cache;
+	static std::atomic_bool m_Empty;
+	static std::atomic_uint64_t m_Generation;
+	static uint64_t m_Revision; // Under m_Lock, incremented when a lookup in progress might be using stale rules or titles
+	static std::function<void()> m_ChangedCallback;
+
+	friend class Hooks;
+
+	static uint32_t Evaluate(const std::wstring &classname, const std::wstring &filename, const std::wstring &title, bool &used_title);
+	static void InvalidateTitleVerdict(const Window &window);
+	static void Forget(const Window &window);
+
+};
\ No newline at end of file
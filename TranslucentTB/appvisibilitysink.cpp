@@ -1,14 +1,23 @@
 #include "appvisibilitysink.hpp"
 
-AppVisibilitySink::AppVisibilitySink(bool &startOpened) : m_startOpenedRef(startOpened) { }
+AppVisibilitySink::AppVisibilitySink(const launcher_callback_t &launcherCallback, const monitor_callback_t &monitorCallback) :
+	m_LauncherCallback(launcherCallback),
+	m_MonitorCallback(monitorCallback)
+{ }
 
 IFACEMETHODIMP AppVisibilitySink::LauncherVisibilityChange(BOOL currentVisibleState)
 {
-	m_startOpenedRef = currentVisibleState;
+	m_LauncherCallback(currentVisibleState);
 	return S_OK;
 }
 
-IFACEMETHODIMP AppVisibilitySink::AppVisibilityOnMonitorChanged(HMONITOR, MONITOR_APP_VISIBILITY, MONITOR_APP_VISIBILITY)
+IFACEMETHODIMP AppVisibilitySink::AppVisibilityOnMonitorChanged(HMONITOR hMonitor, MONITOR_APP_VISIBILITY previousMode, MONITOR_APP_VISIBILITY currentMode)
 {
+	// Start counts as an immersive app, so this tells on which monitor it opened.
+	if (previousMode != currentMode)
+	{
+		m_MonitorCallback(hMonitor, currentMode == MAV_APP_VISIBLE);
+	}
+
 	return S_OK;
 }
\ No newline at end of file
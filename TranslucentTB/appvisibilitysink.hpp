@@ -1,15 +1,21 @@
 #pragma once
+#include <functional>
 #include <ShObjIdl.h>
 #include <winrt/base.h>
 
 class AppVisibilitySink : public winrt::implements<AppVisibilitySink, IAppVisibilityEvents> {
 
+public:
+	using launcher_callback_t = std::function<void(bool visible)>;
+	using monitor_callback_t = std::function<void(HMONITOR monitor, bool app_visible)>;
+
 private:
-	bool &m_startOpenedRef;
+	launcher_callback_t m_LauncherCallback;
+	monitor_callback_t m_MonitorCallback;
 
 public:
-	AppVisibilitySink(bool &startOpened);
+	AppVisibilitySink(const launcher_callback_t &launcherCallback, const monitor_callback_t &monitorCallback);
 	IFACEMETHODIMP LauncherVisibilityChange(BOOL currentVisibleState);
-	IFACEMETHODIMP AppVisibilityOnMonitorChanged(HMONITOR, MONITOR_APP_VISIBILITY, MONITOR_APP_VISIBILITY);
+	IFACEMETHODIMP AppVisibilityOnMonitorChanged(HMONITOR hMonitor, MONITOR_APP_VISIBILITY previousMode, MONITOR_APP_VISIBILITY currentMode);
 
 };
\ No newline at end of file
@@ -7,6 +7,12 @@ winrt::Windows::Foundation::IAsyncOperation<Autostart::StartupState> Autostart::
 {
 	try
 	{
+		// Completes right away once the prefetch is done, so that menu refreshes don't wait.
+		if (const auto task = UWP::TryGetApplicationStartupTask())
+		{
+			co_return task.State();
+		}
+
 		co_return (co_await UWP::GetApplicationStartupTask()).State();
 	}
 	catch (const winrt::hresult_error &error)
@@ -26,7 +32,7 @@ winrt::Windows::Foundation::IAsyncAction Autostart::SetStartupState(StartupState
 			const Autostart::StartupState new_state = co_await task.RequestEnableAsync();
 			if (new_state != state)
 			{
-				Log::OutputMessage(L"Failed to change startup state.");
+				Log::OutputFormatted(L"Failed to change startup state.");
 			}
 		}
 		else if (state == StartupState::Disabled)
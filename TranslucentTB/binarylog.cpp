@@ -0,0 +1,648 @@
+#include "binarylog.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cwchar>
+#include <iterator>
+
+std::size_t BinaryLog::ParseSpecifier(std::wstring_view format, ArgumentType &type)
+{
+	std::size_t i = 1;
+	const auto skip = [&format, &i](std::wstring_view characters)
+	{
+		while (i < format.length() && characters.find(format[i]) != std::wstring_view::npos)
+		{
+			i++;
+		}
+	};
+
+	skip(L"-+ #0");
+	skip(L"0123456789");
+	if (i < format.length() && format[i] == L'.')
+	{
+		i++;
+		skip(L"0123456789");
+	}
+
+	// Length modifiers
+	bool narrow = false, longlong = false, pointer_sized = false;
+	const std::wstring_view rest = format.substr(i);
+	if (rest.compare(0, 3, L"I64") == 0)
+	{
+		longlong = true;
+		i += 3;
+	}
+	else if (rest.compare(0, 3, L"I32") == 0)
+	{
+		i += 3;
+	}
+	else if (rest.compare(0, 2, L"ll") == 0)
+	{
+		longlong = true;
+		i += 2;
+	}
+	else if (rest.compare(0, 2, L"hh") == 0)
+	{
+		i += 2;
+	}
+	else if (!rest.empty())
+	{
+		switch (rest[0])
+		{
+		case L'h':
+			narrow = true;
+			i++;
+			break;
+		case L'l':
+		case L'w':
+			i++; // Strings are wide by default already
+			break;
+		case L'j':
+			longlong = true;
+			i++;
+			break;
+		case L'I':
+		case L'z':
+		case L't':
+			pointer_sized = true;
+			i++;
+			break;
+		case L'L':
+			i++;
+			break;
+		}
+	}
+
+	if (i >= format.length())
+	{
+		return 0;
+	}
+
+	const bool is64 = longlong || (pointer_sized && sizeof(std::size_t) == sizeof(uint64_t));
+	switch (format[i])
+	{
+	case L'd':
+	case L'i':
+		type = is64 ? ArgumentType::Int64 : ArgumentType::Int32;
+		break;
+	case L'u':
+	case L'x':
+	case L'X':
+	case L'o':
+		type = is64 ? ArgumentType::UInt64 : ArgumentType::UInt32;
+		break;
+	case L'c':
+		if (narrow)
+		{
+			return 0;
+		}
+
+		type = ArgumentType::UInt32; // Promoted to int when passed through varargs
+		break;
+	case L'p':
+		type = ArgumentType::Pointer;
+		break;
+	case L'f':
+	case L'F':
+	case L'e':
+	case L'E':
+	case L'g':
+	case L'G':
+	case L'a':
+	case L'A':
+		type = ArgumentType::Double;
+		break;
+	case L's':
+		if (narrow)
+		{
+			return 0; // Would need to be converted, just let the text path handle it.
+		}
+
+		type = ArgumentType::String;
+		break;
+	default:
+		return 0; // %S, %n, %Z and friends
+	}
+
+	return i + 1;
+}
+
+std::size_t BinaryLog::Pack(const wchar_t *const format, va_list args, uint8_t *const buffer, const std::size_t &size)
+{
+	if (size == 0)
+	{
+		return 0;
+	}
+
+	std::size_t used = 1; // First byte is the argument count
+	uint8_t count = 0;
+
+	const auto put = [buffer, &size, &used](const void *data, const std::size_t &length)
+	{
+		if (size - used < length)
+		{
+			return false;
+		}
+
+		std::memcpy(buffer + used, data, length);
+		used += length;
+		return true;
+	};
+
+	const std::wstring_view view(format);
+	for (std::size_t i = 0; i < view.length(); i++)
+	{
+		if (view[i] != L'%')
+		{
+			continue;
+		}
+
+		if (i + 1 < view.length() && view[i + 1] == L'%')
+		{
+			i++;
+			continue;
+		}
+
+		ArgumentType type;
+		const std::size_t length = ParseSpecifier(view.substr(i), type);
+		if (length == 0 || count == UINT8_MAX || !put(&type, sizeof(type)))
+		{
+			return 0;
+		}
+
+		bool success;
+		switch (type)
+		{
+		case ArgumentType::Int32:
+		{
+			const int32_t value = va_arg(args, int32_t);
+			success = put(&value, sizeof(value));
+			break;
+		}
+		case ArgumentType::Int64:
+		{
+			const int64_t value = va_arg(args, int64_t);
+			success = put(&value, sizeof(value));
+			break;
+		}
+		case ArgumentType::UInt32:
+		{
+			const uint32_t value = va_arg(args, uint32_t);
+			success = put(&value, sizeof(value));
+			break;
+		}
+		case ArgumentType::UInt64:
+		{
+			const uint64_t value = va_arg(args, uint64_t);
+			success = put(&value, sizeof(value));
+			break;
+		}
+		case ArgumentType::Double:
+		{
+			const double value = va_arg(args, double);
+			success = put(&value, sizeof(value));
+			break;
+		}
+		case ArgumentType::Pointer:
+		{
+			const uint64_t value = reinterpret_cast<uintptr_t>(va_arg(args, void *));
+			success = put(&value, sizeof(value));
+			break;
+		}
+		case ArgumentType::String:
+		{
+			const wchar_t *str = va_arg(args, const wchar_t *);
+			if (!str)
+			{
+				str = L"(null)";
+			}
+
+			const std::size_t str_length = std::wcslen(str);
+			if (str_length > UINT16_MAX)
+			{
+				return 0;
+			}
+
+			const uint16_t value = static_cast<uint16_t>(str_length);
+			success = put(&value, sizeof(value)) && put(str, str_length * sizeof(wchar_t));
+			break;
+		}
+		default:
+			success = false;
+			break;
+		}
+
+		if (!success)
+		{
+			return 0;
+		}
+
+		count++;
+		i += length - 1;
+	}
+
+	buffer[0] = count;
+	return used;
+}
+
+bool BinaryLog::Unpack(const uint8_t *const buffer, const std::size_t &size, std::vector<Argument> &arguments)
+{
+	arguments.clear();
+	if (size == 0)
+	{
+		return true;
+	}
+
+	std::size_t position = 1;
+	const auto get = [buffer, &size, &position](void *data, const std::size_t &length)
+	{
+		if (size - position < length)
+		{
+			return false;
+		}
+
+		std::memcpy(data, buffer + position, length);
+		position += length;
+		return true;
+	};
+
+	for (uint8_t i = 0; i < buffer[0]; i++)
+	{
+		Argument &argument = arguments.emplace_back();
+		argument.integer = 0;
+		if (!get(&argument.type, sizeof(argument.type)))
+		{
+			return false;
+		}
+
+		switch (argument.type)
+		{
+		case ArgumentType::Int32:
+		{
+			int32_t value;
+			if (!get(&value, sizeof(value)))
+			{
+				return false;
+			}
+
+			argument.integer = static_cast<uint64_t>(static_cast<int64_t>(value));
+			break;
+		}
+		case ArgumentType::UInt32:
+		{
+			uint32_t value;
+			if (!get(&value, sizeof(value)))
+			{
+				return false;
+			}
+
+			argument.integer = value;
+			break;
+		}
+		case ArgumentType::String:
+		{
+			uint16_t length;
+			if (!get(&length, sizeof(length)) || size - position < length * sizeof(wchar_t))
+			{
+				return false;
+			}
+
+			argument.string = std::wstring_view(reinterpret_cast<const wchar_t *>(buffer + position), length);
+			position += length * sizeof(wchar_t);
+			break;
+		}
+		default:
+			// Int64, UInt64, Double and Pointer are all 8 bytes, the union takes care of the type.
+			if (!get(&argument.integer, sizeof(argument.integer)))
+			{
+				return false;
+			}
+			break;
+		}
+	}
+
+	return true;
+}
+
+std::wstring BinaryLog::Format(std::wstring_view format, const std::vector<Argument> &arguments)
+{
+	std::wstring result;
+	std::vector<wchar_t> buffer;
+	std::size_t argument = 0;
+
+	for (std::size_t i = 0; i < format.length(); i++)
+	{
+		if (format[i] != L'%')
+		{
+			result += format[i];
+			continue;
+		}
+
+		if (i + 1 < format.length() && format[i + 1] == L'%')
+		{
+			result += L'%';
+			i++;
+			continue;
+		}
+
+		ArgumentType type;
+		const std::size_t length = ParseSpecifier(format.substr(i), type);
+		if (length == 0 || argument >= arguments.size() || arguments[argument].type != type)
+		{
+			// Shouldn't happen with a file we wrote, print what's left as is.
+			result.append(format.substr(i));
+			break;
+		}
+
+		const std::wstring specifier(format.substr(i, length));
+		const Argument &value = arguments[argument++];
+		buffer.resize(value.string.length() + 512);
+
+		int written;
+		switch (type)
+		{
+		case ArgumentType::Int32:
+			written = _snwprintf_s(buffer.data(), buffer.size(), _TRUNCATE, specifier.c_str(), static_cast<int32_t>(value.integer));
+			break;
+		case ArgumentType::Int64:
+			written = _snwprintf_s(buffer.data(), buffer.size(), _TRUNCATE, specifier.c_str(), static_cast<int64_t>(value.integer));
+			break;
+		case ArgumentType::UInt32:
+			written = _snwprintf_s(buffer.data(), buffer.size(), _TRUNCATE, specifier.c_str(), static_cast<uint32_t>(value.integer));
+			break;
+		case ArgumentType::UInt64:
+			written = _snwprintf_s(buffer.data(), buffer.size(), _TRUNCATE, specifier.c_str(), value.integer);
+			break;
+		case ArgumentType::Double:
+			written = _snwprintf_s(buffer.data(), buffer.size(), _TRUNCATE, specifier.c_str(), value.floating);
+			break;
+		case ArgumentType::Pointer:
+			written = _snwprintf_s(buffer.data(), buffer.size(), _TRUNCATE, specifier.c_str(), reinterpret_cast<void *>(static_cast<uintptr_t>(value.integer)));
+			break;
+		case ArgumentType::String:
+			written = _snwprintf_s(buffer.data(), buffer.size(), _TRUNCATE, specifier.c_str(), std::wstring(value.string).c_str());
+			break;
+		default:
+			written = -1;
+			break;
+		}
+
+		result.append(buffer.data(), written >= 0 ? written : std::wcslen(buffer.data()));
+		i += length - 1;
+	}
+
+	return result;
+}
+
+std::wstring BinaryLog::FormatTime(const std::time_t &time)
+{
+	wchar_t time_str[26];
+	if (_wctime_s(time_str, std::size(time_str), &time) != 0)
+	{
+		return { };
+	}
+
+	time_str[24] = L'\0'; // Remove the newline created by _wctime_s
+	return time_str;
+}
+
+uint32_t BinaryLog::Encoder::intern(std::wstring_view string)
+{
+	if (const auto it = m_Strings.find(std::wstring(string)); it != m_Strings.end())
+	{
+		return it->second;
+	}
+
+	const uint32_t id = static_cast<uint32_t>(m_Strings.size());
+	m_Strings.emplace(string, id);
+
+	write(Record::String);
+	write(id);
+	write(static_cast<uint16_t>(string.length()));
+	const auto bytes = reinterpret_cast<const uint8_t *>(string.data());
+	m_Buffer.insert(m_Buffer.end(), bytes, bytes + string.length() * sizeof(wchar_t));
+
+	return id;
+}
+
+void BinaryLog::Encoder::reset()
+{
+	m_Strings.clear();
+	m_Buffer.assign(std::begin(MAGIC), std::end(MAGIC));
+}
+
+void BinaryLog::Encoder::message(const std::time_t &time, const uint8_t &level, std::wstring_view format, const uint8_t *const arguments, const std::size_t &size)
+{
+	// Strings need to be written before the message that refers to them, so intern everything first.
+	const uint32_t format_id = intern(format);
+
+	uint32_t string_ids[UINT8_MAX];
+	const uint8_t count = size != 0 ? arguments[0] : 0;
+	std::size_t position = 1;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		const ArgumentType type = static_cast<ArgumentType>(arguments[position++]);
+		switch (type)
+		{
+		case ArgumentType::Int32:
+		case ArgumentType::UInt32:
+			position += sizeof(uint32_t);
+			break;
+		case ArgumentType::String:
+		{
+			uint16_t length;
+			std::memcpy(&length, arguments + position, sizeof(length));
+			position += sizeof(length);
+			string_ids[i] = intern(std::wstring_view(reinterpret_cast<const wchar_t *>(arguments + position), length));
+			position += length * sizeof(wchar_t);
+			break;
+		}
+		default:
+			position += sizeof(uint64_t);
+			break;
+		}
+	}
+
+	write(Record::Message);
+	write(static_cast<int64_t>(time));
+	write(level);
+	write(format_id);
+	write(count);
+
+	position = 1;
+	for (uint8_t i = 0; i < count; i++)
+	{
+		const ArgumentType type = static_cast<ArgumentType>(arguments[position++]);
+		write(type);
+
+		switch (type)
+		{
+		case ArgumentType::Int32:
+		case ArgumentType::UInt32:
+			m_Buffer.insert(m_Buffer.end(), arguments + position, arguments + position + sizeof(uint32_t));
+			position += sizeof(uint32_t);
+			break;
+		case ArgumentType::String:
+		{
+			uint16_t length;
+			std::memcpy(&length, arguments + position, sizeof(length));
+			position += sizeof(length) + length * sizeof(wchar_t);
+			write(string_ids[i]);
+			break;
+		}
+		default:
+			m_Buffer.insert(m_Buffer.end(), arguments + position, arguments + position + sizeof(uint64_t));
+			position += sizeof(uint64_t);
+			break;
+		}
+	}
+}
+
+void BinaryLog::Encoder::text(const std::time_t &time, const uint8_t &level, std::wstring_view text)
+{
+	const auto length = static_cast<uint16_t>(std::min<std::size_t>(text.length(), UINT16_MAX));
+
+	write(Record::Text);
+	write(static_cast<int64_t>(time));
+	write(level);
+	write(length);
+
+	const auto bytes = reinterpret_cast<const uint8_t *>(text.data());
+	m_Buffer.insert(m_Buffer.end(), bytes, bytes + length * sizeof(wchar_t));
+}
+
+BinaryLog::Decoder::Decoder(const uint8_t *const data, const std::size_t &size) :
+	m_Position(data),
+	m_End(data + size),
+	m_Valid(false)
+{
+	char magic[sizeof(MAGIC)];
+	if (read(magic))
+	{
+		m_Valid = std::memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+	}
+}
+
+bool BinaryLog::Decoder::next(std::wstring &line)
+{
+	if (!m_Valid)
+	{
+		return false;
+	}
+
+	Record record;
+	while (read(record))
+	{
+		if (record == Record::String)
+		{
+			uint32_t id;
+			uint16_t length;
+			if (!read(id) || !read(length) || static_cast<std::size_t>(m_End - m_Position) < length * sizeof(wchar_t))
+			{
+				return false;
+			}
+
+			std::wstring &string = m_Strings[id];
+			string.resize(length);
+			std::memcpy(string.data(), m_Position, length * sizeof(wchar_t));
+			m_Position += length * sizeof(wchar_t);
+		}
+		else if (record == Record::Message)
+		{
+			int64_t time;
+			uint8_t level, count;
+			uint32_t format_id;
+			if (!read(time) || !read(level) || !read(format_id) || !read(count) || m_Strings.count(format_id) == 0)
+			{
+				return false;
+			}
+
+			std::vector<Argument> arguments(count);
+			for (Argument &argument : arguments)
+			{
+				if (!read(argument.type))
+				{
+					return false;
+				}
+
+				switch (argument.type)
+				{
+				case ArgumentType::Int32:
+				{
+					int32_t value;
+					if (!read(value))
+					{
+						return false;
+					}
+
+					argument.integer = static_cast<uint64_t>(static_cast<int64_t>(value));
+					break;
+				}
+				case ArgumentType::UInt32:
+				{
+					uint32_t value;
+					if (!read(value))
+					{
+						return false;
+					}
+
+					argument.integer = value;
+					break;
+				}
+				case ArgumentType::Int64:
+				case ArgumentType::UInt64:
+				case ArgumentType::Pointer:
+					if (!read(argument.integer))
+					{
+						return false;
+					}
+					break;
+				case ArgumentType::Double:
+					if (!read(argument.floating))
+					{
+						return false;
+					}
+					break;
+				case ArgumentType::String:
+				{
+					uint32_t id;
+					if (!read(id) || m_Strings.count(id) == 0)
+					{
+						return false;
+					}
+
+					argument.string = m_Strings.at(id);
+					break;
+				}
+				default:
+					return false;
+				}
+			}
+
+			line = L'(' + FormatTime(static_cast<std::time_t>(time)) + L") " + Format(m_Strings.at(format_id), arguments);
+			return true;
+		}
+		else if (record == Record::Text)
+		{
+			int64_t time;
+			uint8_t level;
+			uint16_t length;
+			if (!read(time) || !read(level) || !read(length) || static_cast<std::size_t>(m_End - m_Position) < length * sizeof(wchar_t))
+			{
+				return false;
+			}
+
+			line = L'(' + FormatTime(static_cast<std::time_t>(time)) + L") ";
+			const std::size_t prefix = line.length();
+			line.resize(prefix + length);
+			std::memcpy(line.data() + prefix, m_Position, length * sizeof(wchar_t));
+			m_Position += length * sizeof(wchar_t);
+			return true;
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return false;
+}
\ No newline at end of file
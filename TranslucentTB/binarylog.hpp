@@ -0,0 +1,135 @@
+#pragma once
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Compact binary log format. Each message is stored as its printf format and arguments,
+// and every format and string argument is only written once per file, then referred to by ID.
+// Messages that were already formatted are written inline, since they rarely repeat.
+// Doesn't depend on anything else from TranslucentTB, so that LogDecoder can use it too.
+class BinaryLog {
+
+public:
+	static constexpr char MAGIC[8] = { 'T', 'T', 'B', 'L', 'O', 'G', '\0', '\2' }; // Last byte is the version
+	static constexpr wchar_t EXTENSION[] = L".ttblog";
+
+	enum class ArgumentType : uint8_t {
+		Int32,
+		Int64,
+		UInt32,
+		UInt64,
+		Double,
+		Pointer,
+		String
+	};
+
+	struct Argument {
+		ArgumentType type;
+		union {
+			uint64_t integer;
+			double floating;
+		};
+		std::wstring_view string;
+	};
+
+	// Returns the length of the conversion specification at the start of format (which starts with %), 0 if unsupported.
+	// Only the conversions we actually use are supported: d, i, u, x, X, o, c, p, f, e, g, and wide strings.
+	static std::size_t ParseSpecifier(std::wstring_view format, ArgumentType &type);
+
+	// Packs the arguments of a printf call into buffer, without allocating. Returns the amount of bytes used,
+	// or 0 if one of the arguments can't be represented or there's not enough space.
+	static std::size_t Pack(const wchar_t *const format, va_list args, uint8_t *const buffer, const std::size_t &size);
+
+	// Reads back what Pack wrote. Strings point into buffer.
+	static bool Unpack(const uint8_t *const buffer, const std::size_t &size, std::vector<Argument> &arguments);
+
+	// Formats like printf would have, from arguments that came out of Pack or a decoded file.
+	static std::wstring Format(std::wstring_view format, const std::vector<Argument> &arguments);
+
+	// Formats a timestamp like the text log does.
+	static std::wstring FormatTime(const std::time_t &time);
+
+private:
+	enum class Record : uint8_t {
+		String = 1,
+		Message = 2,
+		Text = 3
+	};
+
+public:
+	class Encoder {
+	private:
+		std::unordered_map<std::wstring, uint32_t> m_Strings;
+		std::vector<uint8_t> m_Buffer;
+
+		template<typename T>
+		inline void write(const T &value)
+		{
+			const auto bytes = reinterpret_cast<const uint8_t *>(&value);
+			m_Buffer.insert(m_Buffer.end(), bytes, bytes + sizeof(T));
+		}
+
+		uint32_t intern(std::wstring_view string);
+
+	public:
+		// Starts a new file, forgetting every string written so far.
+		void reset();
+
+		// Arguments as filled by Pack.
+		void message(const std::time_t &time, const uint8_t &level, std::wstring_view format, const uint8_t *const arguments, const std::size_t &size);
+
+		// A message that was already formatted. Not interned, so that one-off lines don't pile up in the string table.
+		void text(const std::time_t &time, const uint8_t &level, std::wstring_view text);
+
+		inline const std::vector<uint8_t> &buffer() const
+		{
+			return m_Buffer;
+		}
+
+		inline void clear_buffer()
+		{
+			m_Buffer.clear();
+		}
+	};
+
+	class Decoder {
+	private:
+		const uint8_t *m_Position;
+		const uint8_t *m_End;
+		bool m_Valid;
+		std::unordered_map<uint32_t, std::wstring> m_Strings;
+
+		template<typename T>
+		inline bool read(T &value)
+		{
+			if (static_cast<std::size_t>(m_End - m_Position) < sizeof(T))
+			{
+				return false;
+			}
+
+			std::memcpy(&value, m_Position, sizeof(T));
+			m_Position += sizeof(T);
+			return true;
+		}
+
+	public:
+		// Data has to outlive the decoder.
+		Decoder(const uint8_t *const data, const std::size_t &size);
+
+		// False if the header is missing or of an unsupported version.
+		inline bool valid() const
+		{
+			return m_Valid;
+		}
+
+		// Decodes the next message, in the same form as the text log (without the line ending).
+		// Returns false when the end of the data is reached, or it's corrupted.
+		bool next(std::wstring &line);
+	};
+};
\ No newline at end of file
@@ -1,30 +1,128 @@
 #include "blacklist.hpp"
+#include <algorithm>
+#include <cstring>
+#include <cwctype>
 #include <fstream>
-#include <sstream>
+#include <utility>
+#include <memoryapi.h>
+#include <WinBase.h>
+#include <winrt/base.h>
 
 #include "config.hpp"
+#include "diagnostics.hpp"
+#include "ttberror.hpp"
 #include "ttblog.hpp"
 #include "util.hpp"
 
-std::vector<std::wstring> Blacklist::m_ClassBlacklist;
-std::vector<std::wstring> Blacklist::m_FileBlacklist;
-std::vector<std::wstring> Blacklist::m_TitleBlacklist;
+std::unordered_set<std::wstring> Blacklist::m_ClassBlacklist;
+Util::string_set Blacklist::m_FileBlacklist;
+PatternMatcher Blacklist::m_TitleBlacklist;
 
 std::recursive_mutex Blacklist::m_CacheLock;
-std::unordered_map<Window, bool> Blacklist::m_Cache;
+std::unordered_map<Window, Blacklist::Verdict> Blacklist::m_Cache;
 
 void Blacklist::Parse(const std::wstring &file)
+{
+	// Everything slow happens before taking the lock, so that lookups don't wait on the disk.
+	Lists lists;
+	WIN32_FILE_ATTRIBUTE_DATA source;
+	const std::wstring index = file + INDEX_EXTENSION;
+
+	// A missing exclude file just means an empty blacklist.
+	if (GetFileAttributesEx(file.c_str(), GetFileExInfoStandard, &source) && !ReadIndex(index, source, lists))
+	{
+		ParseText(file, lists);
+		WriteIndex(index, source, lists);
+	}
+
+	// Compile the list once here, so that matching a window doesn't depend on how long it is.
+	std::unordered_set<std::wstring> classes(lists.classes.begin(), lists.classes.end());
+	Util::string_set files(lists.files.begin(), lists.files.end());
+	PatternMatcher titles(lists.titles);
+
+	{
+		std::lock_guard guard(m_CacheLock);
+		m_ClassBlacklist.swap(classes);
+		m_FileBlacklist.swap(files);
+		std::swap(m_TitleBlacklist, titles);
+		ClearCache();
+	}
+
+	// The old lists get freed here, outside of the lock.
+}
+
+bool Blacklist::IsBlacklisted(const Window &window)
 {
 	std::lock_guard guard(m_CacheLock);
 
-	// Clear our vectors
-	m_ClassBlacklist.clear();
-	m_TitleBlacklist.clear();
-	m_FileBlacklist.clear();
+	if (const auto it = m_Cache.find(window); it != m_Cache.end() && it->second.owner == window.thread_id())
+	{
+		Diagnostics::Increment(Diagnostics::Counter::BlacklistCacheHits);
+		it->second.referenced = true;
+		return it->second.isMatch;
+	}
+	else
+	{
+		Diagnostics::Increment(Diagnostics::Counter::BlacklistCacheMisses);
+		const Diagnostics::Span span(Diagnostics::Stage::Blacklist);
+
+		// This is the fastest because we do the less string manipulation, so always try it first
+		if (!m_ClassBlacklist.empty() && m_ClassBlacklist.count(window.classname()) != 0)
+		{
+			return CacheVerdict(window, true, Rule::ClassName);
+		}
+
+		if (!m_FileBlacklist.empty() && m_FileBlacklist.count(window.filename()) != 0)
+		{
+			return CacheVerdict(window, true, Rule::FileName);
+		}
+
+		// Do it last because titles can change, so it's less reliable.
+		if (!m_TitleBlacklist.empty())
+		{
+			// Even if it doesn't match, the verdict depends on the title now.
+			return CacheVerdict(window, m_TitleBlacklist.matches(window.title()), Rule::Title);
+		}
+
+		return CacheVerdict(window, false, Rule::None);
+	}
+}
+
+void Blacklist::ClearCache()
+{
+	{
+		std::lock_guard guard(m_CacheLock);
+		m_Cache.clear();
+		Diagnostics::Set(Diagnostics::Counter::BlacklistCacheSize, 0);
+	}
+
+	if (Config::Current()->VERBOSE)
+	{
+		Log::OutputFormatted(L"Blacklist cache cleared.");
+	}
+}
+
+std::size_t Blacklist::MemoryUsage()
+{
+	// Only the cache, which is what grows at runtime. The lists are swapped in under the same lock when parsing.
+	std::lock_guard guard(m_CacheLock);
+	return Util::NodeMemoryUsage(m_Cache);
+}
 
+void Blacklist::ParseText(const std::wstring &file, Lists &lists)
+{
 	const wchar_t delimiter = L',';
 	const wchar_t comment = L';';
 
+	// Keys are lowercase ASCII, so only the start of the line needs to be lowercased to check them.
+	const auto begins_with = [](std::wstring_view line, std::wstring_view key)
+	{
+		return line.length() >= key.length() && std::equal(key.begin(), key.end(), line.begin(), [](const wchar_t &k, const wchar_t &c)
+		{
+			return k == static_cast<wchar_t>(std::towlower(c));
+		});
+	};
+
 	std::wifstream excludesfilestream(file);
 	for (std::wstring line; std::getline(excludesfilestream, line);)
 	{
@@ -49,119 +147,220 @@ void Blacklist::Parse(const std::wstring &file)
 			line += delimiter;
 		}
 
-		std::wstring line_lowercase = Util::ToLower(line);
-
-		if (Util::StringBeginsWith(line_lowercase, L"class"))
+		// The file list is case insensitive, so nothing needs to be lowercased.
+		if (begins_with(line, L"class"))
 		{
-			AddToVector(std::move(line), m_ClassBlacklist, delimiter);
+			AddToVector(line, lists.classes, delimiter);
 		}
-		else if (Util::StringBeginsWith(line_lowercase, L"title") || Util::StringBeginsWith(line_lowercase, L"windowtitle"))
+		else if (begins_with(line, L"title") || begins_with(line, L"windowtitle"))
 		{
-			AddToVector(std::move(line), m_TitleBlacklist, delimiter);
+			AddToVector(line, lists.titles, delimiter);
 		}
-		else if (Util::StringBeginsWith(line_lowercase, L"exename"))
+		else if (begins_with(line, L"exename"))
 		{
-			AddToVector(std::move(line_lowercase), m_FileBlacklist, delimiter);
+			AddToVector(line, lists.files, delimiter);
 		}
 		else
 		{
-			Log::OutputMessage(L"Invalid line in dynamic window blacklist file.");
+			Log::OutputFormatted(L"Invalid line in dynamic window blacklist file.");
 		}
 	}
-
-	ClearCache();
 }
 
-bool Blacklist::IsBlacklisted(const Window &window)
+bool Blacklist::ReadIndex(const std::wstring &file, const WIN32_FILE_ATTRIBUTE_DATA &source, Lists &lists)
 {
-	std::lock_guard guard(m_CacheLock);
+	winrt::file_handle handle(CreateFile(file.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL));
+	LARGE_INTEGER size;
+	if (!handle || !GetFileSizeEx(handle.get(), &size) || size.QuadPart < static_cast<LONGLONG>(sizeof(IndexHeader)) || size.QuadPart > UINT32_MAX)
+	{
+		return false; // Not there yet, it just gets written.
+	}
 
-	if (m_Cache.count(window) != 0)
+	winrt::handle mapping(CreateFileMapping(handle.get(), NULL, PAGE_READONLY, 0, 0, NULL));
+	const auto view = mapping ? static_cast<const uint8_t *>(MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, 0)) : nullptr;
+	if (!view)
 	{
-		return m_Cache.at(window);
+		LastErrorHandle(Error::Level::Log, L"Failed to map the blacklist index.");
+		return false;
 	}
-	else
+
+	const std::size_t length = static_cast<std::size_t>(size.QuadPart);
+	std::size_t offset = sizeof(IndexHeader);
+	const auto read_list = [view, length, &offset](const uint32_t &count, std::vector<std::wstring> &list)
 	{
-		// This is the fastest because we do the less string manipulation, so always try it first
-		if (m_ClassBlacklist.size() > 0)
+		list.reserve(count);
+		for (uint32_t i = 0; i < count; i++)
 		{
-			for (const std::wstring &value : m_ClassBlacklist)
+			uint32_t characters;
+			if (length - offset < sizeof(characters))
 			{
-				if (*window.classname() == value)
-				{
-					return OutputMatchToLog(window, m_Cache[window] = true);
-				}
+				return false;
 			}
-		}
 
-		if (m_FileBlacklist.size() > 0)
-		{
-			for (const std::wstring &value : m_FileBlacklist)
+			std::memcpy(&characters, view + offset, sizeof(characters));
+			offset += sizeof(characters);
+			if ((length - offset) / sizeof(wchar_t) < characters)
 			{
-				if (Util::IgnoreCaseStringEquals(*window.filename(), value))
-				{
-					return OutputMatchToLog(window, m_Cache[window] = true);
-				}
+				return false;
 			}
+
+			std::wstring &entry = list.emplace_back(characters, L'\0');
+			std::memcpy(entry.data(), view + offset, characters * sizeof(wchar_t));
+			offset += characters * sizeof(wchar_t);
 		}
 
-		// Do it last because titles can change, so it's less reliable.
-		if (m_TitleBlacklist.size() > 0)
+		return true;
+	};
+
+	IndexHeader header;
+	std::memcpy(&header, view, sizeof(header));
+	const bool fresh = header.magic == INDEX_MAGIC && header.version == INDEX_VERSION &&
+		CompareFileTime(&header.source_write_time, &source.ftLastWriteTime) == 0 &&
+		header.source_size == ((static_cast<uint64_t>(source.nFileSizeHigh) << 32) | source.nFileSizeLow);
+
+	const bool loaded = fresh && read_list(header.class_count, lists.classes) && read_list(header.title_count, lists.titles) && read_list(header.file_count, lists.files);
+	UnmapViewOfFile(view);
+
+	if (!loaded)
+	{
+		lists = { };
+	}
+	else if (Config::Current()->VERBOSE)
+	{
+		Log::OutputFormatted(L"Loaded the blacklist from its index.");
+	}
+
+	return loaded;
+}
+
+void Blacklist::WriteIndex(const std::wstring &file, const WIN32_FILE_ATTRIBUTE_DATA &source, const Lists &lists)
+{
+	const IndexHeader header = {
+		INDEX_MAGIC,
+		INDEX_VERSION,
+		source.ftLastWriteTime,
+		(static_cast<uint64_t>(source.nFileSizeHigh) << 32) | source.nFileSizeLow,
+		static_cast<uint32_t>(lists.classes.size()),
+		static_cast<uint32_t>(lists.titles.size()),
+		static_cast<uint32_t>(lists.files.size())
+	};
+
+	std::vector<uint8_t> buffer(sizeof(header));
+	std::memcpy(buffer.data(), &header, sizeof(header));
+	for (const auto list : { &lists.classes, &lists.titles, &lists.files })
+	{
+		for (const std::wstring &entry : *list)
 		{
-			for (const std::wstring &value : m_TitleBlacklist)
-			{
-				if (window.title()->find(value) != std::wstring::npos)
-				{
-					return OutputMatchToLog(window, m_Cache[window] = true);
-				}
-			}
+			const uint32_t characters = static_cast<uint32_t>(entry.length());
+			const auto length = reinterpret_cast<const uint8_t *>(&characters);
+			const auto data = reinterpret_cast<const uint8_t *>(entry.data());
+			buffer.insert(buffer.end(), length, length + sizeof(characters));
+			buffer.insert(buffer.end(), data, data + characters * sizeof(wchar_t));
 		}
+	}
+
+	// Written aside and moved in place, so that a crash never leaves half an index that looks fresh.
+	const std::wstring temporary = file + L".tmp";
+	{
+		winrt::file_handle handle(CreateFile(temporary.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
+		DWORD written;
+		if (!handle || !WriteFile(handle.get(), buffer.data(), static_cast<DWORD>(buffer.size()), &written, NULL) || written != buffer.size())
+		{
+			LastErrorHandle(Error::Level::Log, L"Failed to write the blacklist index.");
+			return;
+		}
+	}
 
-		return OutputMatchToLog(window, m_Cache[window] = false);
+	if (!MoveFileEx(temporary.c_str(), file.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to replace the blacklist index.");
+		DeleteFile(temporary.c_str());
 	}
 }
 
-void Blacklist::ClearCache()
+void Blacklist::AddToVector(std::wstring_view line, std::vector<std::wstring> &vector, const wchar_t &delimiter)
 {
+	// First lets skip the key
+	std::size_t start = line.find(delimiter);
+	if (start == std::wstring_view::npos)
 	{
-		std::lock_guard guard(m_CacheLock);
-		m_Cache.clear();
+		return;
 	}
 
-	if (Config::VERBOSE)
+	// Now iterate and add the values
+	for (std::size_t end; (end = line.find(delimiter, ++start)) != std::wstring_view::npos; start = end)
 	{
-		Log::OutputMessage(L"Blacklist cache cleared.");
+		vector.push_back(Util::Trim(std::wstring(line.substr(start, end - start))));
 	}
 }
 
-void Blacklist::AddToVector(std::wstring line, std::vector<std::wstring> &vector, const wchar_t &delimiter)
+bool Blacklist::CacheVerdict(const Window &window, const bool &isMatch, const Rule &rule)
 {
-	size_t pos;
+	if (m_Cache.size() >= CACHE_CAPACITY && m_Cache.count(window) == 0)
+	{
+		EvictUnused();
+	}
 
-	// First lets remove the key
-	if ((pos = line.find(delimiter)) != std::wstring::npos)
+	// A stale verdict of a recycled handle just gets replaced.
+	m_Cache[window] = { isMatch, rule, window.thread_id(), true };
+	Diagnostics::Set(Diagnostics::Counter::BlacklistCacheSize, m_Cache.size());
+
+	if (Config::Current()->VERBOSE)
 	{
-		line.erase(0, pos + 1);
+		Log::OutputFormatted(L"%lslacklist match found for window: %p [%ls] [%ls] [%ls]", isMatch ? L"B" : L"No b",
+			window.handle(), window.classname().c_str(), window.filename().c_str(), window.title().c_str());
 	}
 
-	// Now iterate and add the values
-	while ((pos = line.find(delimiter)) != std::wstring::npos)
+	return isMatch;
+}
+
+void Blacklist::InvalidateTitleVerdict(const Window &window)
+{
+	std::lock_guard guard(m_CacheLock);
+
+	// Verdicts decided by class or file name stay valid until the window is destroyed.
+	if (const auto it = m_Cache.find(window); it != m_Cache.end() && it->second.rule == Rule::Title)
 	{
-		vector.push_back(Util::Trim(line.substr(0, pos)));
-		line.erase(0, pos + 1);
+		m_Cache.erase(it);
 	}
 }
 
-const bool &Blacklist::OutputMatchToLog(const Window &window, const bool &isMatch)
+void Blacklist::Forget(const Window &window)
 {
-	if (Config::VERBOSE)
+	std::lock_guard guard(m_CacheLock);
+	m_Cache.erase(window);
+	Diagnostics::Set(Diagnostics::Counter::BlacklistCacheSize, m_Cache.size());
+}
+
+void Blacklist::EvictUnused()
+{
+	// Same second chance sweep as the window cache.
+	const auto sweep = []
 	{
-		std::wostringstream message;
-		message << (isMatch ? L"B" : L"No b") << L"lacklist match found for window: ";
-		message << window.handle() << L" [" << *window.classname() << L"] [" << *window.filename() << L"] [" << *window.title() << L']';
+		std::size_t evicted = 0;
+		for (auto it = m_Cache.begin(); it != m_Cache.end();)
+		{
+			const bool keep = it->second.referenced && it->second.owner == it->first.thread_id();
+			it->second.referenced = false;
+			if (keep)
+			{
+				it++;
+			}
+			else
+			{
+				it = m_Cache.erase(it);
+				evicted++;
+			}
+		}
 
-		Log::OutputMessage(message.str());
+		return evicted;
+	};
+
+	std::size_t evicted = sweep();
+	if (evicted == 0)
+	{
+		evicted = sweep();
 	}
 
-	return isMatch;
+	Diagnostics::Increment(Diagnostics::Counter::CacheEvictions, evicted);
 }
\ No newline at end of file
@@ -1,31 +1,88 @@
 #pragma once
+#include "arch.h"
 #include <cstdint>
+#include <fileapi.h>
 #include <mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "eventhook.hpp"
+#include "patternmatcher.hpp"
+#include "util.hpp"
 #include "window.hpp"
 
 class Blacklist {
 
 public:
+	// Same reasons as the window cache to bound it.
+	static constexpr std::size_t CACHE_CAPACITY = 4096;
+
+	// The parsed lists get saved next to the exclude file with this appended, and are loaded
+	// from there instead as long as the exclude file didn't change, so big lists don't get parsed again.
+	static constexpr wchar_t INDEX_EXTENSION[] = L".index";
+
 	static void Parse(const std::wstring &file);
 	static bool IsBlacklisted(const Window &window);
 	static void ClearCache();
 
+	// Rough heap usage of the cache, for the diagnostics report.
+	static std::size_t MemoryUsage();
+
 private:
-	static std::vector<std::wstring> m_ClassBlacklist;
-	static std::vector<std::wstring> m_FileBlacklist;
-	static std::vector<std::wstring> m_TitleBlacklist;
+	static std::unordered_set<std::wstring> m_ClassBlacklist;
+	static Util::string_set m_FileBlacklist;
+	static PatternMatcher m_TitleBlacklist;
+
+	// What decided a verdict, so that title changes only invalidate verdicts that looked at the title.
+	enum class Rule : uint8_t {
+		None,
+		ClassName,
+		FileName,
+		Title
+	};
+
+	struct Verdict {
+		bool isMatch;
+		Rule rule;
+		DWORD owner;     // Thread owning the window, a recycled handle has another one
+		bool referenced; // Used since the last eviction sweep
+	};
 
 	static std::recursive_mutex m_CacheLock;
-	static std::unordered_map<Window, bool> m_Cache;
+	static std::unordered_map<Window, Verdict> m_Cache;
+
+	struct Lists {
+		std::vector<std::wstring> classes;
+		std::vector<std::wstring> titles;
+		std::vector<std::wstring> files;
+	};
+
+	// Followed by the class, title and file lists, each entry being its length as an uint32_t and then its UTF-16 characters.
+	struct IndexHeader {
+		uint32_t magic;
+		uint32_t version;
+		FILETIME source_write_time; // Of the exclude file the lists were parsed from
+		uint64_t source_size;
+		uint32_t class_count;
+		uint32_t title_count;
+		uint32_t file_count;
+	};
+
+	static constexpr uint32_t INDEX_MAGIC = 0x58425454; // TTBX
+	static constexpr uint32_t INDEX_VERSION = 1;
 
 	friend class Hooks;
 
-	static void AddToVector(std::wstring line, std::vector<std::wstring> &vector, const wchar_t &delimiter = L',');
-	static const bool &OutputMatchToLog(const Window &window, const bool &isMatch);
+	static void ParseText(const std::wstring &file, Lists &lists);
+	static bool ReadIndex(const std::wstring &file, const WIN32_FILE_ATTRIBUTE_DATA &source, Lists &lists);
+	static void WriteIndex(const std::wstring &file, const WIN32_FILE_ATTRIBUTE_DATA &source, const Lists &lists);
+	static void AddToVector(std::wstring_view line, std::vector<std::wstring> &vector, const wchar_t &delimiter = L',');
+	static bool CacheVerdict(const Window &window, const bool &isMatch, const Rule &rule);
+	static void InvalidateTitleVerdict(const Window &window);
+	static void Forget(const Window &window);
+	static void EvictUnused();
 
 };
\ No newline at end of file
@@ -22,6 +22,9 @@ static constexpr wchar_t CONFIG_FILE[] = L"config.cfg";
 // Dynamic windows exclude file name
 static constexpr wchar_t EXCLUDE_FILE[] = L"dynamic-ws-exclude.csv";
 
+// Per application appearance rules file name
+static constexpr wchar_t RULES_FILE[] = L"app-rules.csv";
+
 // Message sent by explorer when the taskbar is created
 static constexpr wchar_t WM_TASKBARCREATED[] = L"TaskbarCreated";
 
@@ -1,181 +1,404 @@
 #include "config.hpp"
 #include <fstream>
 #include <iomanip>
+#include <iterator>
 #include <sstream>
+#include <stdexcept>
 
 #include "common.hpp"
 #include "ttblog.hpp"
-#include "util.hpp"
 #include "win32.hpp"
 
-// Defaults
+// Options, in the order they are saved.
+constexpr Config::Option Config::OPTIONS[] = {
+	// Regular
+	{ L"accent", Kind::Accent, offsetof(Config, REGULAR_APPEARANCE.ACCENT), nullptr, L"accent values are: clear (default), fluent (only on build 17063 and up), opaque, normal, or blur.", false },
+	{ L"color", Kind::Color, offsetof(Config, REGULAR_APPEARANCE.COLOR), nullptr, L"A color in hexadecimal notation.", false },
+	{ L"tint", Kind::Color, offsetof(Config, REGULAR_APPEARANCE.COLOR), nullptr, nullptr, true },
+	{ L"opacity", Kind::Opacity, offsetof(Config, REGULAR_APPEARANCE.COLOR), nullptr, L"A value in the range 0 to 255.", false },
+
+	// Maximised
+	{ L"dynamic-ws", Kind::Bool, offsetof(Config, MAXIMISED_ENABLED), L"\n; Dynamic Modes\n; they all have their own accent, color and opacity configs.\n\n; Dynamic Windows. State to use when a window is maximised.\n", nullptr, false },
+	{ L"dynamic-ws-accent", Kind::Accent, offsetof(Config, MAXIMISED_APPEARANCE.ACCENT), nullptr, nullptr, false },
+	{ L"dynamic-ws-color", Kind::Color, offsetof(Config, MAXIMISED_APPEARANCE.COLOR), nullptr, L"A color in hexadecimal notation.", false },
+	{ L"dynamic-ws-tint", Kind::Color, offsetof(Config, MAXIMISED_APPEARANCE.COLOR), nullptr, nullptr, true },
+	{ L"dynamic-ws-opacity", Kind::Opacity, offsetof(Config, MAXIMISED_APPEARANCE.COLOR), nullptr, L"A value in the range 0 to 255.", false },
+	{ L"dynamic-ws-regular-on-peek", Kind::Bool, offsetof(Config, MAXIMISED_REGULAR_ON_PEEK), nullptr, L"when using aero peek, behave as if no window was maximised.", false },
+
+	// Start menu
+	{ L"dynamic-start", Kind::Bool, offsetof(Config, START_ENABLED), L"\n; Dynamic Start. State to use when the start menu is opened.\n", nullptr, false },
+	{ L"dynamic-start-accent", Kind::Accent, offsetof(Config, START_APPEARANCE.ACCENT), nullptr, nullptr, false },
+	{ L"dynamic-start-color", Kind::Color, offsetof(Config, START_APPEARANCE.COLOR), nullptr, L"A color in hexadecimal notation.", false },
+	{ L"dynamic-start-tint", Kind::Color, offsetof(Config, START_APPEARANCE.COLOR), nullptr, nullptr, true },
+	{ L"dynamic-start-opacity", Kind::Opacity, offsetof(Config, START_APPEARANCE.COLOR), nullptr, L"A value in the range 0 to 255.", false },
+
+	// Cortana
+	{ L"dynamic-cortana", Kind::Bool, offsetof(Config, CORTANA_ENABLED), L"\n; Dynamic Cortana. State to use when Cortana or the search menu is opened.\n", nullptr, false },
+	{ L"dynamic-cortana-accent", Kind::Accent, offsetof(Config, CORTANA_APPEARANCE.ACCENT), nullptr, nullptr, false },
+	{ L"dynamic-cortana-color", Kind::Color, offsetof(Config, CORTANA_APPEARANCE.COLOR), nullptr, L"A color in hexadecimal notation.", false },
+	{ L"dynamic-cortana-tint", Kind::Color, offsetof(Config, CORTANA_APPEARANCE.COLOR), nullptr, nullptr, true },
+	{ L"dynamic-cortana-opacity", Kind::Opacity, offsetof(Config, CORTANA_APPEARANCE.COLOR), nullptr, L"A value in the range 0 to 255.", false },
+
+	// Timeline/Task View
+	{ L"dynamic-timeline", Kind::Bool, offsetof(Config, TIMELINE_ENABLED), L"\n; Dynamic Timeline. State to use when the timeline (or task view on older builds) is opened.\n", nullptr, false },
+	{ L"dynamic-timeline-accent", Kind::Accent, offsetof(Config, TIMELINE_APPEARANCE.ACCENT), nullptr, nullptr, false },
+	{ L"dynamic-timeline-color", Kind::Color, offsetof(Config, TIMELINE_APPEARANCE.COLOR), nullptr, L"A color in hexadecimal notation.", false },
+	{ L"dynamic-timeline-tint", Kind::Color, offsetof(Config, TIMELINE_APPEARANCE.COLOR), nullptr, nullptr, true },
+	{ L"dynamic-timeline-opacity", Kind::Opacity, offsetof(Config, TIMELINE_APPEARANCE.COLOR), nullptr, L"A value in the range 0 to 255.", false },
+
+	// Peek
+	{ L"peek", Kind::Peek, offsetof(Config, PEEK), L"\n; Controls how the Aero Peek button behaves (dynamic, show or hide)\n", nullptr, false },
+	{ L"peek-only-main", Kind::Bool, offsetof(Config, PEEK_ONLY_MAIN), nullptr, L"Decides wether only the main monitor is considered when dynamic peek is enabled.", false },
+
+	// Advanced
+	{ L"sleep-time", Kind::Byte, offsetof(Config, SLEEP_TIME), L"\n; Advanced settings\n; sleep time in milliseconds right after something changed, a shorter time reduces flicker when opening start, but results in higher CPU usage. Slows down to once a second when idle.\n", nullptr, false },
+	{ L"event-driven", Kind::Bool, offsetof(Config, EVENT_DRIVEN), L"; only update the taskbar when windows change instead of constantly polling. Disable if the taskbar sometimes fails to update.\n", nullptr, false },
+	{ L"transition-time", Kind::Short, offsetof(Config, TRANSITION_TIME), L"; time in milliseconds to fade between colors when only the color changes, 0 to switch instantly. Not done while saving power.\n", nullptr, false },
+	{ L"lean-memory", Kind::Bool, offsetof(Config, LEAN_MEMORY), L"; give memory back after a few minutes without activity, at the cost of some work when activity resumes. Only done when event-driven.\n", nullptr, false },
+	{ L"no-tray", Kind::Bool, offsetof(Config, NO_TRAY), L"; hide icon in system tray. Changes to this requires a restart of the application.\n", nullptr, false },
+	{ L"verbose", Kind::Bool, offsetof(Config, VERBOSE), L"; more informative logging. Can make huge log files.\n", nullptr, false },
+	{ L"binary-log", Kind::Bool, offsetof(Config, BINARY_LOG), L"; write the log in a compact binary format, which LogDecoder turns back into text. Changes to this requires a restart of the application.\n", nullptr, false },
+	{ L"control-pipe", Kind::Bool, offsetof(Config, CONTROL_PIPE), L"; let management tools reconfigure and query this instance through a local named pipe. Changes to this requires a restart of the application.\n", nullptr, false },
+	{ L"record-events", Kind::Bool, offsetof(Config, RECORD_EVENTS), L"; record what the taskbar appearance reacts to in events.ttbtrace, next to this file, for the Replay tool. Changes to this requires a restart of the application.\n", nullptr, false }
+};
+
+// The accent comment above hardcodes it.
+static_assert(MIN_FLUENT_BUILD == 17063);
+
+constexpr wchar_t Config::ToLower(wchar_t character)
+{
+	// Keys and values are all ASCII.
+	return character >= L'A' && character <= L'Z' ? character - L'A' + L'a' : character;
+}
+
+constexpr bool Config::KeyEquals(std::wstring_view left, std::wstring_view right)
+{
+	if (left.length() != right.length())
+	{
+		return false;
+	}
+
+	for (std::size_t i = 0; i < left.length(); i++)
+	{
+		if (ToLower(left[i]) != ToLower(right[i]))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+constexpr uint32_t Config::HashKey(std::wstring_view key, uint32_t seed)
+{
+	// FNV-1a
+	uint32_t hash = 2166136261u ^ seed;
+	for (const wchar_t character : key)
+	{
+		hash ^= ToLower(character);
+		hash *= 16777619u;
+	}
 
-// Regular
-Config::TASKBAR_APPEARANCE Config::REGULAR_APPEARANCE = { swca::ACCENT::ACCENT_ENABLE_TRANSPARENTGRADIENT, 0x0 };
+	return hash;
+}
 
-// Maximised
-bool Config::MAXIMISED_ENABLED = true;
-Config::TASKBAR_APPEARANCE Config::MAXIMISED_APPEARANCE = { swca::ACCENT::ACCENT_ENABLE_GRADIENT, 0xaa000000 };
-bool Config::MAXIMISED_REGULAR_ON_PEEK = true;
+constexpr uint32_t Config::FindSeed()
+{
+	for (uint32_t seed = 0; seed < 1000; seed++)
+	{
+		bool used[SLOT_COUNT] = { };
+		bool collision = false;
+		for (const Option &option : OPTIONS)
+		{
+			bool &slot = used[HashKey(option.key, seed) % SLOT_COUNT];
+			if (slot)
+			{
+				collision = true;
+				break;
+			}
 
-// Start
-bool Config::START_ENABLED = true;
-Config::TASKBAR_APPEARANCE Config::START_APPEARANCE = { swca::ACCENT::ACCENT_NORMAL, 0x0 };
+			slot = true;
+		}
 
-// Cortana
-bool Config::CORTANA_ENABLED = true;
-Config::TASKBAR_APPEARANCE Config::CORTANA_APPEARANCE = { swca::ACCENT::ACCENT_NORMAL, 0x0 };
+		if (!collision)
+		{
+			return seed;
+		}
+	}
+
+	return UINT32_MAX;
+}
 
-// Timeline/Task View
-bool Config::TIMELINE_ENABLED = true;
-Config::TASKBAR_APPEARANCE Config::TIMELINE_APPEARANCE = { swca::ACCENT::ACCENT_NORMAL, 0x0 };
+constexpr std::array<uint8_t, Config::SLOT_COUNT> Config::BuildSlots(uint32_t seed)
+{
+	// 0 is an empty slot, otherwise the index in OPTIONS plus one.
+	std::array<uint8_t, SLOT_COUNT> slots = { };
+	for (std::size_t i = 0; i < std::size(OPTIONS); i++)
+	{
+		slots[HashKey(OPTIONS[i].key, seed) % SLOT_COUNT] = static_cast<uint8_t>(i + 1);
+	}
 
-// Peek
-enum Config::PEEK Config::PEEK = PEEK::Dynamic;
-bool Config::PEEK_ONLY_MAIN = true;
+	return slots;
+}
 
-// Advanced
-uint8_t Config::SLEEP_TIME = 10;
-bool Config::NO_TRAY = false;
-bool Config::VERBOSE =
-#ifndef _DEBUG
-	false;
-#else
-	true;
-#endif
+constexpr uint32_t Config::SLOT_SEED = FindSeed();
+constexpr std::array<uint8_t, Config::SLOT_COUNT> Config::SLOTS = BuildSlots(SLOT_SEED);
 
 std::mutex Config::m_ConfigLock;
 
-void Config::Parse(const std::wstring &file)
+std::shared_ptr<const Config> Config::Current()
+{
+	return std::atomic_load(&GetCurrentStorage());
+}
+
+void Config::Update(const std::function<void(Config &)> &modifier)
 {
 	std::lock_guard guard(m_ConfigLock);
 
+	Config config = *Current();
+	modifier(config);
+	Publish(std::move(config));
+}
+
+void Config::Parse(const std::wstring &file)
+{
 	std::wifstream configstream(file);
-	for (std::wstring line; std::getline(configstream, line);)
+	const std::wstring contents((std::istreambuf_iterator<wchar_t>(configstream)), std::istreambuf_iterator<wchar_t>());
+
+	ParseText(contents);
+}
+
+void Config::ParseText(std::wstring_view contents)
+{
+	std::lock_guard guard(m_ConfigLock);
+
+	Config config;
+	std::wstring_view remaining = contents;
+	while (!remaining.empty())
 	{
-		if (line.empty())
-		{
-			continue;
-		}
+		const std::size_t line_end = remaining.find(L'\n');
+		std::wstring_view line = remaining.substr(0, line_end);
+		remaining.remove_prefix(line_end != std::wstring_view::npos ? line_end + 1 : remaining.length());
 
 		// Skip comments
-		size_t comment_index = line.find(L';');
-		if (comment_index == 0)
+		const std::size_t comment_index = line.find(L';');
+		if (comment_index != std::wstring_view::npos)
 		{
-			continue;
+			line.remove_suffix(line.length() - comment_index);
 		}
-		else if (comment_index != std::wstring::npos)
+
+		line = Trim(line);
+		if (line.empty())
 		{
-			line.erase(comment_index);
+			continue;
 		}
 
-		size_t split_index = line.find(L'=');
-		if (split_index != std::wstring::npos)
+		const std::size_t split_index = line.find(L'=');
+		if (split_index != std::wstring_view::npos)
 		{
-			Util::ToLowerInplace(line);
-			const std::wstring key = Util::Trim(line.substr(0, split_index));
-			const std::wstring val = Util::Trim(line.substr(split_index + 1, line.length() - split_index - 1));
+			const std::wstring_view key = Trim(line.substr(0, split_index));
+			const std::wstring_view value = Trim(line.substr(split_index + 1));
 
-			ParseSingleConfigOption(key, val);
+			if (const Option *const option = FindOption(key))
+			{
+				if (!ParseValue(config, *option, value))
+				{
+					UnknownValue(key, value);
+				}
+			}
+			else
+			{
+				Log::OutputFormatted(L"Unknown key found in configuration file: %ls", std::wstring(key).c_str());
+			}
 		}
 		else
 		{
-			Log::OutputMessage(L"Invalid line in configuration file: " + line);
+			Log::OutputFormatted(L"Invalid line in configuration file: %ls", std::wstring(line).c_str());
 		}
 	}
+
+	Publish(std::move(config));
 }
 
 void Config::Save(const std::wstring &file)
 {
 	std::lock_guard guard(m_ConfigLock);
 
+	const auto config = Current();
+	std::wstring contents;
+	for (const Option &option : OPTIONS)
+	{
+		if (option.alias)
+		{
+			continue;
+		}
+
+		if (option.header)
+		{
+			contents += option.header;
+		}
+
+		contents.append(option.key) += L'=';
+
+		const std::wstring value = GetValueText(*config, option);
+		contents += value;
+		if (option.comment)
+		{
+			// Align the comments of short values.
+			if (value.length() < 6)
+			{
+				contents.append(6 - value.length(), L' ');
+			}
+
+			contents += L" ; ";
+			contents += option.comment;
+		}
+
+		contents += L'\n';
+	}
+
 	std::wofstream configstream(file);
+	configstream << contents;
+}
+
+void Config::Publish(Config &&config)
+{
+	// m_ConfigLock needs to be held.
+	config.VERSION = Current()->VERSION + 1;
+	std::atomic_store(&GetCurrentStorage(), std::make_shared<const Config>(std::move(config)));
+}
+
+const Config::Option *Config::FindOption(std::wstring_view key)
+{
+	static_assert(SLOT_SEED != UINT32_MAX, "No perfect hash seed found for the configuration keys, increase SLOT_COUNT");
+	static_assert(std::size(OPTIONS) < UINT8_MAX, "Too many configuration keys for the slot table");
 
-	configstream << L"accent=" << std::left << std::setw(6) << std::setfill(L' ') << GetAccentText(REGULAR_APPEARANCE.ACCENT) << L"; accent values are: clear (default), fluent (only on build " << MIN_FLUENT_BUILD << L" and up), opaque, normal, or blur." << std::endl;
-	configstream << L"color=" << GetColorText(REGULAR_APPEARANCE.COLOR) << L" ; A color in hexadecimal notation." << std::endl;
-	configstream << L"opacity=" << GetOpacityText(REGULAR_APPEARANCE.COLOR) << L"  ; A value in the range 0 to 255." << std::endl;
-
-	configstream << std::endl;
-	configstream << L"; Dynamic Modes" << std::endl;
-	configstream << L"; they all have their own accent, color and opacity configs." << std::endl;
-	configstream << std::endl;
-	configstream << L"; Dynamic Windows. State to use when a window is maximised." << std::endl;
-	configstream << L"dynamic-ws=" << GetBoolText(MAXIMISED_ENABLED) << std::endl;
-	configstream << L"dynamic-ws-accent=" << GetAccentText(MAXIMISED_APPEARANCE.ACCENT) << std::endl;
-	configstream << L"dynamic-ws-color=" << GetColorText(MAXIMISED_APPEARANCE.COLOR) << L" ; A color in hexadecimal notation." << std::endl;
-	configstream << L"dynamic-ws-opacity=" << GetOpacityText(MAXIMISED_APPEARANCE.COLOR) << L"  ; A value in the range 0 to 255." << std::endl;
-	configstream << L"dynamic-ws-regular-on-peek=" << GetBoolText(MAXIMISED_REGULAR_ON_PEEK) << L" ; when using aero peek, behave as if no window was maximised." << std::endl;
-	configstream << std::endl;
-	configstream << L"; Dynamic Start. State to use when the start menu is opened." << std::endl;
-	configstream << L"dynamic-start=" << GetBoolText(START_ENABLED) << std::endl;
-	configstream << L"dynamic-start-accent=" << GetAccentText(START_APPEARANCE.ACCENT) << std::endl;
-	configstream << L"dynamic-start-color=" << GetColorText(START_APPEARANCE.COLOR) << L" ; A color in hexadecimal notation." << std::endl;
-	configstream << L"dynamic-start-opacity=" << GetOpacityText(START_APPEARANCE.COLOR) << L"  ; A value in the range 0 to 255." << std::endl;
-	configstream << std::endl;
-	configstream << L"; Dynamic Cortana. State to use when Cortana or the search menu is opened." << std::endl;
-	configstream << L"dynamic-cortana=" << GetBoolText(CORTANA_ENABLED) << std::endl;
-	configstream << L"dynamic-cortana-accent=" << GetAccentText(CORTANA_APPEARANCE.ACCENT) << std::endl;
-	configstream << L"dynamic-cortana-color=" << GetColorText(CORTANA_APPEARANCE.COLOR) << L" ; A color in hexadecimal notation." << std::endl;
-	configstream << L"dynamic-cortana-opacity=" << GetOpacityText(CORTANA_APPEARANCE.COLOR) << L"  ; A value in the range 0 to 255." << std::endl;
-	configstream << std::endl;
-	configstream << L"; Dynamic Timeline. State to use when the timeline (or task view on older builds) is opened." << std::endl;
-	configstream << L"dynamic-timeline=" << GetBoolText(TIMELINE_ENABLED) << std::endl;
-	configstream << L"dynamic-timeline-accent=" << GetAccentText(TIMELINE_APPEARANCE.ACCENT) << std::endl;
-	configstream << L"dynamic-timeline-color=" << GetColorText(TIMELINE_APPEARANCE.COLOR) << L" ; A color in hexadecimal notation." << std::endl;
-	configstream << L"dynamic-timeline-opacity=" << "100" << L"  ; A value in the range 0 to 255." << std::endl;
-
-	configstream << std::endl;
-	configstream << L"; Controls how the Aero Peek button behaves (dynamic, show or hide)" << std::endl;
-	configstream << L"peek=";
-	switch (PEEK)
+	const uint8_t slot = SLOTS[HashKey(key, SLOT_SEED) % SLOT_COUNT];
+	if (slot != 0)
 	{
-	case PEEK::Disabled:
-		configstream << L"hide";
-		break;
-	case PEEK::Dynamic:
-		configstream << L"dynamic";
-		break;
-	case PEEK::Enabled:
-		configstream << L"show";
-		break;
-	}
-	configstream << std::endl;
-	configstream << L"peek-only-main=" << GetBoolText(PEEK_ONLY_MAIN) << L" ; Decides wether only the main monitor is considered when dynamic peek is enabled." << std::endl;
-
-	configstream << std::endl;
-	configstream << L"; Advanced settings" << std::endl;
-	configstream << L"; sleep time in milliseconds, a shorter time reduces flicker when opening start, but results in higher CPU usage." << std::endl;
-	configstream << L"sleep-time=" << std::dec << SLEEP_TIME << std::endl;
-	configstream << L"; hide icon in system tray. Changes to this requires a restart of the application." << std::endl;
-	configstream << L"no-tray=" << GetBoolText(NO_TRAY) << std::endl;
-	configstream << L"; more informative logging. Can make huge log files." << std::endl;
-	configstream << L"verbose=" << GetBoolText(VERBOSE) << std::endl;
+		const Option &option = OPTIONS[slot - 1];
+		if (KeyEquals(option.key, key))
+		{
+			return &option;
+		}
+	}
+
+	return nullptr;
 }
 
-void Config::UnknownValue(const std::wstring &key, const std::wstring &value)
+std::wstring_view Config::Trim(std::wstring_view str)
 {
-	Log::OutputMessage(L"Unknown value found in configuration file: " + value + L" (for key: " + key + L')');
+	static constexpr std::wstring_view whitespace = L" \t\r";
+
+	const std::size_t first = str.find_first_not_of(whitespace);
+	if (first == std::wstring_view::npos)
+	{
+		return { };
+	}
+
+	const std::size_t last = str.find_last_not_of(whitespace);
+	return str.substr(first, last - first + 1);
 }
 
-bool Config::ParseAccent(const std::wstring &value, swca::ACCENT &accent)
+bool Config::ParseNumber(std::wstring_view value, uint32_t base, uint32_t &number)
 {
-	if (value == L"blur")
+	if (value.empty())
+	{
+		return false;
+	}
+
+	uint64_t result = 0;
+	for (const wchar_t character : value)
+	{
+		uint32_t digit;
+		if (character >= L'0' && character <= L'9')
+		{
+			digit = character - L'0';
+		}
+		else if (ToLower(character) >= L'a' && ToLower(character) <= L'f')
+		{
+			digit = ToLower(character) - L'a' + 10;
+		}
+		else
+		{
+			return false;
+		}
+
+		if (digit >= base)
+		{
+			return false;
+		}
+
+		result = result * base + digit;
+		if (result > UINT32_MAX)
+		{
+			return false;
+		}
+	}
+
+	number = static_cast<uint32_t>(result);
+	return true;
+}
+
+void Config::UnknownValue(std::wstring_view key, std::wstring_view value)
+{
+	Log::OutputFormatted(L"Unknown value found in configuration file: %ls (for key: %ls)", std::wstring(value).c_str(), std::wstring(key).c_str());
+}
+
+bool Config::ParseValue(Config &config, const Option &option, std::wstring_view value)
+{
+	switch (option.kind)
+	{
+	case Kind::Bool:
+		return ParseBool(value, GetField<bool>(config, option));
+	case Kind::Accent:
+		return ParseAccent(value, GetField<swca::ACCENT>(config, option));
+	case Kind::Color:
+		return ParseColor(value, GetField<uint32_t>(config, option));
+	case Kind::Opacity:
+		return ParseOpacity(value, GetField<uint32_t>(config, option));
+	case Kind::Peek:
+		return ParsePeek(value, GetField<enum PEEK>(config, option));
+	case Kind::Byte:
+		return ParseByte(value, GetField<uint8_t>(config, option));
+	case Kind::Short:
+		return ParseShort(value, GetField<uint16_t>(config, option));
+	default:
+		return false;
+	}
+}
+
+bool Config::ParseAppearance(std::wstring_view accent, std::wstring_view color, std::wstring_view opacity, TASKBAR_APPEARANCE &appearance)
+{
+	TASKBAR_APPEARANCE result = { };
+	if (!ParseAccent(Trim(accent), result.ACCENT) || !ParseColor(Trim(color), result.COLOR) || !ParseOpacity(Trim(opacity), result.COLOR))
+	{
+		return false;
+	}
+
+	appearance = result;
+	return true;
+}
+
+bool Config::ParseAccent(std::wstring_view value, swca::ACCENT &accent)
+{
+	if (KeyEquals(value, L"blur"))
 	{
 		accent = swca::ACCENT::ACCENT_ENABLE_BLURBEHIND;
 	}
-	else if (value == L"opaque")
+	else if (KeyEquals(value, L"opaque"))
 	{
 		accent = swca::ACCENT::ACCENT_ENABLE_GRADIENT;
 	}
-	else if (value == L"transparent" || value == L"translucent" || value == L"clear")
+	else if (KeyEquals(value, L"transparent") || KeyEquals(value, L"translucent") || KeyEquals(value, L"clear"))
 	{
 		accent = swca::ACCENT::ACCENT_ENABLE_TRANSPARENTGRADIENT;
 	}
-	else if (value == L"normal")
+	else if (KeyEquals(value, L"normal"))
 	{
 		accent = swca::ACCENT::ACCENT_NORMAL;
 	}
-	else if (value == L"fluent" && win32::IsAtLeastBuild(MIN_FLUENT_BUILD))
+	else if (KeyEquals(value, L"fluent") && win32::IsAtLeastBuild(MIN_FLUENT_BUILD))
 	{
 		accent = swca::ACCENT::ACCENT_ENABLE_FLUENT;
 	}
@@ -187,54 +410,54 @@ bool Config::ParseAccent(const std::wstring &value, swca::ACCENT &accent)
 	return true;
 }
 
-bool Config::ParseColor(std::wstring value, uint32_t &color)
+bool Config::ParseColor(std::wstring_view value, uint32_t &color)
 {
-	Util::TrimInplace(value);
-
-	Util::RemovePrefixInplace(value, L"#");
-	Util::RemovePrefixInplace(value, L"0x");
+	if (!value.empty() && value.front() == L'#')
+	{
+		value.remove_prefix(1);
+	}
+	else if (value.length() >= 2 && KeyEquals(value.substr(0, 2), L"0x"))
+	{
+		value.remove_prefix(2);
+	}
 
 	// Get only the last 6 characters, keeps compatibility with old version.
 	// It stored AARRGGBB in color, but now we store it as RRGGBB.
 	// We read AA from opacity instead, which the old version also saved alpha to.
 	if (value.length() > 6)
 	{
-		value.erase(0, 2);
+		value.remove_prefix(2);
 	}
 
-	try
-	{
-		color = (color & 0xFF000000) + (std::stoi(value, nullptr, 16) & 0x00FFFFFF);
-	}
-	catch (std::invalid_argument)
+	uint32_t rgb;
+	if (!ParseNumber(value, 16, rgb))
 	{
 		return false;
 	}
 
+	color = (color & 0xFF000000) + (rgb & 0x00FFFFFF);
 	return true;
 }
 
-bool Config::ParseOpacity(const std::wstring &value, uint32_t &color)
+bool Config::ParseOpacity(std::wstring_view value, uint32_t &color)
 {
-	try
-	{
-		color = ((std::stoi(value) & 0xFF) << 24) + (color & 0x00FFFFFF);
-		return true;
-	}
-	catch (std::invalid_argument)
+	uint32_t opacity;
+	if (!ParseNumber(value, 10, opacity) || opacity > 0xFF)
 	{
-		Log::OutputMessage(L"Could not parse opacity found in configuration file: " + value);
 		return false;
 	}
+
+	color = (opacity << 24) + (color & 0x00FFFFFF);
+	return true;
 }
 
-bool Config::ParseBool(const std::wstring &value, bool &setting)
+bool Config::ParseBool(std::wstring_view value, bool &setting)
 {
-	if (value == L"true" || value == L"enable")
+	if (KeyEquals(value, L"true") || KeyEquals(value, L"enable"))
 	{
 		setting = true;
 	}
-	else if (value == L"false" || value == L"disable")
+	else if (KeyEquals(value, L"false") || KeyEquals(value, L"disable"))
 	{
 		setting = false;
 	}
@@ -246,202 +469,72 @@ bool Config::ParseBool(const std::wstring &value, bool &setting)
 	return true;
 }
 
-void Config::ParseSingleConfigOption(const std::wstring &arg, const std::wstring &value)
+bool Config::ParsePeek(std::wstring_view value, enum PEEK &peek)
 {
-	if (arg == L"accent")
-	{
-		if (!ParseAccent(value, REGULAR_APPEARANCE.ACCENT))
-		{
-			UnknownValue(arg, value);
-		}
-	}
-	else if (arg == L"color" || arg == L"tint")
-	{
-		if (!ParseColor(value, REGULAR_APPEARANCE.COLOR))
-		{
-			Log::OutputMessage(L"Could not parse color found in configuration file: " + value);
-		}
-	}
-	else if (arg == L"opacity")
-	{
-		if (!ParseOpacity(value, REGULAR_APPEARANCE.COLOR))
-		{
-			Log::OutputMessage(L"Could not parse opacity found in configuration file: " + value);
-		}
-	}
-	else if (arg == L"dynamic-ws")
-	{
-		if (!ParseBool(value, MAXIMISED_ENABLED))
-		{
-			UnknownValue(arg, value);
-		}
-	}
-	else if (arg == L"dynamic-ws-accent")
-	{
-		if (!ParseAccent(value, MAXIMISED_APPEARANCE.ACCENT))
-		{
-			UnknownValue(arg, value);
-		}
-	}
-	else if (arg == L"dynamic-ws-color" || arg == L"dynamic-ws-tint")
-	{
-		if (!ParseColor(value, MAXIMISED_APPEARANCE.COLOR))
-		{
-			Log::OutputMessage(L"Could not parse dynamic windows color found in configuration file: " + value);
-		}
-	}
-	else if (arg == L"dynamic-ws-opacity")
-	{
-		if (!ParseOpacity(value, MAXIMISED_APPEARANCE.COLOR))
-		{
-			Log::OutputMessage(L"Could not parse dynamic windows opacity found in configuration file: " + value);
-		}
-	}
-	else if (arg == L"dynamic-ws-regular-on-peek")
-	{
-		if (!ParseBool(value, MAXIMISED_REGULAR_ON_PEEK))
-		{
-			UnknownValue(arg, value);
-		}
-	}
-	else if (arg == L"dynamic-start")
-	{
-		if (!ParseBool(value, START_ENABLED))
-		{
-			UnknownValue(arg, value);
-		}
-	}
-	else if (arg == L"dynamic-start-accent")
-	{
-		if (!ParseAccent(value, START_APPEARANCE.ACCENT))
-		{
-			UnknownValue(arg, value);
-		}
-	}
-	else if (arg == L"dynamic-start-color" || arg == L"dynamic-start-tint")
-	{
-		if (!ParseColor(value, START_APPEARANCE.COLOR))
-		{
-			Log::OutputMessage(L"Could not parse dynamic start color found in configuration file: " + value);
-		}
-	}
-	else if (arg == L"dynamic-start-opacity")
-	{
-		if (!ParseOpacity(value, START_APPEARANCE.COLOR))
-		{
-			Log::OutputMessage(L"Could not parse dynamic start opacity found in configuration file: " + value);
-		}
-	}
-	else if (arg == L"dynamic-cortana")
+	if (KeyEquals(value, L"hide"))
 	{
-		if (!ParseBool(value, CORTANA_ENABLED))
-		{
-			UnknownValue(arg, value);
-		}
+		peek = PEEK::Disabled;
 	}
-	else if (arg == L"dynamic-cortana-accent")
+	else if (KeyEquals(value, L"dynamic"))
 	{
-		if (!ParseAccent(value, CORTANA_APPEARANCE.ACCENT))
-		{
-			UnknownValue(arg, value);
-		}
+		peek = PEEK::Dynamic;
 	}
-	else if (arg == L"dynamic-cortana-color" || arg == L"dynamic-cortana-tint")
+	else if (KeyEquals(value, L"show"))
 	{
-		if (!ParseColor(value, CORTANA_APPEARANCE.COLOR))
-		{
-			Log::OutputMessage(L"Could not parse dynamic Cortana color found in configuration file: " + value);
-		}
+		peek = PEEK::Enabled;
 	}
-	else if (arg == L"dynamic-cortana-opacity")
-	{
-		if (!ParseOpacity(value, CORTANA_APPEARANCE.COLOR))
-		{
-			Log::OutputMessage(L"Could not parse dynamic Cortana opacity found in configuration file: " + value);
-		}
-	}
-	else if (arg == L"dynamic-timeline")
-	{
-		if (!ParseBool(value, TIMELINE_ENABLED))
-		{
-			UnknownValue(arg, value);
-		}
-	}
-	else if (arg == L"dynamic-timeline-accent")
-	{
-		if (!ParseAccent(value, TIMELINE_APPEARANCE.ACCENT))
-		{
-			UnknownValue(arg, value);
-		}
-	}
-	else if (arg == L"dynamic-timeline-color" || arg == L"dynamic-timeline-tint")
-	{
-		if (!ParseColor(value, TIMELINE_APPEARANCE.COLOR))
-		{
-			Log::OutputMessage(L"Could not parse dynamic timeline color found in configuration file: " + value);
-		}
-	}
-	else if (arg == L"dynamic-timeline-opacity")
-	{
-		if (!ParseOpacity(value, TIMELINE_APPEARANCE.COLOR))
-		{
-			Log::OutputMessage(L"Could not parse dynamic timeline opacity found in configuration file: " + value);
-		}
-	}
-	else if (arg == L"peek")
-	{
-		if (value == L"hide")
-		{
-			PEEK = PEEK::Disabled;
-		}
-		else if (value == L"dynamic")
-		{
-			PEEK = PEEK::Dynamic;
-		}
-		else if (value == L"show")
-		{
-			PEEK = PEEK::Enabled;
-		}
-		else
-		{
-			UnknownValue(arg, value);
-		}
-	}
-	else if (arg == L"peek-only-main")
-	{
-		if (!ParseBool(value, PEEK_ONLY_MAIN))
-		{
-			UnknownValue(arg, value);
-		}
-	}
-	else if (arg == L"sleep-time")
+	else
 	{
-		try
-		{
-			SLEEP_TIME = std::stoi(value) & 0xFF;
-		}
-		catch (std::invalid_argument)
-		{
-			Log::OutputMessage(L"Could not parse sleep time found in configuration file: " + value);
-		}
+		return false;
 	}
-	else if (arg == L"no-tray")
+
+	return true;
+}
+
+bool Config::ParseByte(std::wstring_view value, uint8_t &setting)
+{
+	uint32_t number;
+	if (!ParseNumber(value, 10, number) || number > 0xFF)
 	{
-		if (!ParseBool(value, NO_TRAY))
-		{
-			UnknownValue(arg, value);
-		}
+		return false;
 	}
-	else if (arg == L"verbose")
+
+	setting = static_cast<uint8_t>(number);
+	return true;
+}
+
+bool Config::ParseShort(std::wstring_view value, uint16_t &setting)
+{
+	uint32_t number;
+	if (!ParseNumber(value, 10, number) || number > 0xFFFF)
 	{
-		if (!ParseBool(value, VERBOSE))
-		{
-			UnknownValue(arg, value);
-		}
+		return false;
 	}
-	else
-	{
-		Log::OutputMessage(L"Unknown key found in configuration file: " + arg);
+
+	setting = static_cast<uint16_t>(number);
+	return true;
+}
+
+std::wstring Config::GetValueText(const Config &config, const Option &option)
+{
+	switch (option.kind)
+	{
+	case Kind::Bool:
+		return GetBoolText(GetField<bool>(config, option));
+	case Kind::Accent:
+		return GetAccentText(GetField<swca::ACCENT>(config, option));
+	case Kind::Color:
+		return GetColorText(GetField<uint32_t>(config, option));
+	case Kind::Opacity:
+		return GetOpacityText(GetField<uint32_t>(config, option));
+	case Kind::Peek:
+		return GetPeekText(GetField<enum PEEK>(config, option));
+	case Kind::Byte:
+		return std::to_wstring(GetField<uint8_t>(config, option));
+	case Kind::Short:
+		return std::to_wstring(GetField<uint16_t>(config, option));
+	default:
+		throw std::invalid_argument("option kind was not one of the known values");
 	}
 }
 
@@ -473,12 +566,25 @@ std::wstring Config::GetColorText(const uint32_t &color)
 
 std::wstring Config::GetOpacityText(const uint32_t &color)
 {
-	std::wostringstream stream;
-	stream << std::left << std::setw(3) << std::setfill(L' ') << std::dec << ((color & 0xFF000000) >> 24);
-	return stream.str();
+	return std::to_wstring((color & 0xFF000000) >> 24);
 }
 
 std::wstring Config::GetBoolText(const bool &value)
 {
 	return value ? L"enable" : L"disable";
+}
+
+std::wstring Config::GetPeekText(const enum PEEK &peek)
+{
+	switch (peek)
+	{
+	case PEEK::Disabled:
+		return L"hide";
+	case PEEK::Dynamic:
+		return L"dynamic";
+	case PEEK::Enabled:
+		return L"show";
+	default:
+		throw std::invalid_argument("peek was not one of the known values");
+	}
 }
\ No newline at end of file
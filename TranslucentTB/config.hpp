@@ -1,10 +1,16 @@
 #pragma once
+#include <array>
+#include <cstddef>
 #include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
 #include <string>
+#include <string_view>
 
 #include "swcadata.hpp"
 
+// An instance is one immutable version of the settings, see Current.
 class Config {
 
 public:
@@ -13,54 +19,143 @@ public:
 		uint32_t     COLOR;
 	};
 
+	// Incremented every time new settings get published.
+	uint64_t VERSION = 0;
+
 	// Regular
-	static TASKBAR_APPEARANCE REGULAR_APPEARANCE;
+	TASKBAR_APPEARANCE REGULAR_APPEARANCE = { swca::ACCENT::ACCENT_ENABLE_TRANSPARENTGRADIENT, 0x0 };
 
 	// Maximised
-	static bool MAXIMISED_ENABLED;
-	static TASKBAR_APPEARANCE MAXIMISED_APPEARANCE;
-	static bool MAXIMISED_REGULAR_ON_PEEK;
+	bool MAXIMISED_ENABLED = true;
+	TASKBAR_APPEARANCE MAXIMISED_APPEARANCE = { swca::ACCENT::ACCENT_ENABLE_GRADIENT, 0xaa000000 };
+	bool MAXIMISED_REGULAR_ON_PEEK = true;
 
 	// Start menu
-	static bool START_ENABLED;
-	static TASKBAR_APPEARANCE START_APPEARANCE;
+	bool START_ENABLED = true;
+	TASKBAR_APPEARANCE START_APPEARANCE = { swca::ACCENT::ACCENT_NORMAL, 0x0 };
 
 	// Cortana
-	static bool CORTANA_ENABLED;
-	static TASKBAR_APPEARANCE CORTANA_APPEARANCE;
+	bool CORTANA_ENABLED = true;
+	TASKBAR_APPEARANCE CORTANA_APPEARANCE = { swca::ACCENT::ACCENT_NORMAL, 0x0 };
 
 	// Timeline/Task View
-	static bool TIMELINE_ENABLED;
-	static TASKBAR_APPEARANCE TIMELINE_APPEARANCE;
+	bool TIMELINE_ENABLED = true;
+	TASKBAR_APPEARANCE TIMELINE_APPEARANCE = { swca::ACCENT::ACCENT_NORMAL, 0x0 };
 
 	// Peek
-	static enum /*class*/ PEEK {
+	enum /*class*/ PEEK {
 		Disabled, // Hide the button
 		Dynamic,  // Show when a window is maximised
 		Enabled   // Don't hide the button
-	} PEEK;
-	static bool PEEK_ONLY_MAIN;
+	} PEEK = PEEK::Dynamic;
+	bool PEEK_ONLY_MAIN = true;
 
 	// Advanced
-	static uint8_t SLEEP_TIME;
-	static bool NO_TRAY;
-	static bool VERBOSE;
+	uint8_t SLEEP_TIME = 10;
+	bool EVENT_DRIVEN = true;
+	uint16_t TRANSITION_TIME = 0;
+	bool LEAN_MEMORY = false;
+	bool NO_TRAY = false;
+	bool VERBOSE =
+#ifndef _DEBUG
+		false;
+#else
+		true;
+#endif
+	bool BINARY_LOG = false;
+	bool CONTROL_PIPE = false;
+	bool RECORD_EVENTS = false;
+
+	// The settings currently in effect. They never change once published, so take them once
+	// and use them for a whole operation to get a consistent view. Safe from any thread.
+	static std::shared_ptr<const Config> Current();
 
+	// Publishes a modified copy of the current settings.
+	static void Update(const std::function<void(Config &)> &modifier);
+
+	// Publishes the settings found in a file, or in text in the same format, with defaults for what's missing.
 	static void Parse(const std::wstring &file);
+	static void ParseText(std::wstring_view contents);
 	static void Save(const std::wstring &file);
 
+	// Same syntax as the accent, color and opacity keys, for other files that describe appearances.
+	static bool ParseAppearance(std::wstring_view accent, std::wstring_view color, std::wstring_view opacity, TASKBAR_APPEARANCE &appearance);
+
 private:
+	enum class Kind {
+		Bool,
+		Accent,
+		Color,
+		Opacity,
+		Peek,
+		Byte,
+		Short
+	};
+
+	struct Option {
+		std::wstring_view key;
+		Kind kind;
+		std::size_t offset;     // Where the setting is in Config.
+		const wchar_t *header;  // Comment lines written before the option when saving.
+		const wchar_t *comment; // Comment written after the value when saving.
+		bool alias;             // Only accepted when parsing, never saved.
+	};
+
+	// Keys are looked up with a perfect hash, computed at compile time from the options table.
+	static constexpr std::size_t SLOT_COUNT = 512;
+
+	static const Option OPTIONS[];
+	static const uint32_t SLOT_SEED;
+	static const std::array<uint8_t, SLOT_COUNT> SLOTS;
+
+	// Serializes publishers, readers don't need it.
 	static std::mutex m_ConfigLock;
 
-	static void UnknownValue(const std::wstring &key, const std::wstring &value);
-	static bool ParseAccent(const std::wstring &value, swca::ACCENT &accent);
-	static bool ParseColor(std::wstring value, uint32_t &color);
-	static bool ParseOpacity(const std::wstring &value, uint32_t &color);
-	static bool ParseBool(const std::wstring &value, bool &setting);
-	static void ParseSingleConfigOption(const std::wstring &arg, const std::wstring &value);
+	// As function because static initialization order. Only access through std::atomic_load and std::atomic_store.
+	inline static std::shared_ptr<const Config> &GetCurrentStorage()
+	{
+		static std::shared_ptr<const Config> current = std::make_shared<const Config>();
+		return current;
+	}
+
+	static void Publish(Config &&config);
+
+	template<typename T>
+	inline static T &GetField(Config &config, const Option &option)
+	{
+		return *reinterpret_cast<T *>(reinterpret_cast<uint8_t *>(&config) + option.offset);
+	}
+
+	template<typename T>
+	inline static const T &GetField(const Config &config, const Option &option)
+	{
+		return *reinterpret_cast<const T *>(reinterpret_cast<const uint8_t *>(&config) + option.offset);
+	}
+
+	static constexpr wchar_t ToLower(wchar_t character);
+	static constexpr bool KeyEquals(std::wstring_view left, std::wstring_view right);
+	static constexpr uint32_t HashKey(std::wstring_view key, uint32_t seed);
+	static constexpr uint32_t FindSeed();
+	static constexpr std::array<uint8_t, SLOT_COUNT> BuildSlots(uint32_t seed);
+	static const Option *FindOption(std::wstring_view key);
+
+	static std::wstring_view Trim(std::wstring_view str);
+	static bool ParseNumber(std::wstring_view value, uint32_t base, uint32_t &number);
+
+	static void UnknownValue(std::wstring_view key, std::wstring_view value);
+	static bool ParseValue(Config &config, const Option &option, std::wstring_view value);
+	static bool ParseAccent(std::wstring_view value, swca::ACCENT &accent);
+	static bool ParseColor(std::wstring_view value, uint32_t &color);
+	static bool ParseOpacity(std::wstring_view value, uint32_t &color);
+	static bool ParseBool(std::wstring_view value, bool &setting);
+	static bool ParsePeek(std::wstring_view value, enum PEEK &peek);
+	static bool ParseByte(std::wstring_view value, uint8_t &setting);
+	static bool ParseShort(std::wstring_view value, uint16_t &setting);
 
+	static std::wstring GetValueText(const Config &config, const Option &option);
 	static std::wstring GetAccentText(const swca::ACCENT &accent);
 	static std::wstring GetColorText(const uint32_t &color);
 	static std::wstring GetOpacityText(const uint32_t &color);
 	static std::wstring GetBoolText(const bool &value);
+	static std::wstring GetPeekText(const enum PEEK &peek);
 };
\ No newline at end of file
@@ -0,0 +1,314 @@
+#include "controlpipe.hpp"
+#include <cstring>
+#include <processthreadsapi.h>
+#include <sddl.h>
+#include <securitybaseapi.h>
+#include <WinBase.h>
+
+#include "autofree.hpp"
+#include "ttberror.hpp"
+
+std::wstring ControlPipe::GetSecurityDescriptor()
+{
+	// Full access for the system and administrators, where management agents run, and the user we run as.
+	std::wstring sddl = L"D:P(A;;GA;;;SY)(A;;GA;;;BA)";
+
+	winrt::handle token;
+	if (!OpenProcessToken(GetCurrentProcess(), TOKEN_QUERY, token.put()))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to open process token.");
+		return sddl;
+	}
+
+	DWORD size = 0;
+	GetTokenInformation(token.get(), TokenUser, NULL, 0, &size);
+	std::vector<uint8_t> buffer(size);
+	if (!GetTokenInformation(token.get(), TokenUser, buffer.data(), size, &size))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to get process user.");
+		return sddl;
+	}
+
+	AutoFree::Local<wchar_t> sid;
+	if (!ConvertSidToStringSid(reinterpret_cast<const TOKEN_USER *>(buffer.data())->User.Sid, sid.put()))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to convert process user to a string.");
+		return sddl;
+	}
+
+	return sddl.append(L"(A;;GA;;;").append(sid.get()).append(L")");
+}
+
+bool ControlPipe::Start(const std::function<BOOL()> &operation)
+{
+	std::lock_guard guard(m_Lock);
+	if (m_Stopping)
+	{
+		SetLastError(ERROR_OPERATION_ABORTED);
+		return false;
+	}
+
+	StartThreadpoolIo(m_Io);
+	if (!operation())
+	{
+		const DWORD error = GetLastError();
+		if (error != ERROR_IO_PENDING)
+		{
+			// Nothing got queued, so no callback is coming.
+			CancelThreadpoolIo(m_Io);
+			SetLastError(error);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void ControlPipe::Connect()
+{
+	m_State = State::Connecting;
+	if (!Start([this] { return ConnectNamedPipe(m_Pipe.get(), &m_Overlapped); }))
+	{
+		switch (GetLastError())
+		{
+		case ERROR_PIPE_CONNECTED:
+			// A client connected between creating the pipe and now.
+			OnCompleted(ERROR_SUCCESS, 0);
+			break;
+
+		case ERROR_NO_DATA:
+			// A client connected and left already.
+			Disconnect();
+			break;
+
+		case ERROR_OPERATION_ABORTED:
+			break;
+
+		default:
+			LastErrorHandle(Error::Level::Log, L"Failed to wait for a control pipe client.");
+		}
+	}
+}
+
+void ControlPipe::Read(void *buffer, const DWORD &size)
+{
+	m_ReadBuffer = static_cast<uint8_t *>(buffer);
+	m_ReadRemaining = size;
+	if (!Start([this] { return ReadFile(m_Pipe.get(), m_ReadBuffer, m_ReadRemaining, NULL, &m_Overlapped); }))
+	{
+		const DWORD error = GetLastError();
+		if (error != ERROR_OPERATION_ABORTED)
+		{
+			if (error != ERROR_BROKEN_PIPE)
+			{
+				LastErrorHandle(Error::Level::Log, L"Failed to read from the control pipe.");
+			}
+
+			Disconnect();
+		}
+	}
+}
+
+void ControlPipe::Reply(const HRESULT &result, const std::vector<uint8_t> &payload, const bool &close)
+{
+	const ResponseHeader header = { result, static_cast<uint32_t>(payload.size()) };
+	m_Reply.resize(sizeof(header) + payload.size());
+	std::memcpy(m_Reply.data(), &header, sizeof(header));
+	std::memcpy(m_Reply.data() + sizeof(header), payload.data(), payload.size());
+
+	m_State = close ? State::Closing : State::Writing;
+	if (!Start([this] { return WriteFile(m_Pipe.get(), m_Reply.data(), static_cast<DWORD>(m_Reply.size()), NULL, &m_Overlapped); }))
+	{
+		const DWORD error = GetLastError();
+		if (error != ERROR_OPERATION_ABORTED)
+		{
+			if (error != ERROR_NO_DATA)
+			{
+				LastErrorHandle(Error::Level::Log, L"Failed to write to the control pipe.");
+			}
+
+			Disconnect();
+		}
+	}
+}
+
+void ControlPipe::Disconnect()
+{
+	SetThreadpoolTimer(m_Timer, NULL, 0, 0);
+	if (!DisconnectNamedPipe(m_Pipe.get()))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to disconnect a control pipe client.");
+	}
+
+	Connect();
+}
+
+void ControlPipe::ArmTimeout()
+{
+	// Negative means relative, in 100 nanoseconds intervals.
+	ULARGE_INTEGER due;
+	due.QuadPart = static_cast<ULONGLONG>(-REQUEST_TIMEOUT * 10000);
+	FILETIME due_time = { due.LowPart, due.HighPart };
+	SetThreadpoolTimer(m_Timer, &due_time, 0, 0);
+}
+
+void ControlPipe::OnCompleted(const ULONG &result, const ULONG_PTR &transferred)
+{
+	if (result != ERROR_SUCCESS)
+	{
+		// Aborted means stopping or the client timed out, broken means the client went away.
+		if (result == ERROR_OPERATION_ABORTED)
+		{
+			std::lock_guard guard(m_Lock);
+			if (m_Stopping)
+			{
+				return;
+			}
+		}
+		else if (result != ERROR_BROKEN_PIPE && result != ERROR_NO_DATA)
+		{
+			ErrorHandle(HRESULT_FROM_WIN32(result), Error::Level::Log, L"Control pipe operation failed.");
+		}
+
+		Disconnect();
+		return;
+	}
+
+	switch (m_State)
+	{
+	case State::Connecting:
+	case State::Writing:
+		// Wait for the next request, the client closing the pipe ends the wait.
+		ArmTimeout();
+		m_State = State::ReadingHeader;
+		Read(&m_Request, sizeof(m_Request));
+		break;
+
+	case State::ReadingHeader:
+	case State::ReadingPayload:
+		m_ReadRemaining -= static_cast<DWORD>(transferred);
+		if (m_ReadRemaining != 0)
+		{
+			Read(m_ReadBuffer + transferred, m_ReadRemaining);
+		}
+		else if (m_State == State::ReadingHeader && m_Request.size != 0)
+		{
+			if (m_Request.size > MAX_PAYLOAD)
+			{
+				// We can't tell where the next request would start, so drop the client.
+				Reply(HRESULT_FROM_WIN32(ERROR_INVALID_DATA), { }, true);
+				break;
+			}
+
+			m_Payload.resize(m_Request.size);
+			m_State = State::ReadingPayload;
+			Read(m_Payload.data(), m_Request.size);
+		}
+		else
+		{
+			if (m_State == State::ReadingHeader)
+			{
+				m_Payload.clear();
+			}
+
+			std::vector<uint8_t> reply;
+			const HRESULT hr = m_Handler(m_Request.command, m_Payload, reply);
+			Reply(hr, reply, false);
+		}
+		break;
+
+	case State::Closing:
+		Disconnect();
+		break;
+	}
+}
+
+void CALLBACK ControlPipe::IoCallback(PTP_CALLBACK_INSTANCE, void *context, void *, ULONG result, ULONG_PTR transferred, PTP_IO)
+{
+	static_cast<ControlPipe *>(context)->OnCompleted(result, transferred);
+}
+
+void CALLBACK ControlPipe::TimerCallback(PTP_CALLBACK_INSTANCE, void *context, PTP_TIMER)
+{
+	// Makes the pending read fail, which disconnects the client.
+	const auto pipe = static_cast<ControlPipe *>(context);
+	CancelIoEx(pipe->m_Pipe.get(), &pipe->m_Overlapped);
+}
+
+ControlPipe::ControlPipe(const handler_t &handler) :
+	m_Overlapped { },
+	m_Io(nullptr),
+	m_Timer(nullptr),
+	m_Handler(handler),
+	m_Stopping(false),
+	m_State(State::Connecting),
+	m_Request { },
+	m_ReadBuffer(nullptr),
+	m_ReadRemaining(0)
+{
+	DWORD session;
+	if (!ProcessIdToSessionId(GetCurrentProcessId(), &session))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to get the current session.");
+		return;
+	}
+
+	AutoFree::Local<SECURITY_DESCRIPTOR> descriptor;
+	if (!ConvertStringSecurityDescriptorToSecurityDescriptor(GetSecurityDescriptor().c_str(), SDDL_REVISION_1, reinterpret_cast<PSECURITY_DESCRIPTOR *>(descriptor.put()), NULL))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to create control pipe security descriptor.");
+		return;
+	}
+
+	SECURITY_ATTRIBUTES attributes = { sizeof(attributes), descriptor.get(), FALSE };
+	const std::wstring name = PIPE_PREFIX + std::to_wstring(session);
+
+	// Being the first instance makes sure nobody else is pretending to be us.
+	m_Pipe.attach(CreateNamedPipe(name.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED | FILE_FLAG_FIRST_PIPE_INSTANCE,
+		PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT | PIPE_REJECT_REMOTE_CLIENTS, 1, MAX_PAYLOAD, MAX_PAYLOAD, 0, &attributes));
+	if (!m_Pipe)
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to create control pipe.");
+		return;
+	}
+
+	m_Io = CreateThreadpoolIo(m_Pipe.get(), IoCallback, this, NULL);
+	m_Timer = CreateThreadpoolTimer(TimerCallback, this, NULL);
+	if (!m_Io || !m_Timer)
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to create thread pool objects for the control pipe.");
+		if (m_Io)
+		{
+			CloseThreadpoolIo(m_Io);
+			m_Io = nullptr;
+		}
+		return;
+	}
+
+	Connect();
+}
+
+ControlPipe::~ControlPipe()
+{
+	{
+		std::lock_guard guard(m_Lock);
+		m_Stopping = true;
+		if (m_Pipe)
+		{
+			CancelIoEx(m_Pipe.get(), NULL);
+		}
+	}
+
+	if (m_Io)
+	{
+		WaitForThreadpoolIoCallbacks(m_Io, FALSE);
+		CloseThreadpoolIo(m_Io);
+	}
+
+	if (m_Timer)
+	{
+		SetThreadpoolTimer(m_Timer, NULL, 0, 0);
+		WaitForThreadpoolTimerCallbacks(m_Timer, TRUE);
+		CloseThreadpoolTimer(m_Timer);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,107 @@
+#pragma once
+#include "arch.h"
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <threadpoolapiset.h>
+#include <vector>
+#include <windef.h>
+#include <winrt/base.h>
+
+// A local named pipe that management tools can use to control a running instance without restarting it.
+// A request is a RequestHeader followed by its payload, and gets a ResponseHeader followed by its payload back.
+// Several requests can be sent on one connection, it gets closed after REQUEST_TIMEOUT without one.
+// Only a single client is served at a time, others get ERROR_PIPE_BUSY and should use WaitNamedPipe.
+class ControlPipe {
+
+public:
+	// The session id gets appended, so that every session has its own instance.
+	static constexpr wchar_t PIPE_PREFIX[] = L"\\\\.\\pipe\\TranslucentTB.Control.";
+	static constexpr uint32_t PROTOCOL_VERSION = 1;
+
+	enum class Command : uint32_t {
+		QueryVersion = 0,  // Replies with PROTOCOL_VERSION as an uint32_t
+		ApplyConfig = 1,   // Payload is UTF-16 text in the config file format, missing keys get their defaults
+		ReloadFiles = 2,   // Rereads the configuration, exclude and rules files
+		QueryCounters = 3, // Replies with the counter count as an uint32_t, then as many uint64_t in Diagnostics::Counter order
+		QueryCacheStats = 4 // Replies with CacheStats
+	};
+
+	struct RequestHeader {
+		Command command;
+		uint32_t size; // Of the payload, in bytes
+	};
+
+	struct ResponseHeader {
+		HRESULT result;
+		uint32_t size; // Of the payload, in bytes
+	};
+
+	struct CacheStats {
+		uint64_t window_entries;
+		uint64_t window_capacity;
+		uint64_t window_hits;
+		uint64_t window_misses;
+		uint64_t blacklist_entries;
+		uint64_t blacklist_capacity;
+		uint64_t blacklist_hits;
+		uint64_t blacklist_misses;
+		uint64_t evictions;
+	};
+
+	// Gets called from a thread pool thread, one request at a time. The returned result is sent back with the reply.
+	using handler_t = std::function<HRESULT(const Command &command, const std::vector<uint8_t> &payload, std::vector<uint8_t> &reply)>;
+
+private:
+	static constexpr uint32_t MAX_PAYLOAD = 65536;
+	static constexpr int64_t REQUEST_TIMEOUT = 5000; // In milliseconds, so that an idle client doesn't block everyone else
+
+	enum class State {
+		Connecting,
+		ReadingHeader,
+		ReadingPayload,
+		Writing,
+		Closing // Writing a reply, then dropping the client
+	};
+
+	winrt::file_handle m_Pipe;
+	OVERLAPPED m_Overlapped;
+	PTP_IO m_Io;
+	PTP_TIMER m_Timer;
+	handler_t m_Handler;
+
+	// Held while starting an operation, so that stopping never misses one.
+	std::mutex m_Lock;
+	bool m_Stopping;
+
+	// Only one operation is ever pending, so only one callback runs at a time and those need no locking.
+	State m_State;
+	RequestHeader m_Request;
+	std::vector<uint8_t> m_Payload;
+	std::vector<uint8_t> m_Reply; // Starts with the ResponseHeader
+	uint8_t *m_ReadBuffer;
+	DWORD m_ReadRemaining; // Byte mode pipes can return less than asked for
+
+	static std::wstring GetSecurityDescriptor();
+
+	bool Start(const std::function<BOOL()> &operation);
+	void Connect();
+	void Read(void *buffer, const DWORD &size);
+	void Reply(const HRESULT &result, const std::vector<uint8_t> &payload, const bool &close);
+	void Disconnect();
+	void ArmTimeout();
+
+	void OnCompleted(const ULONG &result, const ULONG_PTR &transferred);
+
+	static void CALLBACK IoCallback(PTP_CALLBACK_INSTANCE, void *context, void *, ULONG result, ULONG_PTR transferred, PTP_IO);
+	static void CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE, void *context, PTP_TIMER);
+
+public:
+	ControlPipe(const handler_t &handler);
+
+	inline ControlPipe(const ControlPipe &) = delete;
+	inline ControlPipe &operator =(const ControlPipe &) = delete;
+
+	~ControlPipe();
+};
\ No newline at end of file
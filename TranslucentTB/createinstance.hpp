@@ -24,7 +24,7 @@ inline winrt::com_ptr<T> create_instance(REFCLSID rclsid, IUnknown *pUnkOuter =
 		{
 			iname = L"[failed to convert interface name to UTF-16]";
 		}
-		ErrorHandle(hr, Error::Level::Log, (L"Failed to create instance of COM interface " + iname + L'.').c_str());
+		ErrorHandle(hr, Error::Level::Log, L"Failed to create instance of COM interface " + iname + L'.');
 	}
 
 	return ptr;
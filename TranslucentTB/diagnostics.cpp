@@ -0,0 +1,226 @@
+#include "diagnostics.hpp"
+#include <algorithm>
+#include <iomanip>
+#include <memoryapi.h>
+#include <new>
+#include <processthreadsapi.h>
+#include <Psapi.h>
+#include <profileapi.h>
+#include <sstream>
+#include <synchapi.h>
+#include <TraceLoggingProvider.h>
+#include <winmeta.h>
+#include <WinUser.h>
+
+#include "common.hpp"
+#include "ttberror.hpp"
+#include "ttblog.hpp"
+#include "window.hpp"
+
+// {F97D33C4-40C0-4243-B666-346D91696EF5}
+TRACELOGGING_DEFINE_PROVIDER(
+	TranslucentTBProvider,
+	"TranslucentTB",
+	(0xf97d33c4, 0x40c0, 0x4243, 0xb6, 0x66, 0x34, 0x6d, 0x91, 0x69, 0x6e, 0xf5)
+);
+
+Diagnostics::SharedData Diagnostics::m_LocalData;
+Diagnostics::SharedData *Diagnostics::m_Data = &m_LocalData;
+winrt::handle Diagnostics::m_SharedMemory;
+std::array<Diagnostics::StageTiming, static_cast<std::size_t>(Diagnostics::Stage::Count)> Diagnostics::m_Stages;
+std::vector<std::pair<const wchar_t *, Diagnostics::memory_usage_t>> Diagnostics::m_MemoryUsages;
+int64_t Diagnostics::m_StartTime;
+int64_t Diagnostics::m_Frequency;
+
+Diagnostics::Span::Span(const Stage &stage) : m_Stage(stage)
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	m_Start = now.QuadPart;
+}
+
+Diagnostics::Span::~Span()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	RecordStage(m_Stage, now.QuadPart - m_Start);
+}
+
+void Diagnostics::Register()
+{
+	LARGE_INTEGER value;
+	QueryPerformanceFrequency(&value);
+	m_Frequency = value.QuadPart;
+	QueryPerformanceCounter(&value);
+	m_StartTime = value.QuadPart;
+
+	ErrorHandle(TraceLoggingRegister(TranslucentTBProvider), Error::Level::Log, L"Failed to register ETW provider.");
+}
+
+void Diagnostics::Share()
+{
+	m_SharedMemory.attach(CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(SharedData), SHARED_MEMORY_NAME));
+	if (!m_SharedMemory)
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to create diagnostics shared memory.");
+		return;
+	}
+	const bool existed = GetLastError() == ERROR_ALREADY_EXISTS;
+
+	void *const view = MapViewOfFile(m_SharedMemory.get(), FILE_MAP_WRITE, 0, 0, sizeof(SharedData));
+	if (!view)
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to map diagnostics shared memory.");
+		m_SharedMemory.close();
+		return;
+	}
+
+	// A reader (or an instance that didn't exit) might be keeping it alive. Only take it over once its owner is gone.
+	if (existed && IsOwnerAlive(*static_cast<const SharedData *>(view)))
+	{
+		Log::OutputFormatted(L"Another instance still publishes its diagnostics, not publishing ours.");
+		UnmapViewOfFile(view);
+		m_SharedMemory.close();
+		return;
+	}
+
+	// Never unmapped, other threads can still be incrementing counters while we exit.
+	SharedData *const data = new (view) SharedData();
+	data->version = SHARED_MEMORY_VERSION;
+	data->process_id = GetCurrentProcessId();
+	data->frequency = m_Frequency;
+	for (std::size_t i = 0; i < static_cast<std::size_t>(Counter::Count); i++)
+	{
+		data->counters[i] = m_LocalData.counters[i].load(std::memory_order_relaxed);
+	}
+
+	m_Data = data;
+}
+
+bool Diagnostics::IsOwnerAlive(const SharedData &data)
+{
+	if (data.version != SHARED_MEMORY_VERSION || data.process_id == 0 || data.process_id == GetCurrentProcessId())
+	{
+		return false;
+	}
+
+	const winrt::handle process(OpenProcess(SYNCHRONIZE, FALSE, data.process_id));
+	return process && WaitForSingleObject(process.get(), 0) == WAIT_TIMEOUT;
+}
+
+void Diagnostics::Unregister()
+{
+	TraceLoggingUnregister(TranslucentTBProvider);
+}
+
+void Diagnostics::RecordApply()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	m_Data->last_apply.store(now.QuadPart, std::memory_order_relaxed);
+}
+
+const wchar_t *Diagnostics::GetStageName(const Stage &stage)
+{
+	switch (stage)
+	{
+	case Stage::Evaluation:
+		return L"Evaluation";
+	case Stage::WindowScan:
+		return L"WindowScan";
+	case Stage::Blacklist:
+		return L"Blacklist";
+	case Stage::Swca:
+		return L"SetWindowCompositionAttribute";
+	default:
+		return L"Unknown";
+	}
+}
+
+void Diagnostics::RecordStage(const Stage &stage, const int64_t &ticks)
+{
+	StageTiming &timing = m_Stages[static_cast<std::size_t>(stage)];
+	timing.count.fetch_add(1, std::memory_order_relaxed);
+	timing.total_ticks.fetch_add(static_cast<uint64_t>(ticks), std::memory_order_relaxed);
+
+	uint64_t max = timing.max_ticks.load(std::memory_order_relaxed);
+	while (static_cast<uint64_t>(ticks) > max && !timing.max_ticks.compare_exchange_weak(max, static_cast<uint64_t>(ticks), std::memory_order_relaxed)) { }
+
+	// Doesn't do anything unless a trace session enabled us.
+	TraceLoggingWrite(
+		TranslucentTBProvider,
+		"Stage",
+		TraceLoggingLevel(WINEVENT_LEVEL_VERBOSE),
+		TraceLoggingWideString(GetStageName(stage), "Name"),
+		TraceLoggingUInt64(m_Frequency ? ticks * 1000000 / m_Frequency : 0, "DurationMicroseconds")
+	);
+}
+
+void Diagnostics::RegisterMemoryUsage(const wchar_t *name, const memory_usage_t &usage)
+{
+	m_MemoryUsages.emplace_back(name, usage);
+}
+
+std::wstring Diagnostics::Report()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	const double uptime = static_cast<double>(now.QuadPart - m_StartTime) / m_Frequency;
+
+	const auto get = [](const Counter &counter)
+	{
+		return m_Data->counters[static_cast<std::size_t>(counter)].load(std::memory_order_relaxed);
+	};
+
+	const auto ratio = [](const uint64_t &hits, const uint64_t &misses)
+	{
+		return hits + misses != 0 ? 100.0 * hits / (hits + misses) : 0.0;
+	};
+
+	std::wostringstream report;
+	report << std::fixed << std::setprecision(1);
+	report << L"Uptime: " << uptime << L" s\n";
+	report << L"Evaluations per second: " << m_Stages[static_cast<std::size_t>(Stage::Evaluation)].count.load(std::memory_order_relaxed) / (std::max)(uptime, 1.0) << L"\n\n";
+
+	report << L"Hook callbacks: " << get(Counter::HookCallbacks) << L" (" << get(Counter::HookCallbacksFiltered) << L" filtered out)\n";
+	report << L"Window cache: " << get(Counter::WindowCacheHits) << L" hits, " << get(Counter::WindowCacheMisses) << L" misses ("
+		<< ratio(get(Counter::WindowCacheHits), get(Counter::WindowCacheMisses)) << L"%)\n";
+	report << L"Blacklist cache: " << get(Counter::BlacklistCacheHits) << L" hits, " << get(Counter::BlacklistCacheMisses) << L" misses ("
+		<< ratio(get(Counter::BlacklistCacheHits), get(Counter::BlacklistCacheMisses)) << L"%)\n";
+	report << L"Cached: " << get(Counter::WindowCacheSize) << L" windows, " << get(Counter::BlacklistCacheSize) << L" verdicts ("
+		<< get(Counter::CacheEvictions) << L" evicted)\n";
+	report << L"Evaluations skipped because nothing changed: " << get(Counter::EvaluationsSkipped) << L"\n";
+	report << L"SetWindowCompositionAttribute: " << get(Counter::SwcaCalls) << L" issued, " << get(Counter::SwcaSkipped) << L" skipped\n";
+	report << L"Messages that timed out: " << get(Counter::MessageTimeouts) << L"\n\n";
+
+	PROCESS_MEMORY_COUNTERS_EX memory = { sizeof(memory) };
+	if (GetProcessMemoryInfo(GetCurrentProcess(), reinterpret_cast<PROCESS_MEMORY_COUNTERS *>(&memory), sizeof(memory)))
+	{
+		report << L"Memory: " << memory.PrivateUsage / 1024.0 << L" KiB private, " << memory.WorkingSetSize / 1024.0 << L" KiB working set\n";
+	}
+
+	for (const auto &[name, usage] : m_MemoryUsages)
+	{
+		report << name << L": ~" << usage() / 1024.0 << L" KiB\n";
+	}
+	report << L"\n";
+
+	for (std::size_t i = 0; i < m_Stages.size(); i++)
+	{
+		const StageTiming &timing = m_Stages[i];
+		const uint64_t count = timing.count.load(std::memory_order_relaxed);
+		const double total = 1000.0 * timing.total_ticks.load(std::memory_order_relaxed) / m_Frequency;
+		const double max = 1000.0 * timing.max_ticks.load(std::memory_order_relaxed) / m_Frequency;
+
+		report << GetStageName(static_cast<Stage>(i)) << L": " << count << L" times, "
+			<< std::setprecision(3) << (count != 0 ? total / count : 0.0) << L" ms average, " << max << L" ms max\n"
+			<< std::setprecision(1);
+	}
+
+	return report.str();
+}
+
+void Diagnostics::ShowReport()
+{
+	MessageBox(Window::NullWindow, Report().c_str(), NAME L" - Diagnostics", MB_ICONINFORMATION | MB_OK | MB_SETFOREGROUND);
+}
\ No newline at end of file
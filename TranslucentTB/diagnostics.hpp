@@ -0,0 +1,116 @@
+#pragma once
+#include "arch.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include <windef.h>
+#include <winrt/base.h>
+
+// In-process counters and an ETW (TraceLogging) provider, so that performance can be looked at in the field.
+// The provider is named "TranslucentTB", record it with WPR or tracelog and open it in WPA.
+class Diagnostics {
+
+public:
+	enum class Counter {
+		HookCallbacks,
+		HookCallbacksFiltered,
+		WindowCacheHits,
+		WindowCacheMisses,
+		BlacklistCacheHits,
+		BlacklistCacheMisses,
+		SwcaCalls,
+		SwcaSkipped,
+		EvaluationsSkipped,
+		MessageTimeouts,
+		CacheEvictions,
+		WindowCacheSize,    // Current size, not a count
+		BlacklistCacheSize, // Current size, not a count
+		Count
+	};
+
+	enum class Stage {
+		Evaluation,   // SetTaskbarBlur
+		WindowScan,   // Enumerating every window
+		Blacklist,    // Evaluating a window against the blacklist
+		Swca,         // SetWindowCompositionAttribute and WM_THEMECHANGED
+		Count
+	};
+
+	// Measures how long a stage takes until it goes out of scope.
+	class Span {
+	private:
+		Stage m_Stage;
+		int64_t m_Start;
+
+	public:
+		Span(const Stage &stage);
+		~Span();
+
+		inline Span(const Span &) = delete;
+		inline Span &operator =(const Span &) = delete;
+	};
+
+	// Once registered, the counters live in a named shared memory section, so that external tools can read them.
+	static constexpr wchar_t SHARED_MEMORY_NAME[] = L"Local\\TranslucentTB.Diagnostics";
+	static constexpr uint32_t SHARED_MEMORY_VERSION = 3;
+
+	struct SharedData {
+		uint32_t version;
+		uint32_t process_id;
+		int64_t frequency;
+		std::atomic_int64_t last_apply; // QueryPerformanceCounter time of the last time a taskbar got a new appearance.
+		std::atomic_uint64_t counters[static_cast<std::size_t>(Counter::Count)];
+	};
+
+	static void Register();
+
+	// Publishes the counters in shared memory. Call once the previous instance is gone, it owns them until then.
+	static void Share();
+	static void Unregister();
+
+	inline static void Increment(const Counter &counter, const uint64_t &amount = 1)
+	{
+		m_Data->counters[static_cast<std::size_t>(counter)].fetch_add(amount, std::memory_order_relaxed);
+	}
+
+	inline static void Set(const Counter &counter, const uint64_t &value)
+	{
+		m_Data->counters[static_cast<std::size_t>(counter)].store(value, std::memory_order_relaxed);
+	}
+
+	inline static uint64_t Get(const Counter &counter)
+	{
+		return m_Data->counters[static_cast<std::size_t>(counter)].load(std::memory_order_relaxed);
+	}
+
+	static void RecordApply();
+
+	// Subsystems holding onto memory report roughly how much heap they use, shown in the report. Only call during startup.
+	using memory_usage_t = std::size_t(*)();
+	static void RegisterMemoryUsage(const wchar_t *name, const memory_usage_t &usage);
+
+	static std::wstring Report();
+	static void ShowReport();
+
+private:
+	struct StageTiming {
+		std::atomic_uint64_t count;
+		std::atomic_uint64_t total_ticks;
+		std::atomic_uint64_t max_ticks;
+	};
+
+	static SharedData m_LocalData; // Used until the shared memory is mapped, or if that fails.
+	static SharedData *m_Data;
+	static winrt::handle m_SharedMemory;
+	static std::array<StageTiming, static_cast<std::size_t>(Stage::Count)> m_Stages;
+	static std::vector<std::pair<const wchar_t *, memory_usage_t>> m_MemoryUsages;
+	static int64_t m_StartTime;
+	static int64_t m_Frequency;
+
+	static const wchar_t *GetStageName(const Stage &stage);
+	static bool IsOwnerAlive(const SharedData &data);
+	static void RecordStage(const Stage &stage, const int64_t &ticks);
+};
\ No newline at end of file
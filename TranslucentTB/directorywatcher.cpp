@@ -0,0 +1,156 @@
+#include "directorywatcher.hpp"
+#include <utility>
+#include <vector>
+#include <winbase.h>
+
+#include "ttberror.hpp"
+#include "util.hpp"
+
+bool DirectoryWatcher::Listen()
+{
+	if (!ReadDirectoryChangesW(m_Directory.get(), m_Buffer.get(), BUFFER_SIZE, FALSE, FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_LAST_WRITE, NULL, &m_Overlapped, NULL))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to listen for directory changes.");
+		return false;
+	}
+
+	SetThreadpoolWait(m_Wait, m_Event.get(), NULL);
+	return true;
+}
+
+void DirectoryWatcher::CollectChanges(const DWORD &size)
+{
+	std::lock_guard guard(m_ChangesLock);
+	if (size == 0)
+	{
+		// The buffer overflowed
+		m_Changes.emplace();
+		return;
+	}
+
+	const uint8_t *entry = reinterpret_cast<const uint8_t *>(m_Buffer.get());
+	while (true)
+	{
+		const auto info = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(entry);
+		m_Changes.emplace(Util::ToLower(std::wstring(info->FileName, info->FileNameLength / sizeof(wchar_t))));
+
+		if (info->NextEntryOffset == 0)
+		{
+			break;
+		}
+
+		entry += info->NextEntryOffset;
+	}
+}
+
+void CALLBACK DirectoryWatcher::WaitCallback(PTP_CALLBACK_INSTANCE, void *context, PTP_WAIT, TP_WAIT_RESULT)
+{
+	const auto watcher = static_cast<DirectoryWatcher *>(context);
+
+	DWORD size;
+	if (!GetOverlappedResult(watcher->m_Directory.get(), &watcher->m_Overlapped, &size, FALSE))
+	{
+		if (GetLastError() != ERROR_OPERATION_ABORTED)
+		{
+			LastErrorHandle(Error::Level::Log, L"Failed to get directory changes.");
+		}
+
+		return;
+	}
+
+	if (watcher->m_Stopping)
+	{
+		return;
+	}
+
+	// Has to be done before listening again, because the buffer gets reused.
+	watcher->CollectChanges(size);
+
+	// Restart the settle delay. Negative means relative, in 100 nanoseconds intervals.
+	ULARGE_INTEGER due;
+	due.QuadPart = static_cast<ULONGLONG>(-SETTLE_TIME * 10000);
+	FILETIME due_time = { due.LowPart, due.HighPart };
+	SetThreadpoolTimer(watcher->m_Timer, &due_time, 0, 0);
+
+	watcher->Listen();
+}
+
+void CALLBACK DirectoryWatcher::TimerCallback(PTP_CALLBACK_INSTANCE, void *context, PTP_TIMER)
+{
+	const auto watcher = static_cast<DirectoryWatcher *>(context);
+
+	std::unordered_set<std::wstring> changes;
+	{
+		std::lock_guard guard(watcher->m_ChangesLock);
+		std::swap(changes, watcher->m_Changes);
+	}
+
+	for (const std::wstring &file : changes)
+	{
+		watcher->m_Callback(file);
+	}
+}
+
+DirectoryWatcher::DirectoryWatcher(const std::wstring &directory, const callback_t &callback) :
+	m_Overlapped { },
+	m_Buffer(std::make_unique<DWORD[]>(BUFFER_SIZE / sizeof(DWORD))),
+	m_Wait(nullptr),
+	m_Timer(nullptr),
+	m_Stopping(false),
+	m_Callback(callback)
+{
+	m_Directory.attach(CreateFile(directory.c_str(), FILE_LIST_DIRECTORY, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED, NULL));
+	if (!m_Directory)
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to open directory to watch.");
+		return;
+	}
+
+	m_Event.attach(CreateEvent(NULL, TRUE, FALSE, NULL));
+	if (!m_Event)
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to create directory change event.");
+		return;
+	}
+	m_Overlapped.hEvent = m_Event.get();
+
+	m_Wait = CreateThreadpoolWait(WaitCallback, this, NULL);
+	m_Timer = CreateThreadpoolTimer(TimerCallback, this, NULL);
+	if (!m_Wait || !m_Timer)
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to create thread pool objects for directory watching.");
+		return;
+	}
+
+	Listen();
+}
+
+DirectoryWatcher::~DirectoryWatcher()
+{
+	m_Stopping = true;
+
+	if (m_Wait)
+	{
+		// A callback that was already running might have rearmed the wait, so do it twice.
+		SetThreadpoolWait(m_Wait, NULL, NULL);
+		WaitForThreadpoolWaitCallbacks(m_Wait, TRUE);
+		SetThreadpoolWait(m_Wait, NULL, NULL);
+
+		// Only returns true if there was a read pending.
+		if (CancelIoEx(m_Directory.get(), &m_Overlapped))
+		{
+			DWORD size;
+			GetOverlappedResult(m_Directory.get(), &m_Overlapped, &size, TRUE);
+		}
+
+		WaitForThreadpoolWaitCallbacks(m_Wait, TRUE);
+		CloseThreadpoolWait(m_Wait);
+	}
+
+	if (m_Timer)
+	{
+		SetThreadpoolTimer(m_Timer, NULL, 0, 0);
+		WaitForThreadpoolTimerCallbacks(m_Timer, TRUE);
+		CloseThreadpoolTimer(m_Timer);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,50 @@
+#pragma once
+#include "arch.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <threadpoolapiset.h>
+#include <unordered_set>
+#include <windef.h>
+#include <winrt/base.h>
+
+class DirectoryWatcher {
+
+private:
+	// Gets called from a thread pool thread, with the lowercase name of a file that changed.
+	// An empty name means too much changed to keep track of, and any file might have.
+	using callback_t = std::function<void(const std::wstring &)>;
+
+	// Editors tend to write files in several steps, so changes are only reported once they settled for this long.
+	static constexpr int64_t SETTLE_TIME = 200; // In milliseconds
+	static constexpr DWORD BUFFER_SIZE = 16384;
+
+	winrt::file_handle m_Directory;
+	winrt::handle m_Event;
+	OVERLAPPED m_Overlapped;
+	std::unique_ptr<DWORD[]> m_Buffer; // FILE_NOTIFY_INFORMATION needs to be DWORD aligned
+	PTP_WAIT m_Wait;
+	PTP_TIMER m_Timer;
+	std::atomic_bool m_Stopping;
+	callback_t m_Callback;
+
+	std::mutex m_ChangesLock;
+	std::unordered_set<std::wstring> m_Changes;
+
+	bool Listen();
+	void CollectChanges(const DWORD &size);
+
+	static void CALLBACK WaitCallback(PTP_CALLBACK_INSTANCE, void *context, PTP_WAIT, TP_WAIT_RESULT);
+	static void CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE, void *context, PTP_TIMER);
+
+public:
+	DirectoryWatcher(const std::wstring &directory, const callback_t &callback);
+
+	inline DirectoryWatcher(const DirectoryWatcher &) = delete;
+	inline DirectoryWatcher &operator =(const DirectoryWatcher &) = delete;
+
+	~DirectoryWatcher();
+};
\ No newline at end of file
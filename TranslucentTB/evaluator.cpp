@@ -0,0 +1,86 @@
+#include "evaluator.hpp"
+
+bool Evaluator::Evaluate(const Config &config, const Inputs &inputs, const Queries &queries, std::unordered_map<HMONITOR, Config::TASKBAR_APPEARANCE> &appearances)
+{
+	bool should_show_peek = config.PEEK == Config::PEEK::Enabled;
+
+	appearances.clear();
+	for (const Taskbar &taskbar : inputs.taskbars)
+	{
+		appearances[taskbar.monitor] = config.REGULAR_APPEARANCE; // Reset taskbar state
+	}
+	if (config.MAXIMISED_ENABLED || config.PEEK == Config::PEEK::Dynamic)
+	{
+		for (const Taskbar &taskbar : inputs.taskbars)
+		{
+			if (queries.has_maximised_window(taskbar.monitor))
+			{
+				if (config.MAXIMISED_ENABLED)
+				{
+					appearances[taskbar.monitor] = config.MAXIMISED_APPEARANCE;
+				}
+
+				if (config.PEEK == Config::PEEK::Dynamic && (!config.PEEK_ONLY_MAIN || taskbar.main))
+				{
+					should_show_peek = true;
+				}
+			}
+		}
+	}
+
+	// Rules of the maximised and foreground windows win over the regular and maximised appearances.
+	if (queries.rule_appearance)
+	{
+		for (auto &[monitor, appearance] : appearances)
+		{
+			if (const auto rule = queries.rule_appearance(monitor))
+			{
+				appearance = *rule;
+			}
+		}
+	}
+
+	if (const auto it = inputs.foreground_monitor ? appearances.find(inputs.foreground_monitor) : appearances.end(); it != appearances.end())
+	{
+		auto &appearance = it->second;
+		if (config.CORTANA_ENABLED && !inputs.start_opened && inputs.foreground_kind == Window::Kind::Search && !inputs.foreground_cloaked)
+		{
+			appearance = config.CORTANA_APPEARANCE;
+		}
+
+		// Start didn't tell on which monitor it opened, assume it's the one of the foreground window.
+		if (config.START_ENABLED && inputs.start_opened && inputs.start_monitors.empty())
+		{
+			appearance = config.START_APPEARANCE;
+		}
+	}
+
+	// Otherwise only the taskbars of the monitors Start is on change.
+	for (const HMONITOR monitor : inputs.start_monitors)
+	{
+		if (const auto it = appearances.find(monitor); it != appearances.end())
+		{
+			it->second = config.START_APPEARANCE;
+		}
+	}
+
+	// Put this between Start/Cortana and Task view/Timeline
+	// Task view and Timeline show over Aero Peek, but not Start or Cortana
+	if (config.MAXIMISED_ENABLED && config.MAXIMISED_REGULAR_ON_PEEK && inputs.peek_active)
+	{
+		for (auto &[_, appearance] : appearances)
+		{
+			appearance = config.REGULAR_APPEARANCE;
+		}
+	}
+
+	if (config.TIMELINE_ENABLED && inputs.foreground_kind == Window::Kind::Timeline)
+	{
+		for (auto &[_, appearance] : appearances)
+		{
+			appearance = config.TIMELINE_APPEARANCE;
+		}
+	}
+
+	return should_show_peek;
+}
\ No newline at end of file
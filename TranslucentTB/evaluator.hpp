@@ -0,0 +1,43 @@
+#pragma once
+#include "arch.h"
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+#include <windef.h>
+
+#include "config.hpp"
+#include "window.hpp"
+
+// Decides what every taskbar should look like, without looking at any window itself. The worker
+// answers the queries from the real windows, and the Replay tool from a recorded EventTrace.
+class Evaluator {
+
+public:
+	struct Taskbar {
+		HMONITOR monitor;
+		bool main;
+	};
+
+	// Read once by the caller, so that the whole pass agrees on them.
+	struct Inputs {
+		const std::vector<Taskbar> &taskbars;
+		HMONITOR foreground_monitor; // Null when there is no foreground window
+		Window::Kind foreground_kind;
+		bool foreground_cloaked;
+		bool start_opened;
+		const std::vector<HMONITOR> &start_monitors; // Where Start is visible, empty if it didn't tell
+		bool peek_active;
+	};
+
+	struct Queries {
+		std::function<bool(const HMONITOR &)> has_maximised_window;
+
+		// Appearance of the application rule winning on a monitor, if any. Left empty when there are no rules.
+		std::function<std::optional<Config::TASKBAR_APPEARANCE>(const HMONITOR &)> rule_appearance;
+	};
+
+	// Fills appearances with an entry for each taskbar. Returns whether the peek button should show.
+	static bool Evaluate(const Config &config, const Inputs &inputs, const Queries &queries, std::unordered_map<HMONITOR, Config::TASKBAR_APPEARANCE> &appearances);
+
+};
\ No newline at end of file
@@ -1,22 +1,51 @@
 #include "eventhook.hpp"
 
+#include "diagnostics.hpp"
 #include "ttblog.hpp"
 
 void CALLBACK EventHook::RawHookCallback(HWINEVENTHOOK hook, DWORD event, HWND window, LONG idObject, LONG idChild, DWORD dwEventThread, DWORD dwmsEventTime)
 {
-	GetMap()[hook](event, window, idObject, idChild, dwEventThread, dwmsEventTime);
+	Diagnostics::Increment(Diagnostics::Counter::HookCallbacks);
+
+	const auto &map = GetMap();
+	const auto it = map.find(hook);
+	if (it == map.end())
+	{
+		return;
+	}
+
+	const Filter filter = it->second.filter;
+	if (filter != Filter::None)
+	{
+		// Most events are about child objects, discard them before doing anything expensive.
+		if (idObject != OBJID_WINDOW || idChild != CHILDID_SELF || !window)
+		{
+			Diagnostics::Increment(Diagnostics::Counter::HookCallbacksFiltered);
+			return;
+		}
+
+		if (filter == Filter::TopLevelWindows && GetAncestor(window, GA_ROOT) != window)
+		{
+			Diagnostics::Increment(Diagnostics::Counter::HookCallbacksFiltered);
+			return;
+		}
+	}
+
+	// Copy it, because the callback is allowed to destroy its own hook.
+	const callback_t callback = it->second.callback;
+	callback(event, window, idObject, idChild, dwEventThread, dwmsEventTime);
 }
 
-EventHook::EventHook(const DWORD &min, const DWORD &max, const callback_t &callback, const DWORD &flags, const HMODULE &hMod, const DWORD &idProcess, const DWORD &idThread)
+EventHook::EventHook(const DWORD &min, const DWORD &max, const callback_t &callback, const DWORD &flags, const Filter &filter, const HMODULE &hMod, const DWORD &idProcess, const DWORD &idThread)
 {
 	m_Handle = SetWinEventHook(min, max, hMod, RawHookCallback, idProcess, idThread, flags);
 	if (m_Handle)
 	{
-		GetMap().emplace(m_Handle, callback);
+		GetMap().emplace(m_Handle, HookData { callback, filter });
 	}
 	else
 	{
-		Log::OutputMessage(L"Failed to create a Windows event hook.");
+		Log::OutputFormatted(L"Failed to create a Windows event hook.");
 	}
 }
 
@@ -27,7 +56,7 @@ EventHook::~EventHook()
 		GetMap().erase(m_Handle);
 		if (!UnhookWinEvent(m_Handle))
 		{
-			Log::OutputMessage(L"Failed to delete a Windows event hook.");
+			Log::OutputFormatted(L"Failed to delete a Windows event hook.");
 		}
 	}
 }
\ No newline at end of file
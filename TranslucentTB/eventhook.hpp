@@ -9,14 +9,27 @@
 
 class EventHook {
 
+public:
+	// Events that get dropped before reaching the callback, as cheaply as possible.
+	enum class Filter {
+		None,
+		Windows,        // Only events about windows themselves, not their children objects like scroll bars or carets.
+		TopLevelWindows // Same as Windows, but the window also has to be top-level. Don't use for destruction events.
+	};
+
 private:
 	using callback_t = std::function<void(DWORD, const Window &, LONG, LONG, DWORD, DWORD)>;
 	HWINEVENTHOOK m_Handle;
 
+	struct HookData {
+		callback_t callback;
+		Filter filter;
+	};
+
 	// As function because static initialization order.
-	inline static std::unordered_map<HWINEVENTHOOK, callback_t> &GetMap()
+	inline static std::unordered_map<HWINEVENTHOOK, HookData> &GetMap()
 	{
-		static std::unordered_map<HWINEVENTHOOK, callback_t> map;
+		static std::unordered_map<HWINEVENTHOOK, HookData> map;
 		return map;
 	}
 
@@ -24,7 +37,7 @@ private:
 
 public:
 	inline EventHook(const HWINEVENTHOOK &handle) : m_Handle(handle) { }
-	EventHook(const DWORD &min, const DWORD &max, const callback_t &callback, const DWORD &flags, const HMODULE &hMod = NULL, const DWORD &idProcess = 0, const DWORD &idThread = 0);
+	EventHook(const DWORD &min, const DWORD &max, const callback_t &callback, const DWORD &flags, const Filter &filter = Filter::None, const HMODULE &hMod = NULL, const DWORD &idProcess = 0, const DWORD &idThread = 0);
 
 	inline EventHook(const EventHook &) = delete;
 	inline EventHook &operator =(const EventHook &) = delete;
@@ -0,0 +1,205 @@
+#include "eventtrace.hpp"
+#include <cstring>
+#include <fileapi.h>
+#include <handleapi.h>
+#include <profileapi.h>
+
+#include "ttberror.hpp"
+
+static_assert(sizeof(EventTrace::Record) == 32, "Record is written as is, changing its size needs a new VERSION.");
+
+std::atomic_bool EventTrace::m_Recording = false;
+PTP_TIMER EventTrace::m_Timer = nullptr;
+std::mutex EventTrace::m_Lock;
+winrt::file_handle EventTrace::m_File;
+std::vector<EventTrace::Record> EventTrace::m_Buffer;
+int64_t EventTrace::m_Start;
+int64_t EventTrace::m_Frequency;
+
+void EventTrace::Start(const std::wstring &file)
+{
+	std::lock_guard guard(m_Lock);
+
+	m_File.attach(CreateFile(file.c_str(), GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
+	if (!m_File)
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to create event trace file.");
+		return;
+	}
+
+	const Header header = { MAGIC, VERSION };
+	DWORD written;
+	if (!WriteFile(m_File.get(), &header, sizeof(header), &written, NULL))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to write event trace header.");
+		m_File.close();
+		return;
+	}
+
+	LARGE_INTEGER counter;
+	QueryPerformanceFrequency(&counter);
+	m_Frequency = counter.QuadPart;
+	QueryPerformanceCounter(&counter);
+	m_Start = counter.QuadPart;
+
+	m_Buffer.reserve(BUFFER_SIZE);
+	m_Recording = true;
+
+	// Without it, records only get written when the buffer fills up or at the end.
+	m_Timer = CreateThreadpoolTimer(TimerCallback, nullptr, NULL);
+	if (m_Timer)
+	{
+		// Negative means relative, in 100 nanoseconds intervals.
+		ULARGE_INTEGER due;
+		due.QuadPart = static_cast<ULONGLONG>(-static_cast<int64_t>(WRITE_INTERVAL) * 10000);
+		FILETIME due_time = { due.LowPart, due.HighPart };
+		SetThreadpoolTimer(m_Timer, &due_time, WRITE_INTERVAL, WRITE_INTERVAL / 10);
+	}
+	else
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to create event trace timer.");
+	}
+}
+
+void EventTrace::Stop()
+{
+	m_Recording = false;
+
+	// Not with the lock held, the callback needs it.
+	if (m_Timer)
+	{
+		SetThreadpoolTimer(m_Timer, NULL, 0, 0);
+		WaitForThreadpoolTimerCallbacks(m_Timer, TRUE);
+		CloseThreadpoolTimer(m_Timer);
+		m_Timer = nullptr;
+	}
+
+	std::lock_guard guard(m_Lock);
+	if (m_File)
+	{
+		Write();
+		m_File.close();
+	}
+}
+
+void EventTrace::Foreground(const Window &window, const HMONITOR &monitor, const Window::Kind &kind, const bool &cloaked)
+{
+	std::lock_guard guard(m_Lock);
+	Append({ 0, Kind::Foreground, cloaked, kind, 0, 0, reinterpret_cast<uintptr_t>(window.handle()), reinterpret_cast<uintptr_t>(monitor) });
+}
+
+void EventTrace::Maximised(const Window &window, const HMONITOR &monitor)
+{
+	std::lock_guard guard(m_Lock);
+	Append({ 0, Kind::Maximised, false, Window::Kind::Normal, 0, 0, reinterpret_cast<uintptr_t>(window.handle()), reinterpret_cast<uintptr_t>(monitor) });
+}
+
+void EventTrace::Rescan(const std::unordered_map<Window, HMONITOR> &windows)
+{
+	std::lock_guard guard(m_Lock);
+	Append({ 0, Kind::Rescan, false, Window::Kind::Normal, 0, static_cast<uint32_t>(windows.size()), 0, 0 });
+	for (const auto &[window, monitor] : windows)
+	{
+		Append({ 0, Kind::Maximised, false, Window::Kind::Normal, 0, 0, reinterpret_cast<uintptr_t>(window.handle()), reinterpret_cast<uintptr_t>(monitor) });
+	}
+}
+
+void EventTrace::Peek(const bool &active)
+{
+	std::lock_guard guard(m_Lock);
+	Append({ 0, Kind::Peek, active, Window::Kind::Normal, 0, 0, 0, 0 });
+}
+
+void EventTrace::Launcher(const bool &visible)
+{
+	std::lock_guard guard(m_Lock);
+	Append({ 0, Kind::Launcher, visible, Window::Kind::Normal, 0, 0, 0, 0 });
+}
+
+void EventTrace::MonitorApp(const HMONITOR &monitor, const bool &visible)
+{
+	std::lock_guard guard(m_Lock);
+	Append({ 0, Kind::MonitorApp, visible, Window::Kind::Normal, 0, 0, 0, reinterpret_cast<uintptr_t>(monitor) });
+}
+
+void EventTrace::Taskbars(const std::vector<Evaluator::Taskbar> &taskbars)
+{
+	std::lock_guard guard(m_Lock);
+	Append({ 0, Kind::Taskbars, false, Window::Kind::Normal, 0, static_cast<uint32_t>(taskbars.size()), 0, 0 });
+	for (const Evaluator::Taskbar &taskbar : taskbars)
+	{
+		Append({ 0, Kind::Taskbar, taskbar.main, Window::Kind::Normal, 0, 0, 0, reinterpret_cast<uintptr_t>(taskbar.monitor) });
+	}
+}
+
+bool EventTrace::Decode(const uint8_t *const data, const std::size_t &size, std::vector<Record> &records)
+{
+	Header header;
+	if (size < sizeof(header))
+	{
+		return false;
+	}
+
+	std::memcpy(&header, data, sizeof(header));
+	if (header.magic != MAGIC || header.version != VERSION)
+	{
+		return false;
+	}
+
+	// A partial record at the end means the recording was cut short, just leave it out.
+	const std::size_t count = (size - sizeof(header)) / sizeof(Record);
+	records.resize(count);
+	std::memcpy(records.data(), data + sizeof(header), count * sizeof(Record));
+	return true;
+}
+
+uint64_t EventTrace::Now()
+{
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+
+	// Split to not overflow on long recordings.
+	const int64_t elapsed = now.QuadPart - m_Start;
+	return (elapsed / m_Frequency) * 1000000 + (elapsed % m_Frequency) * 1000000 / m_Frequency;
+}
+
+void EventTrace::Append(Record record)
+{
+	// Recording might have been stopped while waiting on the lock.
+	if (!m_File)
+	{
+		return;
+	}
+
+	record.time = Now();
+	m_Buffer.push_back(record);
+	if (m_Buffer.size() >= BUFFER_SIZE)
+	{
+		Write();
+	}
+}
+
+void EventTrace::Write()
+{
+	if (m_Buffer.empty())
+	{
+		return;
+	}
+
+	DWORD written;
+	if (!WriteFile(m_File.get(), m_Buffer.data(), static_cast<DWORD>(m_Buffer.size() * sizeof(Record)), &written, NULL))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to write event trace.");
+	}
+
+	m_Buffer.clear();
+}
+
+void CALLBACK EventTrace::TimerCallback(PTP_CALLBACK_INSTANCE, void *, PTP_TIMER)
+{
+	std::lock_guard guard(m_Lock);
+	if (m_File)
+	{
+		Write();
+	}
+}
\ No newline at end of file
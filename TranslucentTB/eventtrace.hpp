@@ -0,0 +1,91 @@
+#pragma once
+#include "arch.h"
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <threadpoolapiset.h>
+#include <unordered_map>
+#include <vector>
+#include <windef.h>
+#include <winrt/base.h>
+
+#include "evaluator.hpp"
+#include "window.hpp"
+
+// Records what the state evaluation reacts to, with what it would find out about the windows involved,
+// so that the Replay tool can feed it back to the Evaluator without any real window around.
+class EventTrace {
+
+public:
+	static constexpr wchar_t EXTENSION[] = L".ttbtrace";
+
+	enum class Kind : uint8_t {
+		Foreground, // window, monitor, flag = cloaked, window_kind
+		Maximised,  // window, monitor (null when it isn't maximised anymore)
+		Rescan,     // count = how many Maximised records follow, they replace everything tracked so far
+		Peek,       // flag = active
+		Launcher,   // flag = visible
+		MonitorApp, // monitor, flag = an immersive app is visible on it
+		Taskbars,   // count = how many Taskbar records follow, they replace the previous ones
+		Taskbar     // monitor, flag = main taskbar
+	};
+
+	struct Record {
+		uint64_t time; // Microseconds since the recording started
+		Kind kind;
+		bool flag;
+		Window::Kind window_kind;
+		uint8_t reserved;
+		uint32_t count;
+		uint64_t window;
+		uint64_t monitor;
+	};
+
+	static void Start(const std::wstring &file);
+	static void Stop(); // Writes what is still buffered
+
+	// Check this first, so that nothing gets queried about the windows when not recording.
+	inline static bool Recording()
+	{
+		return m_Recording.load(std::memory_order_relaxed);
+	}
+
+	static void Foreground(const Window &window, const HMONITOR &monitor, const Window::Kind &kind, const bool &cloaked);
+	static void Maximised(const Window &window, const HMONITOR &monitor);
+	static void Rescan(const std::unordered_map<Window, HMONITOR> &windows);
+	static void Peek(const bool &active);
+	static void Launcher(const bool &visible);
+	static void MonitorApp(const HMONITOR &monitor, const bool &visible);
+	static void Taskbars(const std::vector<Evaluator::Taskbar> &taskbars);
+
+	// Returns false if this isn't a trace, or was written by an unsupported version.
+	static bool Decode(const uint8_t *const data, const std::size_t &size, std::vector<Record> &records);
+
+private:
+	static constexpr uint32_t MAGIC = 0x43525454; // TTRC
+	static constexpr uint32_t VERSION = 1;
+	static constexpr std::size_t BUFFER_SIZE = 4096; // In records
+	static constexpr DWORD WRITE_INTERVAL = 1000; // In milliseconds, so that a crash doesn't lose much
+
+	struct Header {
+		uint32_t magic;
+		uint32_t version;
+	};
+
+	static std::atomic_bool m_Recording;
+	static PTP_TIMER m_Timer; // Writes the buffer every WRITE_INTERVAL, even when nothing happens
+
+	// Only used with m_Lock held
+	static std::mutex m_Lock;
+	static winrt::file_handle m_File;
+	static std::vector<Record> m_Buffer;
+	static int64_t m_Start;
+	static int64_t m_Frequency;
+
+	static uint64_t Now();
+	static void Append(Record record);
+	static void Write();
+	static void CALLBACK TimerCallback(PTP_CALLBACK_INSTANCE, void *, PTP_TIMER);
+};
\ No newline at end of file
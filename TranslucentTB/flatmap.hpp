@@ -0,0 +1,168 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <utility>
+#include <vector>
+
+// Open-addressed hash map using linear probing. Everything lives in a single contiguous
+// allocation, which is a lot more cache friendly than std::unordered_map for small keys.
+// A default constructed key marks an empty slot, so it can't be used as a key.
+// Pointers returned by find are invalidated by any insertion or removal.
+template<typename K, typename V, class Hash = std::hash<K>>
+class flat_map {
+
+private:
+	std::vector<std::pair<K, V>> m_Slots;
+	std::size_t m_Size = 0;
+	Hash m_Hasher;
+
+	inline std::size_t ideal_slot(const K &key) const
+	{
+		return m_Hasher(key) & (m_Slots.size() - 1);
+	}
+
+	inline std::size_t find_slot(const K &key) const
+	{
+		std::size_t i = ideal_slot(key);
+		while (m_Slots[i].first != K { } && m_Slots[i].first != key)
+		{
+			i = (i + 1) & (m_Slots.size() - 1);
+		}
+
+		return i;
+	}
+
+	inline void grow()
+	{
+		std::vector<std::pair<K, V>> old((std::max)(m_Slots.size() * 2, static_cast<std::size_t>(16)));
+		std::swap(old, m_Slots);
+
+		for (auto &slot : old)
+		{
+			if (slot.first != K { })
+			{
+				m_Slots[find_slot(slot.first)] = std::move(slot);
+			}
+		}
+	}
+
+public:
+	inline V *find(const K &key)
+	{
+		if (m_Size == 0 || key == K { })
+		{
+			return nullptr;
+		}
+
+		auto &slot = m_Slots[find_slot(key)];
+		return slot.first == key ? &slot.second : nullptr;
+	}
+
+	inline V &operator [](const K &key)
+	{
+		// Keep the load factor under 50%, linear probing degrades quickly above that.
+		if ((m_Size + 1) * 2 > m_Slots.size())
+		{
+			grow();
+		}
+
+		auto &slot = m_Slots[find_slot(key)];
+		if (slot.first != key)
+		{
+			slot.first = key;
+			m_Size++;
+		}
+
+		return slot.second;
+	}
+
+	inline bool erase(const K &key)
+	{
+		if (m_Size == 0 || key == K { })
+		{
+			return false;
+		}
+
+		std::size_t i = find_slot(key);
+		if (m_Slots[i].first != key)
+		{
+			return false;
+		}
+
+		// Backward shift deletion, so that we don't need tombstones.
+		const std::size_t mask = m_Slots.size() - 1;
+		for (std::size_t j = (i + 1) & mask; m_Slots[j].first != K { }; j = (j + 1) & mask)
+		{
+			const std::size_t k = ideal_slot(m_Slots[j].first);
+			if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			{
+				continue; // The entry at j is still reachable from its ideal slot.
+			}
+
+			m_Slots[i] = std::move(m_Slots[j]);
+			i = j;
+		}
+
+		m_Slots[i] = { };
+		m_Size--;
+		return true;
+	}
+
+	// Removes every entry the predicate returns true for, returns how many were removed.
+	template<class Predicate>
+	inline std::size_t erase_if(Predicate &&predicate)
+	{
+		std::vector<K> keys;
+		for (auto &[key, value] : m_Slots)
+		{
+			if (key != K { } && predicate(key, value))
+			{
+				keys.push_back(key);
+			}
+		}
+
+		for (const K &key : keys)
+		{
+			erase(key);
+		}
+
+		return keys.size();
+	}
+
+	template<class Function>
+	inline void for_each(Function &&function)
+	{
+		for (auto &[key, value] : m_Slots)
+		{
+			if (key != K { })
+			{
+				function(key, value);
+			}
+		}
+	}
+
+	inline void clear()
+	{
+		m_Slots.clear();
+		m_Size = 0;
+	}
+
+	// Like clear, but also gives the memory back.
+	inline void release()
+	{
+		std::vector<std::pair<K, V>>().swap(m_Slots);
+		m_Size = 0;
+	}
+
+	inline std::size_t size() const
+	{
+		return m_Size;
+	}
+
+	// Slots allocated, used or not.
+	inline std::size_t capacity() const
+	{
+		return m_Slots.capacity();
+	}
+};
\ No newline at end of file
@@ -0,0 +1,229 @@
+#include "handover.hpp"
+#include <cstring>
+#include <iterator>
+#include <memoryapi.h>
+#include <processthreadsapi.h>
+#include <synchapi.h>
+#include <winrt/base.h>
+
+#include "common.hpp"
+#include "ttberror.hpp"
+#include "ttblog.hpp"
+
+std::optional<Handover::State> Handover::Request(const Window &previous, const unsigned int &timeout)
+{
+	DWORD pid = 0;
+	GetWindowThreadProcessId(previous, &pid);
+	winrt::handle process(pid ? OpenProcess(SYNCHRONIZE, FALSE, pid) : nullptr);
+
+	// Created before asking, so that they exist by the time the old instance looks for them.
+	winrt::handle section(CreateFileMapping(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, SHARED_MEMORY_SIZE, SHARED_MEMORY_NAME));
+	const bool already_exists = section && GetLastError() == ERROR_ALREADY_EXISTS;
+	winrt::handle ready(CreateEvent(NULL, TRUE, FALSE, READY_EVENT_NAME));
+	if (!section || !ready)
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to prepare for the handover from the previous instance.");
+	}
+
+	// The handler only posts WM_QUIT, so this returns as soon as it's asked, not once it's gone.
+	previous.send_message_timeout(NEW_TTB_INSTANCE, timeout);
+
+	// If the shared memory was already there, someone else is taking over and what's in it isn't for us.
+	if (!process || !section || !ready || already_exists)
+	{
+		// No state coming, but still don't touch the taskbars while it might. Don't hang because of it either.
+		if (process && WaitForSingleObject(process.get(), timeout) == WAIT_FAILED)
+		{
+			LastErrorHandle(Error::Level::Log, L"Failed to wait for the previous instance to exit.");
+		}
+
+		return std::nullopt;
+	}
+
+	// Versions without handover just exit, so don't wait for them any longer than that.
+	const HANDLE handles[] = { ready.get(), process.get() };
+	switch (WaitForMultipleObjects(static_cast<DWORD>(std::size(handles)), handles, FALSE, timeout))
+	{
+	case WAIT_OBJECT_0:
+		break;
+
+	case WAIT_FAILED:
+		LastErrorHandle(Error::Level::Log, L"Failed to wait for the handover from the previous instance.");
+		[[fallthrough]];
+
+	default:
+		return std::nullopt;
+	}
+
+	const auto view = static_cast<const uint8_t *>(MapViewOfFile(section.get(), FILE_MAP_READ, 0, 0, SHARED_MEMORY_SIZE));
+	if (!view)
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to map the handover shared memory.");
+		return std::nullopt;
+	}
+
+	auto state = Read(view, pid);
+	UnmapViewOfFile(view);
+	return state;
+}
+
+void Handover::Publish(const State &state)
+{
+	winrt::handle section(OpenFileMapping(FILE_MAP_WRITE, FALSE, SHARED_MEMORY_NAME));
+	if (!section)
+	{
+		return; // Replaced by a version that doesn't know about this, or not being replaced at all.
+	}
+
+	const auto view = static_cast<uint8_t *>(MapViewOfFile(section.get(), FILE_MAP_WRITE, 0, 0, SHARED_MEMORY_SIZE));
+	if (!view)
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to map the handover shared memory.");
+		return;
+	}
+
+	Header header = { VERSION, GetCurrentProcessId(), 0, 0, sizeof(Header) };
+	const auto write = [view, &header](const void *const data, const std::size_t &size)
+	{
+		std::memcpy(view + header.size, data, size);
+		header.size += static_cast<uint32_t>(size);
+	};
+
+	for (const TaskbarState &taskbar : state.taskbars)
+	{
+		const TaskbarRecord record = { reinterpret_cast<uintptr_t>(static_cast<HWND>(taskbar.window)), taskbar.policy };
+		if (header.size + sizeof(record) > SHARED_MEMORY_SIZE)
+		{
+			break;
+		}
+
+		write(&record, sizeof(record));
+		header.taskbar_count++;
+	}
+
+	for (const Window::StableProperties &window : state.windows)
+	{
+		WindowRecord record = { reinterpret_cast<uintptr_t>(window.handle), window.owner, 0, 0, 0, 0 };
+		if (window.classname && window.classname->length() <= UINT16_MAX)
+		{
+			record.flags |= HasClassName;
+			record.classname_length = static_cast<uint16_t>(window.classname->length());
+		}
+
+		if (window.filename && window.filename->length() <= UINT16_MAX)
+		{
+			record.flags |= HasFileName;
+			record.filename_length = static_cast<uint16_t>(window.filename->length());
+		}
+
+		if (window.kind)
+		{
+			record.flags |= HasKind;
+			record.kind = static_cast<uint8_t>(*window.kind);
+		}
+
+		// Records are never cut in half, the cache is just a bit colder if they don't all fit.
+		const std::size_t size = sizeof(record) + (record.classname_length + record.filename_length) * sizeof(wchar_t);
+		if (header.size + size > SHARED_MEMORY_SIZE)
+		{
+			break;
+		}
+
+		write(&record, sizeof(record));
+		if (record.flags & HasClassName)
+		{
+			write(window.classname->data(), record.classname_length * sizeof(wchar_t));
+		}
+
+		if (record.flags & HasFileName)
+		{
+			write(window.filename->data(), record.filename_length * sizeof(wchar_t));
+		}
+
+		header.window_count++;
+	}
+
+	std::memcpy(view, &header, sizeof(header));
+	UnmapViewOfFile(view);
+
+	winrt::handle ready(OpenEvent(EVENT_MODIFY_STATE, FALSE, READY_EVENT_NAME));
+	if (!ready || !SetEvent(ready.get()))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to signal that the handover state is ready.");
+	}
+}
+
+std::optional<Handover::State> Handover::Read(const uint8_t *data, const DWORD &process)
+{
+	Header header;
+	std::memcpy(&header, data, sizeof(header));
+	if (header.version != VERSION || header.process_id != process || header.size < sizeof(header) || header.size > SHARED_MEMORY_SIZE)
+	{
+		Log::OutputFormatted(L"Ignoring handover state left by an incompatible instance.");
+		return std::nullopt;
+	}
+
+	std::size_t offset = sizeof(header);
+	const auto read = [data, &header, &offset](void *const destination, const std::size_t &size)
+	{
+		if (header.size - offset < size)
+		{
+			return false;
+		}
+
+		std::memcpy(destination, data + offset, size);
+		offset += size;
+		return true;
+	};
+
+	State state;
+	state.taskbars.reserve(header.taskbar_count);
+	for (uint32_t i = 0; i < header.taskbar_count; i++)
+	{
+		TaskbarRecord record;
+		if (!read(&record, sizeof(record)))
+		{
+			return std::nullopt;
+		}
+
+		state.taskbars.push_back({ reinterpret_cast<HWND>(static_cast<uintptr_t>(record.handle)), record.policy });
+	}
+
+	state.windows.reserve(header.window_count);
+	for (uint32_t i = 0; i < header.window_count; i++)
+	{
+		WindowRecord record;
+		if (!read(&record, sizeof(record)))
+		{
+			return std::nullopt;
+		}
+
+		Window::StableProperties &window = state.windows.emplace_back();
+		window.handle = reinterpret_cast<HWND>(static_cast<uintptr_t>(record.handle));
+		window.owner = record.owner;
+		if (record.flags & HasClassName)
+		{
+			window.classname.emplace(record.classname_length, L'\0');
+			if (!read(window.classname->data(), record.classname_length * sizeof(wchar_t)))
+			{
+				return std::nullopt;
+			}
+		}
+
+		if (record.flags & HasFileName)
+		{
+			window.filename.emplace(record.filename_length, L'\0');
+			if (!read(window.filename->data(), record.filename_length * sizeof(wchar_t)))
+			{
+				return std::nullopt;
+			}
+		}
+
+		if (record.flags & HasKind && record.kind <= static_cast<uint8_t>(Window::LAST_KIND))
+		{
+			window.kind = static_cast<Window::Kind>(record.kind);
+		}
+	}
+
+	return state;
+}
\ No newline at end of file
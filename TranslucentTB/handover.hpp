@@ -0,0 +1,70 @@
+#pragma once
+#include "arch.h"
+#include <cstdint>
+#include <optional>
+#include <vector>
+#include <windef.h>
+
+#include "swcadata.hpp"
+#include "window.hpp"
+
+// When a new instance replaces a running one, the old one leaves what it knows in shared memory,
+// so that the new one doesn't reapply every taskbar and refetch every window from scratch.
+class Handover {
+
+public:
+	struct TaskbarState {
+		Window window;
+		swca::ACCENTPOLICY policy; // What is currently on screen
+	};
+
+	struct State {
+		std::vector<TaskbarState> taskbars;
+		std::vector<Window::StableProperties> windows;
+	};
+
+	// Called by the new instance. Asks the instance owning the window to exit and waits for its state,
+	// gives up after the timeout or if it exited without leaving any, like versions before this did.
+	// When no state can come, waits for it to exit instead, up to the same timeout.
+	static std::optional<State> Request(const Window &previous, const unsigned int &timeout);
+
+	// Called by the old instance once it stopped touching the taskbars. Does nothing if nobody asked.
+	static void Publish(const State &state);
+
+private:
+	static constexpr wchar_t SHARED_MEMORY_NAME[] = L"Local\\TranslucentTB.Handover";
+	static constexpr wchar_t READY_EVENT_NAME[] = L"Local\\TranslucentTB.HandoverReady";
+	static constexpr uint32_t VERSION = 1;
+	static constexpr uint32_t SHARED_MEMORY_SIZE = 1024 * 1024; // What doesn't fit just doesn't get handed over
+
+	struct Header {
+		uint32_t version;
+		uint32_t process_id; // Of the old instance
+		uint32_t taskbar_count;
+		uint32_t window_count;
+		uint32_t size; // In bytes, including the header
+	};
+
+	// Followed by the class name and then the file name, as UTF-16 without terminator.
+	struct WindowRecord {
+		uint64_t handle;
+		uint32_t owner;
+		uint8_t flags;
+		uint8_t kind;
+		uint16_t classname_length;
+		uint16_t filename_length;
+	};
+
+	struct TaskbarRecord {
+		uint64_t handle;
+		swca::ACCENTPOLICY policy;
+	};
+
+	enum WindowFlags : uint8_t {
+		HasClassName = 1 << 0,
+		HasFileName = 1 << 1,
+		HasKind = 1 << 2
+	};
+
+	static std::optional<State> Read(const uint8_t *data, const DWORD &process);
+};
\ No newline at end of file
@@ -1,39 +1,59 @@
 #include "hooks.hpp"
+#include "apprules.hpp"
 #include "blacklist.hpp"
+#include "windowtracker.hpp"
 
-EventHook Hooks::m_ChangeHook(EVENT_OBJECT_NAMECHANGE, EVENT_OBJECT_NAMECHANGE, Hooks::HandleChangeEvent, WINEVENT_OUTOFCONTEXT);
-EventHook Hooks::m_DestroyHook(EVENT_OBJECT_DESTROY, EVENT_OBJECT_DESTROY, Hooks::HandleDestroyEvent, WINEVENT_OUTOFCONTEXT);
+// Destroyed windows are already gone by the time we get the event, so they can't be checked for being top-level.
+EventHook Hooks::m_ChangeHook(EVENT_OBJECT_NAMECHANGE, EVENT_OBJECT_NAMECHANGE, Hooks::HandleChangeEvent, WINEVENT_OUTOFCONTEXT, EventHook::Filter::TopLevelWindows);
+EventHook Hooks::m_DestroyHook(EVENT_OBJECT_DESTROY, EVENT_OBJECT_DESTROY, Hooks::HandleDestroyEvent, WINEVENT_OUTOFCONTEXT, EventHook::Filter::Windows);
+EventHook Hooks::m_VisibilityHook(EVENT_OBJECT_SHOW, EVENT_OBJECT_HIDE, Hooks::HandleStateEvent, WINEVENT_OUTOFCONTEXT, EventHook::Filter::TopLevelWindows);
+EventHook Hooks::m_LocationHook(EVENT_OBJECT_LOCATIONCHANGE, EVENT_OBJECT_LOCATIONCHANGE, Hooks::HandleStateEvent, WINEVENT_OUTOFCONTEXT, EventHook::Filter::TopLevelWindows);
+EventHook Hooks::m_CloakHook(EVENT_OBJECT_CLOAKED, EVENT_OBJECT_UNCLOAKED, Hooks::HandleStateEvent, WINEVENT_OUTOFCONTEXT, EventHook::Filter::TopLevelWindows);
+EventHook Hooks::m_MinimizeHook(EVENT_SYSTEM_MINIMIZESTART, EVENT_SYSTEM_MINIMIZEEND, Hooks::HandleStateEvent, WINEVENT_OUTOFCONTEXT, EventHook::Filter::TopLevelWindows);
 
-void Hooks::HandleChangeEvent(const DWORD, const Window &window, ...)
+void Hooks::HandleChangeEvent(const DWORD event, const Window &window, const LONG idObject, const LONG idChild, ...)
 {
-	{
-		std::lock_guard guard(Blacklist::m_CacheLock);
-		Blacklist::m_Cache.erase(window);
-	}
+	Blacklist::InvalidateTitleVerdict(window);
+	AppRules::InvalidateTitleVerdict(window);
 
 	{
-		std::lock_guard guard(Window::m_TitlesLock);
-		Window::m_Titles.erase(window);
+		std::lock_guard guard(Window::m_CacheLock);
+		Window::Invalidate(window, Window::Title);
 	}
+
+	// The title might have (un)blacklisted the window.
+	HandleStateEvent(event, window, idObject, idChild);
 }
 
 void Hooks::HandleDestroyEvent(const DWORD, const Window &window, ...)
 {
-	{
-		std::lock_guard guard(Blacklist::m_CacheLock);
-		Blacklist::m_Cache.erase(window);
-	}
+	Blacklist::Forget(window);
+	AppRules::Forget(window);
 
 	{
-		std::lock_guard guard(Window::m_TitlesLock);
-		Window::m_Titles.erase(window);
-	}
-	{
-		std::lock_guard guard(Window::m_ClassNamesLock);
-		Window::m_ClassNames.erase(window);
+		std::lock_guard guard(Window::m_CacheLock);
+		Window::Forget(window);
 	}
+
+	WindowTracker::Remove(window);
+}
+
+void Hooks::HandleStateEvent(const DWORD event, const Window &window, const LONG idObject, const LONG idChild, ...)
+{
+	if (idObject == OBJID_WINDOW && idChild == CHILDID_SELF)
 	{
-		std::lock_guard guard(Window::m_FilenamesLock);
-		Window::m_Filenames.erase(window);
+		if (event == EVENT_OBJECT_LOCATIONCHANGE || event == EVENT_OBJECT_CLOAKED || event == EVENT_OBJECT_UNCLOAKED)
+		{
+			std::lock_guard guard(Window::m_CacheLock);
+			Window::Invalidate(window, static_cast<uint8_t>((event == EVENT_OBJECT_LOCATIONCHANGE ? Window::Monitor : Window::Cloaked) | Window::Desktop));
+
+			// Switching virtual desktops uncloaks the windows of the new one, moving a window to another one cloaks it.
+			if (event == EVENT_OBJECT_UNCLOAKED)
+			{
+				Window::ForgetCurrentDesktop();
+			}
+		}
+
+		WindowTracker::Update(window);
 	}
 }
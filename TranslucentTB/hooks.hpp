@@ -6,7 +6,12 @@ class Hooks {
 private:
 	static EventHook m_ChangeHook;
 	static EventHook m_DestroyHook;
+	static EventHook m_VisibilityHook;
+	static EventHook m_LocationHook;
+	static EventHook m_CloakHook;
+	static EventHook m_MinimizeHook;
 
-	static void HandleChangeEvent(const DWORD, const Window &window, ...);
+	static void HandleChangeEvent(const DWORD, const Window &window, const LONG idObject, const LONG idChild, ...);
 	static void HandleDestroyEvent(const DWORD, const Window &window, ...);
+	static void HandleStateEvent(const DWORD event, const Window &window, const LONG idObject, const LONG idChild, ...);
 };
\ No newline at end of file
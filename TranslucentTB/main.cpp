@@ -1,27 +1,47 @@
 // Standard API
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <iterator>
+#include <memory>
 #include <mutex>
+#include <optional>
 #include <sstream>
 #include <string>
 #include <thread>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 // Windows API
 #include "arch.h"
 #include <PathCch.h>
 #include <ShlObj.h>
+#include <WtsApi32.h>
+#include <threadpoolapiset.h>
 
 // Local stuff
+#include "apprules.hpp"
 #include "appvisibilitysink.hpp"
 #include "autofree.hpp"
 #include "autostart.hpp"
 #include "blacklist.hpp"
 #include "common.hpp"
 #include "config.hpp"
+#include "controlpipe.hpp"
 #include "createinstance.hpp"
+#include "diagnostics.hpp"
+#include "directorywatcher.hpp"
+#include "evaluator.hpp"
 #include "eventhook.hpp"
+#include "eventtrace.hpp"
+#include "handover.hpp"
 #include "messagewindow.hpp"
+#include "monitortopology.hpp"
 #include "resource.h"
+#include "scheduler.hpp"
 #include "swcadata.hpp"
 #include "traycontextmenu.hpp"
 #include "ttberror.hpp"
@@ -33,41 +53,323 @@
 #include "win32.hpp"
 #include "window.hpp"
 #include "windowclass.hpp"
+#include "windowstatesnapshot.hpp"
+#include "windowtracker.hpp"
 
 #pragma region Data
 
-HWND hwnd;
-
 enum class EXITREASON {
 	NewInstance,		// New instance told us to exit
 	UserAction,			// Triggered by the user
 	UserActionNoSave	// Triggered by the user, but doesn't saves config
 };
 
+// Never modified once published, RefreshHandles publishes a whole new one instead.
+struct TaskbarSnapshot {
+	Window main_taskbar;
+	std::unordered_map<HMONITOR, Window> taskbars;
+	std::vector<Evaluator::Taskbar> monitors; // Same taskbars, as the evaluator wants them
+};
+
+// What an evaluation depends on, besides the window properties that are looked up.
+struct EvaluationInputs {
+	const TaskbarSnapshot *taskbars;
+	uint64_t config_version;
+	uint64_t tracker_generation;
+	uint64_t rules_generation;
+	Window foreground;
+	bool foreground_cloaked;
+	bool start_opened;
+	uint64_t visibility_generation;
+	bool peek_active;
+
+	inline bool operator ==(const EvaluationInputs &right) const
+	{
+		return taskbars == right.taskbars &&
+			config_version == right.config_version &&
+			tracker_generation == right.tracker_generation &&
+			rules_generation == right.rules_generation &&
+			foreground == right.foreground &&
+			foreground_cloaked == right.foreground_cloaked &&
+			start_opened == right.start_opened &&
+			visibility_generation == right.visibility_generation &&
+			peek_active == right.peek_active;
+	}
+};
+
+// GUID_CONSOLE_DISPLAY_STATE, GUID_ACDC_POWER_SOURCE and GUID_POWER_SAVING_STATUS, defined here to not need uuid.lib
+static constexpr GUID CONSOLE_DISPLAY_STATE = { 0x6fe69556, 0x704a, 0x47a0, { 0x8f, 0x24, 0xc2, 0x8d, 0x93, 0x6f, 0xda, 0x47 } };
+static constexpr GUID ACDC_POWER_SOURCE = { 0x5d3e9a59, 0xe9d5, 0x4b00, { 0xa6, 0xbd, 0xff, 0x34, 0xff, 0x51, 0x65, 0x48 } };
+static constexpr GUID POWER_SAVING_STATUS = { 0xe00958c0, 0xc213, 0x4ace, { 0xac, 0x77, 0xfe, 0xcc, 0xed, 0x2e, 0xee, 0xa5 } };
+
+// How long to wait for a window to process a message before giving up, in milliseconds.
+static constexpr unsigned int THEMECHANGED_TIMEOUT = 500;
+static constexpr unsigned int NEW_INSTANCE_TIMEOUT = 5000;
+
+// Posted to the tray window by the worker when the creation hook has to follow a new Explorer process.
+static constexpr wchar_t WATCH_EXPLORER[] = L"TTBWatchExplorer";
+
+// Posted to the tray window when a startup state query completes, with the state as wParam.
+static constexpr wchar_t STARTUP_STATE_KNOWN[] = L"TTBStartupStateKnown";
+
+#ifdef STARTUP_BENCHMARK
+// Posted to the tray window by the worker once its first pass is applied, benchmark builds exit there.
+static constexpr wchar_t STARTUP_DONE[] = L"TTBStartupDone";
+#endif
+
+// Things that happened since the last evaluation. They get merged until the worker drains them,
+// so a burst of them (like Explorer creating every taskbar after a restart) costs a single refresh.
+enum PendingEvent : uint32_t {
+	TaskbarsChanged = 1 << 0,
+	MonitorsChanged = 1 << 1,
+	ConfigChanged = 1 << 2,
+	ExcludeChanged = 1 << 3,
+	RulesChanged = 1 << 4,
+	VisibilityChanged = 1 << 5 // Start or an immersive app opened or closed, nothing to drain but skips the settle delay
+};
+
+// Applies happen on the thread pool, one taskbar at a time. WM_THEMECHANGED is a synchronous SendMessage
+// into explorer, so this way a hung taskbar only holds up its own updates, not the other monitors.
+struct TaskbarApply {
+	Window window;
+	bool in_flight = false;
+	bool failed = false;
+	std::optional<swca::ACCENTPOLICY> queued; // Latest policy not yet applied, replaces older ones
+};
+
+// A taskbar fading from one color to another, one step per composed frame.
+struct TaskbarTransition {
+	std::shared_ptr<TaskbarApply> apply;
+	swca::ACCENTPOLICY from;
+	swca::ACCENTPOLICY to;
+	swca::ACCENTPOLICY current; // Last step queued
+	std::chrono::steady_clock::time_point start;
+	std::chrono::milliseconds duration;
+};
+
 static struct {
 	EXITREASON exit_reason = EXITREASON::UserAction;
-	std::mutex taskbars_mutex;
-	Window main_taskbar;
-	std::unordered_map<HMONITOR, std::pair<Window, const Config::TASKBAR_APPEARANCE *>> taskbars;
+	std::shared_ptr<const TaskbarSnapshot> taskbars; // Only access through std::atomic_load and std::atomic_store
+	std::atomic_bool reapply_needed = false;
+	std::atomic_bool retry_needed = false; // An apply failed, the next pass can't be skipped even if nothing changed
 	bool should_show_peek = true;
 	bool is_running = true;
 	std::wstring config_folder;
 	std::wstring config_file;
 	std::wstring exclude_file;
+	std::wstring rules_file;
 	bool peek_active = false;
-	bool start_opened = false;
+	std::atomic_bool start_opened = false;
+
+	// Monitors where an immersive app (Start included) is visible, as told by the app visibility sink.
+	// Forgotten on display changes, since the handles of monitors that went away can be reused.
+	std::mutex visibility_lock;
+	std::vector<HMONITOR> immersive_monitors;
+	std::atomic_uint64_t visibility_generation = 0;
+	winrt::handle evaluate_event;
+	std::atomic_uint32_t pending_events = 0; // Bitmask of PendingEvent
+	std::atomic<DWORD> explorer_pid = 0; // As of the last refresh
+	std::atomic<HWND> tray_window = nullptr;
+
+	// Only touched by the main thread
+	DWORD hooked_pid = 0;
+	std::unique_ptr<EventHook> creation_hook;
+	std::optional<Autostart::StartupState> startup_state; // As of the last query, so that the menu never waits on it
+
+	// Only used by the worker thread
+	std::unordered_map<HMONITOR, Config::TASKBAR_APPEARANCE> appearances;
+	std::unordered_map<Window, swca::ACCENTPOLICY> applied_policies;
+
+	// Only used by whoever calls SetWindowBlur, which is never two threads at once.
+	std::unordered_map<Window, std::shared_ptr<TaskbarApply>> applies;
+
+	// Guards the TaskbarApply contents, which the thread pool changes.
+	std::mutex apply_lock;
+	std::condition_variable applies_done;
+	std::size_t applies_in_flight = 0;
+
+	// Also guarded by apply_lock.
+	std::unordered_map<Window, TaskbarTransition> transitions;
+	std::condition_variable transitions_changed;
+	bool transitions_stop = false;
 } run;
 
 #pragma endregion
 
 #pragma region That one function that does all the magic
 
+void RequestEvaluation();
+
+bool ApplyPolicy(const Window &window, swca::ACCENTPOLICY policy)
+{
+	Diagnostics::Increment(Diagnostics::Counter::SwcaCalls);
+	const Diagnostics::Span span(Diagnostics::Stage::Swca);
+
+	if (policy.nAccentState == swca::ACCENT::ACCENT_NORMAL)
+	{
+		// WM_THEMECHANGED makes the taskbar reload the theme and reapply the normal effect.
+		// Gotta memoize it because constantly sending it makes explorer's CPU usage jump.
+		// Bounded so that a hung explorer doesn't tie up a thread pool thread, it gets retried on the next evaluation.
+		if (!window.send_message_timeout(WM_THEMECHANGED, THEMECHANGED_TIMEOUT))
+		{
+			return false;
+		}
+	}
+	else
+	{
+		swca::WINCOMPATTRDATA data = {
+			swca::WindowCompositionAttribute::WCA_ACCENT_POLICY,
+			&policy,
+			sizeof(policy)
+		};
+
+		if (!user32::SetWindowCompositionAttribute(window, &data))
+		{
+			LastErrorHandle(Error::Level::Log, L"Setting window composition attribute failed.");
+			return false;
+		}
+	}
+
+	Diagnostics::RecordApply();
+	return true;
+}
+
+void CALLBACK ApplyCallback(PTP_CALLBACK_INSTANCE, void *context)
+{
+	const std::unique_ptr<std::shared_ptr<TaskbarApply>> state(static_cast<std::shared_ptr<TaskbarApply> *>(context));
+	TaskbarApply &apply = **state;
+
+	// Whatever got queued meanwhile gets applied too, so that the taskbar ends up with the latest policy.
+	std::unique_lock guard(run.apply_lock);
+	while (apply.queued)
+	{
+		const swca::ACCENTPOLICY policy = *apply.queued;
+		apply.queued.reset();
+
+		guard.unlock();
+		const bool applied = ApplyPolicy(apply.window, policy);
+		guard.lock();
+
+		apply.failed = !applied;
+	}
+
+	// SetWindowBlur retries failed taskbars, but an idle desktop wouldn't give it a pass to do it.
+	if (apply.failed)
+	{
+		run.retry_needed = true;
+		RequestEvaluation();
+	}
+
+	apply.in_flight = false;
+	run.applies_in_flight--;
+	run.applies_done.notify_all();
+}
+
+// Waits for the taskbars to be done applying, but not forever, since one of them might be hung.
+void WaitForApplies()
+{
+	std::unique_lock guard(run.apply_lock);
+	run.applies_done.wait_for(guard, std::chrono::seconds(1), []
+	{
+		return run.applies_in_flight == 0;
+	});
+}
+
+// apply_lock must be held. Returns true if the caller has to submit the apply once it released the lock.
+bool QueueApply(TaskbarApply &state, const swca::ACCENTPOLICY &policy)
+{
+	state.queued = policy;
+	if (state.in_flight)
+	{
+		return false; // Picked up by the running callback once it's done.
+	}
+
+	state.in_flight = true;
+	run.applies_in_flight++;
+	return true;
+}
+
+void SubmitApply(const std::shared_ptr<TaskbarApply> &state)
+{
+	const auto context = new std::shared_ptr<TaskbarApply>(state);
+	if (!TrySubmitThreadpoolCallback(ApplyCallback, context, NULL))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to submit taskbar appearance change to the thread pool.");
+		ApplyCallback(NULL, context);
+	}
+}
+
+// Interpolates each channel separately. Progress goes from 0 to 1.
+uint32_t InterpolateColor(const uint32_t &from, const uint32_t &to, const float &progress)
+{
+	uint32_t result = 0;
+	for (unsigned int shift = 0; shift < 32; shift += 8)
+	{
+		const float start = static_cast<float>((from >> shift) & 0xFF);
+		const float end = static_cast<float>((to >> shift) & 0xFF);
+		result |= static_cast<uint32_t>(start + (end - start) * progress + 0.5f) << shift;
+	}
+
+	return result;
+}
+
+// Steps the taskbars that are fading once per frame DWM composes, and sleeps while none are,
+// so that transitions cost nothing when they're not running.
+void TransitionThread()
+{
+	std::vector<std::shared_ptr<TaskbarApply>> submits;
+
+	std::unique_lock guard(run.apply_lock);
+	while (true)
+	{
+		run.transitions_changed.wait(guard, []
+		{
+			return run.transitions_stop || !run.transitions.empty();
+		});
+
+		if (run.transitions_stop)
+		{
+			break;
+		}
+
+		// Step at most once per composed frame, a faster step would never be seen.
+		guard.unlock();
+		if (FAILED(DwmFlush()))
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(16)); // Composition isn't running, go at about 60 Hz.
+		}
+		guard.lock();
+
+		// A taskbar that's still busy with the previous step just gets the latest one, so slow taskbars skip frames.
+		const auto now = std::chrono::steady_clock::now();
+		for (auto it = run.transitions.begin(); it != run.transitions.end();)
+		{
+			TaskbarTransition &transition = it->second;
+			const float progress = (std::min)(std::chrono::duration<float>(now - transition.start) / transition.duration, 1.0f);
+
+			transition.current.nColor = InterpolateColor(transition.from.nColor, transition.to.nColor, progress);
+			if (QueueApply(*transition.apply, transition.current))
+			{
+				submits.push_back(transition.apply);
+			}
+
+			it = progress < 1.0f ? std::next(it) : run.transitions.erase(it);
+		}
+
+		guard.unlock();
+		for (const auto &state : submits)
+		{
+			SubmitApply(state);
+		}
+		submits.clear();
+		guard.lock();
+	}
+}
+
 void SetWindowBlur(const Window &window, const swca::ACCENT &appearance, const uint32_t &color)
 {
 	if (user32::SetWindowCompositionAttribute)
 	{
-		static std::unordered_map<Window, bool> is_normal;
-
 		swca::ACCENTPOLICY policy = {
 			appearance,
 			2,
@@ -77,14 +379,7 @@ void SetWindowBlur(const Window &window, const swca::ACCENT &appearance, const u
 
 		if (policy.nAccentState == swca::ACCENT::ACCENT_NORMAL)
 		{
-			if (is_normal.count(window) == 0 || !is_normal[window])
-			{
-				// WM_THEMECHANGED makes the taskbar reload the theme and reapply the normal effect.
-				// Gotta memoize it because constantly sending it makes explorer's CPU usage jump.
-				window.send_message(WM_THEMECHANGED);
-				is_normal[window] = true;
-			}
-			return;
+			policy.nColor = 0; // Color is ignored, don't make it look like it changed.
 		}
 		else if (policy.nAccentState == swca::ACCENT::ACCENT_ENABLE_FLUENT && policy.nColor >> 24 == 0x00)
 		{
@@ -92,14 +387,51 @@ void SetWindowBlur(const Window &window, const swca::ACCENT &appearance, const u
 			policy.nColor = (0x01 << 24) + (policy.nColor & 0x00FFFFFF);
 		}
 
-		swca::WINCOMPATTRDATA data = {
-			swca::WindowCompositionAttribute::WCA_ACCENT_POLICY,
-			&policy,
-			sizeof(policy)
-		};
+		auto &state = run.applies[window];
+		if (!state)
+		{
+			state = std::make_shared<TaskbarApply>();
+			state->window = window;
+		}
+
+		std::unique_lock guard(run.apply_lock);
+
+		// Every call makes explorer and DWM recomposite the taskbar, so only apply when something changed.
+		// Failed applies are retried, like they were never done.
+		const auto applied = !state->failed ? run.applied_policies.find(window) : run.applied_policies.end();
+		if (applied != run.applied_policies.end())
+		{
+			const swca::ACCENTPOLICY &previous = applied->second;
+			if (previous.nAccentState == policy.nAccentState && previous.nColor == policy.nColor && previous.nFlags == policy.nFlags)
+			{
+				Diagnostics::Increment(Diagnostics::Counter::SwcaSkipped);
+				return;
+			}
 
-		user32::SetWindowCompositionAttribute(window, &data);
-		is_normal[window] = false;
+			// Only colors can be faded, a different accent is applied right away.
+			const std::chrono::milliseconds duration(Config::Current()->TRANSITION_TIME);
+			if (duration.count() != 0 && !Scheduler::Throttled() && previous.nAccentState == policy.nAccentState && policy.nAccentState != swca::ACCENT::ACCENT_NORMAL)
+			{
+				// When retargeting a running transition, start from where it currently is.
+				const auto running = run.transitions.find(window);
+				const swca::ACCENTPOLICY from = running != run.transitions.end() ? running->second.current : previous;
+
+				run.transitions[window] = { state, from, policy, from, std::chrono::steady_clock::now(), duration };
+				run.applied_policies[window] = policy;
+				run.transitions_changed.notify_one();
+				return;
+			}
+		}
+
+		run.transitions.erase(window); // Jumping replaces any fade still going on.
+		run.applied_policies[window] = policy;
+		const bool submit = QueueApply(*state, policy);
+		guard.unlock();
+
+		if (submit)
+		{
+			SubmitApply(state);
+		}
 	}
 }
 
@@ -123,14 +455,17 @@ void GetPaths()
 	AutoFree::Local<wchar_t> configFolder;
 	AutoFree::Local<wchar_t> configFile;
 	AutoFree::Local<wchar_t> excludeFile;
+	AutoFree::Local<wchar_t> rulesFile;
 
 	ErrorHandle(PathAllocCombine(appData, NAME, PATHCCH_ALLOW_LONG_PATHS, configFolder.put()), Error::Level::Fatal, L"Failed to combine AppData folder and application name!");
 	ErrorHandle(PathAllocCombine(configFolder.get(), CONFIG_FILE, PATHCCH_ALLOW_LONG_PATHS, configFile.put()), Error::Level::Fatal, L"Failed to combine config folder and config file!");
 	ErrorHandle(PathAllocCombine(configFolder.get(), EXCLUDE_FILE, PATHCCH_ALLOW_LONG_PATHS, excludeFile.put()), Error::Level::Fatal, L"Failed to combine config folder and exclude file!");
+	ErrorHandle(PathAllocCombine(configFolder.get(), RULES_FILE, PATHCCH_ALLOW_LONG_PATHS, rulesFile.put()), Error::Level::Fatal, L"Failed to combine config folder and rules file!");
 
 	run.config_folder = configFolder.get();
 	run.config_file = configFile.get();
 	run.exclude_file = excludeFile.get();
+	run.rules_file = rulesFile.get();
 
 #ifdef STORE
 	}
@@ -198,6 +533,10 @@ bool CheckAndRunWelcome()
 	{
 		ApplyStock(EXCLUDE_FILE);
 	}
+	if (!win32::FileExists(run.rules_file))
+	{
+		ApplyStock(RULES_FILE);
+	}
 	return true;
 }
 
@@ -205,24 +544,307 @@ bool CheckAndRunWelcome()
 
 #pragma region Utilities
 
+// Pages that get used again are faulted back in, so this is only worth it once things settled down.
+void TrimWorkingSet()
+{
+	SetLastError(NO_ERROR); // Also returns 0 when there's nothing free
+	if (!HeapCompact(GetProcessHeap(), 0) && GetLastError() != NO_ERROR)
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to compact the process heap.");
+	}
+
+	if (!SetProcessWorkingSetSizeEx(GetCurrentProcess(), static_cast<SIZE_T>(-1), static_cast<SIZE_T>(-1), 0))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to trim the working set.");
+	}
+}
+
+// Wakes up the worker thread, and keeps it at the fast rate for a little while.
+void RequestEvaluation()
+{
+	Scheduler::NotifyActivity();
+	if (!SetEvent(run.evaluate_event.get()))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to signal state evaluation request.");
+	}
+}
+
+// Forgets what was applied to the taskbars, so that it gets reapplied on the next evaluation.
+void InvalidateAppliedState()
+{
+	run.reapply_needed = true;
+	RequestEvaluation();
+}
+
+// Queues an event for the worker to handle on its next pass.
+void PostEvent(const PendingEvent &event)
+{
+	run.pending_events.fetch_or(event);
+	RequestEvaluation();
+}
+
+// Called by the app visibility sink, on its own thread.
+void HandleLauncherVisibility(const bool &visible)
+{
+	if (EventTrace::Recording())
+	{
+		EventTrace::Launcher(visible);
+	}
+
+	run.start_opened = visible;
+	run.visibility_generation++;
+	PostEvent(PendingEvent::VisibilityChanged);
+}
+
+void HandleMonitorAppVisibility(const HMONITOR &monitor, const bool &app_visible)
+{
+	if (EventTrace::Recording())
+	{
+		EventTrace::MonitorApp(monitor, app_visible);
+	}
+
+	{
+		std::lock_guard guard(run.visibility_lock);
+		auto &monitors = run.immersive_monitors;
+		if (const auto it = std::find(monitors.begin(), monitors.end(), monitor); app_visible && it == monitors.end())
+		{
+			monitors.push_back(monitor);
+		}
+		else if (!app_visible && it != monitors.end())
+		{
+			monitors.erase(it);
+		}
+	}
+
+	run.visibility_generation++;
+	PostEvent(PendingEvent::VisibilityChanged);
+}
+
+void SetSchedulerPaused(const Scheduler::Pause &reason, const bool &paused)
+{
+	if (Scheduler::SetPaused(reason, paused))
+	{
+		// Catch up with what changed while we weren't looking. Explorer might also have
+		// reset the taskbars, for example when an RDP session reconnects.
+		InvalidateAppliedState();
+	}
+}
+
+// Called from the thread pool when a file in the configuration folder changed.
+// Editors often write a file several times when saving, the worker only reparses once.
+void HandleConfigChange(const std::wstring &file)
+{
+	const bool all = file.empty();
+	if (all || Util::IgnoreCaseStringEquals(file, CONFIG_FILE))
+	{
+		PostEvent(PendingEvent::ConfigChanged);
+	}
+
+	if (all || Util::IgnoreCaseStringEquals(file, EXCLUDE_FILE))
+	{
+		PostEvent(PendingEvent::ExcludeChanged);
+	}
+
+	if (all || Util::IgnoreCaseStringEquals(file, RULES_FILE))
+	{
+		PostEvent(PendingEvent::RulesChanged);
+	}
+}
+
+// Called from the thread pool for every request on the control pipe.
+HRESULT HandleControlCommand(const ControlPipe::Command &command, const std::vector<uint8_t> &payload, std::vector<uint8_t> &reply)
+{
+	const auto append = [&reply](const auto &value)
+	{
+		const auto bytes = reinterpret_cast<const uint8_t *>(&value);
+		reply.insert(reply.end(), bytes, bytes + sizeof(value));
+	};
+
+	switch (command)
+	{
+	case ControlPipe::Command::QueryVersion:
+		append(ControlPipe::PROTOCOL_VERSION);
+		return S_OK;
+
+	case ControlPipe::Command::ApplyConfig:
+		if (payload.size() % sizeof(wchar_t) != 0)
+		{
+			return E_INVALIDARG;
+		}
+
+		// The worker notices the new version. It gets saved on exit like any other change.
+		Config::ParseText(std::wstring_view(reinterpret_cast<const wchar_t *>(payload.data()), payload.size() / sizeof(wchar_t)));
+		Log::OutputFormatted(L"Configuration applied through the control pipe.");
+		RequestEvaluation();
+		return S_OK;
+
+	case ControlPipe::Command::ReloadFiles:
+		HandleConfigChange({ });
+		return S_OK;
+
+	case ControlPipe::Command::QueryCounters:
+		append(static_cast<uint32_t>(Diagnostics::Counter::Count));
+		for (std::size_t i = 0; i < static_cast<std::size_t>(Diagnostics::Counter::Count); i++)
+		{
+			append(Diagnostics::Get(static_cast<Diagnostics::Counter>(i)));
+		}
+		return S_OK;
+
+	case ControlPipe::Command::QueryCacheStats:
+		append(ControlPipe::CacheStats {
+			Diagnostics::Get(Diagnostics::Counter::WindowCacheSize),
+			Window::CACHE_CAPACITY,
+			Diagnostics::Get(Diagnostics::Counter::WindowCacheHits),
+			Diagnostics::Get(Diagnostics::Counter::WindowCacheMisses),
+			Diagnostics::Get(Diagnostics::Counter::BlacklistCacheSize),
+			Blacklist::CACHE_CAPACITY,
+			Diagnostics::Get(Diagnostics::Counter::BlacklistCacheHits),
+			Diagnostics::Get(Diagnostics::Counter::BlacklistCacheMisses),
+			Diagnostics::Get(Diagnostics::Counter::CacheEvictions)
+		});
+		return S_OK;
+
+	default:
+		return E_NOTIMPL;
+	}
+}
+
 void RefreshHandles()
 {
-	if (Config::VERBOSE)
+	if (Config::Current()->VERBOSE)
 	{
-		Log::OutputMessage(L"Refreshing taskbar handles.");
+		Log::OutputFormatted(L"Refreshing taskbar handles.");
 	}
 
-	std::lock_guard guard(run.taskbars_mutex);
+	// Windows might have moved to a different monitor.
+	MonitorTopology::Rebuild();
+	Window::ClearMonitorCache();
+	WindowTracker::Rescan();
+	{
+		std::lock_guard guard(run.visibility_lock);
+		run.immersive_monitors.clear();
+	}
+	run.visibility_generation++;
 
-	// Older handles are invalid, so clear the map to be ready for new ones
-	run.taskbars.clear();
+	// Taskbars might have been added or removed, so build a new snapshot. The worker will pick it up on its next pass,
+	// so this never has to wait for an evaluation to finish.
+	auto snapshot = std::make_shared<TaskbarSnapshot>();
 
-	run.main_taskbar = Window::Find(L"Shell_TrayWnd");
-	run.taskbars[run.main_taskbar.monitor()] = { run.main_taskbar, &Config::REGULAR_APPEARANCE };
+	snapshot->main_taskbar = Window::Find(L"Shell_TrayWnd");
+	snapshot->taskbars[snapshot->main_taskbar.monitor()] = snapshot->main_taskbar;
 
 	for (const Window secondtaskbar : Window::FindEnum(L"Shell_SecondaryTrayWnd"))
 	{
-		run.taskbars[secondtaskbar.monitor()] = { secondtaskbar, &Config::REGULAR_APPEARANCE };
+		snapshot->taskbars[secondtaskbar.monitor()] = secondtaskbar;
+	}
+
+	for (const auto &[monitor, taskbar] : snapshot->taskbars)
+	{
+		snapshot->monitors.push_back({ monitor, taskbar == snapshot->main_taskbar });
+	}
+
+	// The creation hook is bound to Explorer's process, so it needs to be recreated when Explorer restarts.
+	// Out of context hooks are delivered through the message loop of the thread that made them, so let the main thread do it.
+	DWORD explorer_pid = 0;
+	GetWindowThreadProcessId(snapshot->main_taskbar, &explorer_pid);
+	if (run.explorer_pid.exchange(explorer_pid) != explorer_pid)
+	{
+		if (const Window tray = run.tray_window.load(); tray && !tray.post_message(WATCH_EXPLORER))
+		{
+			LastErrorHandle(Error::Level::Log, L"Failed to ask the main thread to watch the new Explorer process.");
+		}
+	}
+
+	// Most display changes don't add or remove a taskbar, and then there's nothing for the worker to catch up on.
+	if (const auto current = std::atomic_load(&run.taskbars); current && current->main_taskbar == snapshot->main_taskbar && current->taskbars == snapshot->taskbars)
+	{
+		return;
+	}
+
+	if (EventTrace::Recording())
+	{
+		EventTrace::Taskbars(snapshot->monitors);
+	}
+
+	std::atomic_store(&run.taskbars, std::shared_ptr<const TaskbarSnapshot>(std::move(snapshot)));
+	RequestEvaluation();
+}
+
+// Only called by the main thread.
+void WatchExplorer()
+{
+	const DWORD explorer_pid = run.explorer_pid;
+	if (!run.creation_hook || explorer_pid != run.hooked_pid)
+	{
+		// Detect additional monitor connect/disconnect. Only Explorer creates taskbars, so don't get notified for
+		// every window in the system. If Explorer isn't running, the PID is 0 and we watch every process instead.
+		run.hooked_pid = explorer_pid;
+		run.creation_hook.reset(); // Unhook first, so that we never get duplicate events.
+		run.creation_hook = std::make_unique<EventHook>(
+			EVENT_OBJECT_CREATE,
+			EVENT_OBJECT_CREATE,
+			[](DWORD, const Window &window, ...)
+			{
+				if (const std::wstring &classname = window.classname(); classname == L"Shell_TrayWnd" || classname == L"Shell_SecondaryTrayWnd")
+				{
+					PostEvent(PendingEvent::TaskbarsChanged);
+				}
+			},
+			WINEVENT_OUTOFCONTEXT,
+			EventHook::Filter::TopLevelWindows,
+			nullptr,
+			explorer_pid
+		);
+	}
+}
+
+// Handles everything that was posted since the last pass, each kind of event only once. Only called by the worker thread.
+void DrainEvents()
+{
+	const uint32_t events = run.pending_events.exchange(0);
+	if (events & PendingEvent::ConfigChanged)
+	{
+		// The worker notices the new version, the hooks and handles are unaffected.
+		Config::Parse(run.config_file);
+		Log::OutputFormatted(L"Configuration file changed, reloaded it.");
+	}
+
+	if (events & PendingEvent::ExcludeChanged)
+	{
+		// Only clears the verdicts, the window property caches are still valid. The tracked windows got
+		// their verdict from the old list though, so they need a rescan (which also bumps the generation
+		// the pass checks). Refreshing the handles below already does one.
+		Blacklist::Parse(run.exclude_file);
+		if (!(events & (PendingEvent::TaskbarsChanged | PendingEvent::MonitorsChanged)))
+		{
+			WindowTracker::Rescan();
+		}
+		Log::OutputFormatted(L"Dynamic windows exclude file changed, reloaded it.");
+	}
+
+	if (events & PendingEvent::RulesChanged)
+	{
+		AppRules::Parse(run.rules_file);
+		Log::OutputFormatted(L"Application rules file changed, reloaded it.");
+	}
+
+	if (events & (PendingEvent::TaskbarsChanged | PendingEvent::MonitorsChanged))
+	{
+		RefreshHandles();
+	}
+}
+
+// Gives back what the caches hold and what the working set doesn't need. Everything gets fetched again on demand.
+void ReleaseMemory()
+{
+	Window::ReleaseCache();
+	Blacklist::ClearCache();
+	AppRules::ClearCache();
+	TrimWorkingSet();
+
+	if (Config::Current()->VERBOSE)
+	{
+		Log::OutputFormatted(L"Released cached memory after a quiet period.");
 	}
 }
 
@@ -257,155 +879,311 @@ void RefreshAutostartMenu(HMENU menu, const Autostart::StartupState &state)
 	case Autostart::StartupState::Disabled:
 		autostart_text = L"Open at boot";
 	}
-	TrayContextMenu::ChangeItemText(menu, IDM_AUTOSTART, std::move(autostart_text));
-}
+	TrayContextMenu::ChangeItemText(menu, IDM_AUTOSTART, std::move(autostart_text));
+}
+
+// The query can complete on any thread, and after the menu it was for is gone, so the result goes to the tray window.
+void QueryStartupState()
+{
+	Autostart::GetStartupState().Completed([](auto info, ...)
+	{
+		const Autostart::StartupState state = info.GetResults();
+		if (const Window tray = run.tray_window.load(); tray && !tray.post_message(STARTUP_STATE_KNOWN, static_cast<unsigned int>(state)))
+		{
+			LastErrorHandle(Error::Level::Log, L"Failed to tell the main thread about the startup state.");
+		}
+	});
+}
+
+void RefreshMenu(HMENU menu)
+{
+	if (run.startup_state)
+	{
+		RefreshAutostartMenu(menu, *run.startup_state);
+	}
+	else
+	{
+		TrayContextMenu::RefreshBool(IDM_AUTOSTART, menu, false, TrayContextMenu::ControlsEnabled);
+		TrayContextMenu::RefreshBool(IDM_AUTOSTART, menu, false, TrayContextMenu::Toggle);
+		TrayContextMenu::ChangeItemText(menu, IDM_AUTOSTART, L"Querying startup state...");
+	}
+
+	// It can be changed from Task Manager or Group Policy, so the next time the menu opens shows that.
+	QueryStartupState();
+}
+
+#pragma endregion
+
+#pragma region Main logic
+
+// When skip_unchanged is set, trusts the hooks to have noticed every change and does nothing if none of the inputs changed.
+void SetTaskbarBlur(const bool &skip_unchanged = false)
+{
+	const Diagnostics::Span span(Diagnostics::Stage::Evaluation);
+	static std::shared_ptr<const TaskbarSnapshot> snapshot;
+	static EvaluationInputs last_inputs;
+
+	if (auto latest = std::atomic_load(&run.taskbars); latest != snapshot)
+	{
+		// Only forget the taskbars that are gone. New ones have nothing applied yet, so they get their
+		// appearance on this pass, while the ones still around keep theirs (an apply might also still be running for them).
+		snapshot = std::move(latest);
+		const auto prune = [](auto &map)
+		{
+			for (auto it = map.begin(); it != map.end();)
+			{
+				const bool current = snapshot && std::any_of(snapshot->taskbars.begin(), snapshot->taskbars.end(), [&it](const auto &taskbar)
+				{
+					return taskbar.second == it->first;
+				});
+				it = current ? std::next(it) : map.erase(it);
+			}
+		};
+
+		prune(run.applied_policies);
+		prune(run.applies);
+
+		std::lock_guard guard(run.apply_lock);
+		prune(run.transitions);
+	}
+
+	if (!snapshot)
+	{
+		return;
+	}
 
-void RefreshMenu(HMENU menu)
-{
-	TrayContextMenu::RefreshBool(IDM_AUTOSTART, menu, false, TrayContextMenu::ControlsEnabled);
-	TrayContextMenu::RefreshBool(IDM_AUTOSTART, menu, false, TrayContextMenu::Toggle);
-	TrayContextMenu::ChangeItemText(menu, IDM_AUTOSTART, L"Querying startup state...");
-	Autostart::GetStartupState().Completed([menu](auto info, ...)
+	bool reapply = false;
+	if (run.reapply_needed.exchange(false))
 	{
-		RefreshAutostartMenu(menu, info.GetResults());
-	});
-}
+		run.applied_policies.clear();
+		reapply = true;
+	}
+	if (run.retry_needed.exchange(false))
+	{
+		reapply = true;
+	}
 
-#pragma endregion
+	// Same settings for the whole pass, even if they get changed meanwhile.
+	const auto config = Config::Current();
 
-#pragma region Main logic
+	const Window fg_window = Window::ForegroundWindow();
+	WindowStateSnapshot state; // So that the foreground window is only queried once this pass.
 
-BOOL CALLBACK EnumWindowsProcess(const HWND hWnd, LPARAM)
-{
-	const Window window(hWnd);
-	hwnd = hWnd;
-	// DWMWA_CLOAKED should take care of checking if it's on the current desktop.
-	// But that's undocumented behavior.
-	// Do both but with on_current_desktop last.
-	if (window.visible() && window.state() == SW_MAXIMIZE && !window.get_attribute<BOOL>(DWMWA_CLOAKED) &&
-		!Blacklist::IsBlacklisted(window) && window.on_current_desktop() && run.taskbars.count(window.monitor()) != 0)
+	// Read once, so that the whole pass agrees on it. The generation is read before the monitors, so that
+	// a change while copying them makes the next pass look again.
+	const bool start_opened = run.start_opened;
+	const uint64_t visibility_generation = run.visibility_generation;
+	static std::vector<HMONITOR> start_monitors; // Kept around to reuse its storage.
+	if (config->START_ENABLED && start_opened)
 	{
-		auto &taskbar = run.taskbars.at(window.monitor());
-		if (Config::MAXIMISED_ENABLED)
+		// The sink tells about every immersive app, not only Start. When Start has the focus, its monitor is the one.
+		if (fg_window != Window::NullWindow && fg_window.kind() == Window::Kind::StartHost)
 		{
-			taskbar.second = &Config::MAXIMISED_APPEARANCE;
+			start_monitors.assign(1, state.monitor(fg_window));
 		}
+		else
+		{
+			std::lock_guard guard(run.visibility_lock);
+			start_monitors = run.immersive_monitors;
+		}
+	}
+	else
+	{
+		start_monitors.clear();
+	}
+
+	// When woken up by an event that didn't change anything we look at, there's nothing to do.
+	const EvaluationInputs inputs = {
+		snapshot.get(),
+		config->VERSION,
+		WindowTracker::Generation(),
+		AppRules::Generation(),
+		fg_window,
+		fg_window != Window::NullWindow && state.cloaked(fg_window),
+		start_opened,
+		visibility_generation,
+		run.peek_active
+	};
+	if (skip_unchanged && !reapply && inputs == last_inputs)
+	{
+		Diagnostics::Increment(Diagnostics::Counter::EvaluationsSkipped);
+		return;
+	}
+	last_inputs = inputs;
+
+	// Classified once per window, so a steady foreground window costs no string work.
+	const Window::Kind fg_kind = fg_window != Window::NullWindow ? fg_window.kind() : Window::Kind::Normal;
 
-		if (Config::PEEK == Config::PEEK::Dynamic)
+	const HMONITOR fg_monitor = fg_window != Window::NullWindow ? state.monitor(fg_window) : nullptr;
+	Evaluator::Queries queries = { WindowTracker::HasMaximisedWindow };
+	if (!AppRules::Empty())
+	{
+		// Highest priority on each monitor, the foreground window wins ties.
+		queries.rule_appearance = [&fg_window, &fg_monitor](const HMONITOR &monitor) -> std::optional<Config::TASKBAR_APPEARANCE>
 		{
-			if (Config::PEEK_ONLY_MAIN)
+			std::optional<AppRules::Rule> best;
+			if (monitor == fg_monitor)
+			{
+				best = AppRules::Lookup(fg_window);
+			}
+
+			static std::vector<Window> maximised; // Kept around to reuse its storage, only the worker evaluates.
+			WindowTracker::MaximisedWindows(monitor, maximised);
+			for (const Window &window : maximised)
 			{
-				if (taskbar.first == run.main_taskbar)
+				if (const auto rule = AppRules::Lookup(window); rule && (!best || rule->priority > best->priority))
 				{
-					run.should_show_peek = true;
+					best = rule;
 				}
 			}
+
+			if (best)
+			{
+				return best->appearance;
+			}
 			else
 			{
-				run.should_show_peek = true;
+				return std::nullopt;
 			}
-		}
+		};
+	}
+
+	const Evaluator::Inputs evaluator_inputs = {
+		snapshot->monitors,
+		fg_monitor,
+		fg_kind,
+		inputs.foreground_cloaked,
+		start_opened,
+		start_monitors,
+		inputs.peek_active
+	};
+	run.should_show_peek = Evaluator::Evaluate(*config, evaluator_inputs, queries, run.appearances);
+
+	for (const auto &[monitor, taskbar] : snapshot->taskbars)
+	{
+		const Config::TASKBAR_APPEARANCE &appearance = run.appearances.at(monitor);
+		SetWindowBlur(taskbar, appearance.ACCENT, appearance.COLOR);
 	}
-	return true;
 }
 
-void SetTaskbarBlur()
+// Gives the taskbars their regular appearance, without waiting for anything else to be ready.
+// Only call before the worker thread starts, the worker corrects it once it knows the whole state.
+void ApplyInitialAppearance()
 {
-	const Window window(hwnd);
-	static uint8_t counter = 10;
-
-	std::lock_guard guard(run.taskbars_mutex);
-	if (counter >= 10)	// Change this if you want to change the time it takes for the program to update.
-	{					// 1 = Config::SLEEP_TIME; we use 10 (assuming the default configuration value of 10),
-						// because the difference is less noticeable and it has no large impact on CPU.
-						// We can change this if we feel that CPU is more important than response time.
-		run.should_show_peek = (Config::PEEK == Config::PEEK::Enabled);
+	const auto config = Config::Current();
 
-		for (auto &[_, pair] : run.taskbars)
-		{
-			pair.second = &Config::REGULAR_APPEARANCE; // Reset taskbar state
-		}
-		if (Config::MAXIMISED_ENABLED || Config::PEEK == Config::PEEK::Dynamic)
-		{
-			EnumWindows(&EnumWindowsProcess, NULL);
-		}
+	if (const Window main_taskbar = Window::Find(L"Shell_TrayWnd"); main_taskbar != Window::NullWindow)
+	{
+		SetWindowBlur(main_taskbar, config->REGULAR_APPEARANCE.ACCENT, config->REGULAR_APPEARANCE.COLOR);
+	}
 
-		const Window fg_window = Window::ForegroundWindow();
-		if (fg_window != Window::NullWindow && run.taskbars.count(fg_window.monitor()) != 0)
-		{
-			
-			if (window.visible() && window.state() == SW_MAXIMIZE && !window.get_attribute<BOOL>(DWMWA_CLOAKED) &&
-				!Blacklist::IsBlacklisted(window) && window.on_current_desktop() && run.taskbars.count(window.monitor()) != 0)
-			{
-				if (Config::CORTANA_ENABLED && !run.start_opened && !fg_window.get_attribute<BOOL>(DWMWA_CLOAKED))
-				{
-					const auto title = fg_window.filename();
-					if (Util::IgnoreCaseStringEquals(*title, L"SearchUI.exe") || Util::IgnoreCaseStringEquals(*title, L"SearchApp.exe"))
-					{
-						run.taskbars.at(fg_window.monitor()).second = &Config::MAXIMISED_APPEARANCE;
-					}
-				}
-				else
-				{
-					const auto title = fg_window.filename();
-					if (Util::IgnoreCaseStringEquals(*title, L"SearchUI.exe") || Util::IgnoreCaseStringEquals(*title, L"SearchApp.exe"))
-					{
-						run.taskbars.at(fg_window.monitor()).second = &Config::CORTANA_APPEARANCE;
-					}
-				}
+	for (const Window taskbar : Window::FindEnum(L"Shell_SecondaryTrayWnd"))
+	{
+		SetWindowBlur(taskbar, config->REGULAR_APPEARANCE.ACCENT, config->REGULAR_APPEARANCE.COLOR);
+	}
+}
 
-				if (Config::START_ENABLED && run.start_opened)
-				{
-					run.taskbars.at(fg_window.monitor()).second = &Config::MAXIMISED_APPEARANCE;
-				}
-				else
-				{
-					run.taskbars.at(fg_window.monitor()).second = &Config::START_APPEARANCE;
-				}
-			}
-		}
+// Carries on from where the previous instance left, instead of reapplying everything from a cold start.
+void AdoptHandover(const Handover::State &state)
+{
+	Window::ImportStableProperties(state.windows);
 
-		// Put this between Start/Cortana and Task view/Timeline
-		// Task view and Timeline show over Aero Peek, but not Start or Cortana
-		if (Config::MAXIMISED_ENABLED && Config::MAXIMISED_REGULAR_ON_PEEK && run.peek_active)
+	// Explorer might have restarted in between, so only trust what is still a taskbar.
+	std::size_t adopted = 0;
+	{
+		std::lock_guard guard(run.apply_lock);
+		for (const Handover::TaskbarState &taskbar : state.taskbars)
 		{
-			for (auto &[_, pair] : run.taskbars)
+			if (const std::wstring &classname = taskbar.window.classname(); classname == L"Shell_TrayWnd" || classname == L"Shell_SecondaryTrayWnd")
 			{
-				pair.second = &Config::REGULAR_APPEARANCE;
+				run.applied_policies[taskbar.window] = taskbar.policy;
+				adopted++;
 			}
 		}
+	}
+
+	Log::OutputFormatted(L"Took over %zu taskbars and %zu cached windows from the previous instance.", adopted, state.windows.size());
+}
 
-		if (fg_window != Window::NullWindow)
+// Leaves what the next instance needs to carry on without touching the taskbars. The worker must be stopped.
+void PublishHandover()
+{
+	WaitForApplies();
+
+	Handover::State state;
+	{
+		std::lock_guard guard(run.apply_lock);
+		for (const auto &[window, policy] : run.applied_policies)
 		{
-			const static bool timeline_av = win32::IsAtLeastBuild(MIN_FLUENT_BUILD);
-			if (Config::TIMELINE_ENABLED && (timeline_av
-				? (*fg_window.classname() == CORE_WINDOW && Util::IgnoreCaseStringEquals(*fg_window.filename(), L"Explorer.exe"))
-				: (*fg_window.classname() == L"MultitaskingViewFrame")))
+			// We don't know what's on screen for those, so let the new instance apply them again.
+			if (const auto apply = run.applies.find(window); apply != run.applies.end() && (apply->second->failed || apply->second->in_flight))
 			{
-				for (auto &[_, pair] : run.taskbars)
-				{
-					pair.second = &Config::TIMELINE_APPEARANCE;
-				}
+				continue;
 			}
+
+			// A fade that got cut short leaves the taskbar somewhere in between.
+			const auto transition = run.transitions.find(window);
+			state.taskbars.push_back({ window, transition != run.transitions.end() ? transition->second.current : policy });
 		}
+	}
+
+	state.windows = Window::ExportStableProperties();
+	Handover::Publish(state);
+}
+
+#pragma endregion
+
+#pragma region Startup
+
+// Measures how long each startup step takes.
+class StartupTimer {
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	const clock::time_point m_Start = clock::now();
+	clock::time_point m_Last = m_Start;
+	std::vector<std::pair<const wchar_t *, double>> m_Steps;
 
-		counter = 0;
+	inline static double Milliseconds(const clock::duration &duration)
+	{
+		return std::chrono::duration<double, std::milli>(duration).count();
 	}
-	else
+
+public:
+	inline void Step(const wchar_t *const name)
 	{
-		counter++;
+		const clock::time_point now = clock::now();
+		m_Steps.emplace_back(name, Milliseconds(now - m_Last));
+		m_Last = now;
 	}
 
-	for (const auto &[_, pair] : run.taskbars)
+	inline std::wstring Report() const
 	{
-		const Config::TASKBAR_APPEARANCE &appearance = *pair.second;
-		SetWindowBlur(pair.first, appearance.ACCENT, appearance.COLOR);
+		std::wostringstream breakdown;
+		for (const auto &[name, milliseconds] : m_Steps)
+		{
+			breakdown << name << L": " << milliseconds << L" ms, ";
+		}
+
+		return breakdown.str() + L"total: " + std::to_wstring(Milliseconds(m_Last - m_Start)) + L" ms";
 	}
-}
 
-#pragma endregion
+#ifdef STARTUP_BENCHMARK
+	inline bool WriteJson(const wchar_t *const file) const
+	{
+		std::wofstream json(file);
+		json << L"{\n\t\"stages\": [\n";
+		for (std::size_t i = 0; i < m_Steps.size(); i++)
+		{
+			json << L"\t\t{ \"name\": \"" << m_Steps[i].first << L"\", \"milliseconds\": " << m_Steps[i].second << L" }" << (i + 1 != m_Steps.size() ? L",\n" : L"\n");
+		}
+		json << L"\t],\n\t\"total_milliseconds\": " << Milliseconds(m_Last - m_Start) << L"\n}\n";
 
-#pragma region Startup
+		return static_cast<bool>(json);
+	}
+#endif
+};
 
 long ExitApp(const EXITREASON &reason, ...)
 {
@@ -420,15 +1198,134 @@ void InitializeTray(const HINSTANCE &hInstance)
 
 	window.RegisterCallback(NEW_TTB_INSTANCE, std::bind(&ExitApp, EXITREASON::NewInstance));
 
+	window.RegisterCallback(WATCH_EXPLORER, [](...)
+	{
+		WatchExplorer();
+		return 0;
+	});
+
+#ifdef STARTUP_BENCHMARK
+	window.RegisterCallback(STARTUP_DONE, std::bind(&ExitApp, EXITREASON::UserActionNoSave));
+#endif
+
 	window.RegisterCallback(WM_DISPLAYCHANGE, [](...)
 	{
-		RefreshHandles();
+		PostEvent(PendingEvent::MonitorsChanged);
 		return 0;
 	});
 
 	window.RegisterCallback(WM_TASKBARCREATED, [](...)
 	{
-		RefreshHandles();
+		PostEvent(PendingEvent::TaskbarsChanged);
+		return 0;
+	});
+
+	window.RegisterCallback(WM_SETTINGCHANGE, [](const WPARAM wParam, LPARAM)
+	{
+		// Happens when a taskbar is moved or resized, so it might be on another monitor.
+		if (wParam == SPI_SETWORKAREA)
+		{
+			PostEvent(PendingEvent::MonitorsChanged);
+		}
+
+		InvalidateAppliedState(); // Explorer resets the taskbar appearance when this happens.
+		return 0;
+	});
+
+	// Explorer resets the taskbar appearance when those happen.
+	for (const unsigned int message : { WM_THEMECHANGED, WM_DWMCOLORIZATIONCOLORCHANGED })
+	{
+		window.RegisterCallback(message, [](...)
+		{
+			InvalidateAppliedState();
+			return 0;
+		});
+	}
+
+	// Nobody can see the taskbar while the session is locked or the display is off, so stop evaluating.
+	window.RegisterCallback(WM_WTSSESSION_CHANGE, [](const WPARAM wParam, LPARAM)
+	{
+		switch (wParam)
+		{
+		case WTS_SESSION_LOCK:
+		case WTS_SESSION_UNLOCK:
+			SetSchedulerPaused(Scheduler::SessionLocked, wParam == WTS_SESSION_LOCK);
+			break;
+
+		// Nobody is looking at a disconnected RDP session.
+		case WTS_REMOTE_DISCONNECT:
+		case WTS_CONSOLE_DISCONNECT:
+		case WTS_REMOTE_CONNECT:
+		case WTS_CONSOLE_CONNECT:
+			SetSchedulerPaused(Scheduler::SessionDisconnected, wParam == WTS_REMOTE_DISCONNECT || wParam == WTS_CONSOLE_DISCONNECT);
+			break;
+		}
+
+		return 0;
+	});
+
+	window.RegisterCallback(WM_POWERBROADCAST, [](const WPARAM wParam, const LPARAM lParam)
+	{
+		if (wParam == PBT_POWERSETTINGCHANGE)
+		{
+			const auto &setting = *reinterpret_cast<const POWERBROADCAST_SETTING *>(lParam);
+			if (setting.DataLength >= sizeof(DWORD))
+			{
+				const DWORD value = *reinterpret_cast<const DWORD *>(setting.Data);
+				if (setting.PowerSetting == CONSOLE_DISPLAY_STATE)
+				{
+					// 0 is off, 1 is on and 2 is dimmed, which is still visible.
+					SetSchedulerPaused(Scheduler::DisplayOff, value == 0);
+				}
+				else if (setting.PowerSetting == ACDC_POWER_SOURCE)
+				{
+					// 0 is AC, 1 is battery and 2 is a short-term source like a UPS.
+					Scheduler::SetThrottled(Scheduler::OnBattery, value != 0);
+				}
+				else if (setting.PowerSetting == POWER_SAVING_STATUS)
+				{
+					Scheduler::SetThrottled(Scheduler::EnergySaver, value != 0);
+				}
+			}
+		}
+
+		return TRUE;
+	});
+
+	// Each of those sends its current value right away, so the scheduler starts out in the right state.
+	static std::vector<HPOWERNOTIFY> power_notifications;
+	for (const GUID *const setting : { &CONSOLE_DISPLAY_STATE, &ACDC_POWER_SOURCE, &POWER_SAVING_STATUS })
+	{
+		if (const HPOWERNOTIFY notification = RegisterPowerSettingNotification(window.handle(), setting, DEVICE_NOTIFY_WINDOW_HANDLE))
+		{
+			power_notifications.push_back(notification);
+		}
+		else
+		{
+			LastErrorHandle(Error::Level::Log, L"Failed to register for power setting notifications.");
+		}
+	}
+
+	if (!WTSRegisterSessionNotification(window, NOTIFY_FOR_THIS_SESSION))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to register for session change notifications.");
+	}
+
+	window.RegisterCallback(WM_DESTROY, [](...)
+	{
+		for (const HPOWERNOTIFY notification : power_notifications)
+		{
+			if (!UnregisterPowerSettingNotification(notification))
+			{
+				LastErrorHandle(Error::Level::Log, L"Failed to unregister power setting notifications.");
+			}
+		}
+
+		if (!WTSUnRegisterSessionNotification(window))
+		{
+			LastErrorHandle(Error::Level::Log, L"Failed to unregister session change notifications.");
+		}
+
 		return 0;
 	});
 
@@ -455,27 +1352,43 @@ void InitializeTray(const HINSTANCE &hInstance)
 		return 0;
 	});
 
+	run.tray_window = window;
 
-	if (!Config::NO_TRAY)
+	if (!Config::Current()->NO_TRAY)
 	{
 		static TrayContextMenu tray(window, MAKEINTRESOURCE(TRAYICON), MAKEINTRESOURCE(IDR_POPUP_MENU), hInstance);
 
+		window.RegisterCallback(STARTUP_STATE_KNOWN, [](const WPARAM wParam, LPARAM)
+		{
+			run.startup_state = static_cast<Autostart::StartupState>(wParam);
+			return 0;
+		});
+
 		tray.RegisterContextMenuCallback(IDM_AUTOSTART, []
 		{
 			Autostart::GetStartupState().Completed([](auto info, ...)
 			{
-				Autostart::SetStartupState(info.GetResults() == Autostart::StartupState::Enabled ? Autostart::StartupState::Disabled : Autostart::StartupState::Enabled);
+				Autostart::SetStartupState(info.GetResults() == Autostart::StartupState::Enabled ? Autostart::StartupState::Disabled : Autostart::StartupState::Enabled).Completed([](auto, ...)
+				{
+					QueryStartupState();
+				});
 			});
 		});
+		tray.RegisterContextMenuCallback(IDM_DIAGNOSTICS, Diagnostics::ShowReport);
 		tray.RegisterContextMenuCallback(IDM_EXIT, std::bind(&ExitApp, EXITREASON::UserAction));
 
 		tray.RegisterCustomRefresh(RefreshMenu);
+		QueryStartupState();
 	}
 }
 
+// Benchmark builds time this once, up to the first pass of the worker being applied, and write the timings as JSON.
+// Usage: TranslucentTB.exe [output file], defaults to startup-benchmark.json in the working directory.
 int WINAPI wWinMain(const HINSTANCE hInstance, HINSTANCE, wchar_t *, int)
 {
+	StartupTimer timer;
 	win32::HardenProcess();
+	Diagnostics::Register();
 	try
 	{
 		winrt::init_apartment(winrt::apartment_type::multi_threaded);
@@ -484,12 +1397,18 @@ int WINAPI wWinMain(const HINSTANCE hInstance, HINSTANCE, wchar_t *, int)
 	{
 		ErrorHandle(error.code(), Error::Level::Fatal, L"Initialization of Windows Runtime failed.");
 	}
+#ifdef STORE
+	UWP::Prefetch();
+#endif
+	timer.Step(L"initialization");
 
-	// If there already is another instance running, tell it to exit
+	// If there already is another instance running, tell it to exit and take over its state
+	std::optional<Handover::State> handover;
 	if (!win32::IsSingleInstance())
 	{
-		Window::Find(L"TrayWindow", NAME).send_message(NEW_TTB_INSTANCE);
+		handover = Handover::Request(Window::Find(L"TrayWindow", NAME), NEW_INSTANCE_TIMEOUT);
 	}
+	Diagnostics::Share();
 
 	// Get configuration file paths
 	GetPaths();
@@ -499,16 +1418,97 @@ int WINAPI wWinMain(const HINSTANCE hInstance, HINSTANCE, wchar_t *, int)
 	{
 		return EXIT_FAILURE;
 	}
+	timer.Step(L"configuration files");
+
+	// Used to wake up the worker thread in event-driven mode
+	run.evaluate_event.attach(CreateEvent(NULL, FALSE, FALSE, NULL));
+	if (!run.evaluate_event)
+	{
+		LastErrorHandle(Error::Level::Fatal, L"Failed to create state evaluation event!");
+	}
 
 	// Parse our configuration
 	Config::Parse(run.config_file);
+	timer.Step(L"configuration parsing");
+
+	// Make the taskbars look right as soon as possible, everything else can come after.
+	// When taking over, they already look right, and the first evaluation only changes what differs.
+	if (handover)
+	{
+		AdoptHandover(*handover);
+		handover.reset();
+	}
+	else
+	{
+		ApplyInitialAppearance();
+	}
+	timer.Step(L"first accent");
+
+	// Those are only needed to detect Start and virtual desktops, so they are done in parallel.
+	winrt::com_ptr<IAppVisibility> app_visibility;
+	DWORD av_cookie = 0;
+	std::thread deferred_thread([&app_visibility, &av_cookie]
+	{
+		try
+		{
+			winrt::init_apartment(winrt::apartment_type::multi_threaded);
+		}
+		catch (const winrt::hresult_error &error)
+		{
+			ErrorHandle(error.code(), Error::Level::Log, L"Initialization of Windows Runtime failed.");
+			return;
+		}
+
+		StartupTimer deferred_timer;
+
+		// Register our start menu detection sink
+		app_visibility = create_instance<IAppVisibility>(CLSID_AppVisibility);
+		if (app_visibility)
+		{
+			auto av_sink = winrt::make<AppVisibilitySink>(HandleLauncherVisibility, HandleMonitorAppVisibility);
+			ErrorHandle(app_visibility->Advise(av_sink.get(), &av_cookie), Error::Level::Log, L"Failed to register app visibility sink.");
+		}
+		deferred_timer.Step(L"app visibility");
+
+		Window::PrepareDesktopManager();
+		deferred_timer.Step(L"virtual desktop manager");
+
+		Log::OutputMessage(L"Deferred startup timings: " + deferred_timer.Report());
+	});
+
 	Blacklist::Parse(run.exclude_file);
+	AppRules::Parse(run.rules_file);
 
-	// Initialize GUI
-	InitializeTray(hInstance);
+	// Reload them when they get edited
+	auto config_watcher = std::make_unique<DirectoryWatcher>(run.config_folder, HandleConfigChange);
+
+	// Lets management tools reconfigure us without a restart
+	std::unique_ptr<ControlPipe> control_pipe;
+	if (Config::Current()->CONTROL_PIPE)
+	{
+		control_pipe = std::make_unique<ControlPipe>(HandleControlCommand);
+	}
+	timer.Step(L"exclude and rules file parsing");
+
+	// Started before anything gets tracked, so that the trace has the whole state.
+	if (Config::Current()->RECORD_EVENTS)
+	{
+		EventTrace::Start(run.config_folder + L"\\events" + EventTrace::EXTENSION);
+		if (const Window foreground = Window::ForegroundWindow(); foreground != Window::NullWindow && EventTrace::Recording())
+		{
+			EventTrace::Foreground(foreground, foreground.monitor(), foreground.kind(), foreground.cloaked());
+		}
+	}
+
+	Diagnostics::RegisterMemoryUsage(L"Window cache", Window::MemoryUsage);
+	Diagnostics::RegisterMemoryUsage(L"Blacklist cache", Blacklist::MemoryUsage);
+	Diagnostics::RegisterMemoryUsage(L"Application rules", AppRules::MemoryUsage);
 
 	// Populate our map
+	WindowTracker::SetChangedCallback(RequestEvaluation);
+	AppRules::SetChangedCallback(RequestEvaluation);
 	RefreshHandles();
+	timer.Step(L"window tracking");
 
 	// Undoc'd, allows to detect when Aero Peek starts and stops
 	EventHook peek_hook(
@@ -517,35 +1517,38 @@ int WINAPI wWinMain(const HINSTANCE hInstance, HINSTANCE, wchar_t *, int)
 		[](const DWORD event, ...)
 		{
 			run.peek_active = event == 0x21;
+			if (EventTrace::Recording())
+			{
+				EventTrace::Peek(run.peek_active);
+			}
+
+			RequestEvaluation();
 		},
 		WINEVENT_OUTOFCONTEXT
 	);
 
-	// Detect additional monitor connect/disconnect
-	EventHook creation_hook(
-		EVENT_OBJECT_CREATE,
-		EVENT_OBJECT_DESTROY,
+	// Maximised windows are tracked by the hooks in hooks.cpp, this only gets notified when that changes.
+	// The foreground window is not tracked, so listen for it separately.
+	EventHook foreground_hook(
+		EVENT_SYSTEM_FOREGROUND,
+		EVENT_SYSTEM_FOREGROUND,
 		[](DWORD, const Window &window, ...)
 		{
-			if (window.valid())
+			// Classify it here, so that the worker only finds it in the cache.
+			const Window::Kind kind = window.kind();
+			if (EventTrace::Recording())
 			{
-				if (const auto classname = window.classname(); *classname == L"Shell_TrayWnd" || *classname == L"Shell_SecondaryTrayWnd")
-				{
-					RefreshHandles();
-				}
+				EventTrace::Foreground(window, window.monitor(), kind, window.cloaked());
 			}
+
+			RequestEvaluation();
 		},
-		WINEVENT_OUTOFCONTEXT
+		WINEVENT_OUTOFCONTEXT,
+		EventHook::Filter::Windows
 	);
+	timer.Step(L"hooks");
 
-	// Register our start menu detection sink
-	auto app_visibility = create_instance<IAppVisibility>(CLSID_AppVisibility);
-	DWORD av_cookie = 0;
-	if (app_visibility)
-	{
-		auto av_sink = winrt::make<AppVisibilitySink>(run.start_opened);
-		ErrorHandle(app_visibility->Advise(av_sink.get(), &av_cookie), Error::Level::Log, L"Failed to register app visibility sink.");
-	}
+	std::thread transition_thread(TransitionThread);
 
 	std::thread swca_thread([]
 	{
@@ -558,13 +1561,80 @@ int WINAPI wWinMain(const HINSTANCE hInstance, HINSTANCE, wchar_t *, int)
 			ErrorHandle(error.code(), Error::Level::Fatal, L"Initialization of Windows Runtime failed.");
 		}
 
+#ifdef STARTUP_BENCHMARK
+		bool first_pass = true;
+#endif
 		while (run.is_running)
 		{
-			SetTaskbarBlur();
-			std::this_thread::sleep_for(std::chrono::milliseconds(Config::SLEEP_TIME));
+			const auto config = Config::Current();
+			const DWORD result = WaitForSingleObject(run.evaluate_event.get(), Scheduler::NextWait(*config));
+			if (result == WAIT_FAILED)
+			{
+				LastErrorHandle(Error::Level::Fatal, L"Waiting for a state evaluation request failed!");
+			}
+
+			if (!run.is_running)
+			{
+				break;
+			}
+
+			if (Scheduler::Paused())
+			{
+				continue; // Resuming requests an evaluation, events stay pending until then.
+			}
+
+			// Evaluating would only fill the caches right back up.
+			if (result == WAIT_TIMEOUT && Scheduler::ShouldTrim(*config))
+			{
+				ReleaseMemory();
+				continue;
+			}
+
+			if (config->EVENT_DRIVEN)
+			{
+				// Let bursts of events (like dragging a window around) settle before evaluating,
+				// so that we do at most one evaluation every SLEEP_TIME, or less when saving power.
+				// Start opening is a single event though, so don't make the user wait for a burst that isn't coming.
+				if (!(run.pending_events & PendingEvent::VisibilityChanged))
+				{
+					std::this_thread::sleep_for(std::chrono::milliseconds(Scheduler::SettleTime(*config)));
+				}
+				DrainEvents();
+				SetTaskbarBlur(true);
+			}
+			else
+			{
+				DrainEvents();
+				SetTaskbarBlur();
+			}
+
+#ifdef STARTUP_BENCHMARK
+			// Time the taskbars actually changing.
+			if (const Window tray = run.tray_window.load(); first_pass && tray)
+			{
+				WaitForApplies();
+				first_pass = !tray.post_message(STARTUP_DONE);
+			}
+#endif
 		}
 	});
 
+	// Initialize GUI
+	InitializeTray(hInstance);
+	WatchExplorer(); // Needs the tray window, so that later Explorer restarts can tell us.
+	timer.Step(L"tray");
+#ifdef STARTUP_BENCHMARK
+	RequestEvaluation(); // The worker can only tell us it's done once the tray window exists.
+#endif
+
+	Log::OutputMessage(L"Startup timings: " + timer.Report());
+
+	// Startup touched a lot of things that won't be used again.
+	if (Config::Current()->LEAN_MEMORY)
+	{
+		TrimWorkingSet();
+	}
+
 	MSG msg;
 	BOOL ret;
 	while ((ret = GetMessage(&msg, NULL, 0, 0)) != 0)
@@ -580,8 +1650,28 @@ int WINAPI wWinMain(const HINSTANCE hInstance, HINSTANCE, wchar_t *, int)
 		}
 	}
 
+#ifdef STARTUP_BENCHMARK
+	timer.Step(L"first apply");
+	const bool written = timer.WriteJson(__argc > 1 ? __wargv[1] : L"startup-benchmark.json");
+#endif
+
 	run.is_running = false;
+	RequestEvaluation(); // Wake up the worker thread if it's waiting for events.
 	swca_thread.join(); // Wait for our worker thread to exit.
+	{
+		std::lock_guard guard(run.apply_lock);
+		run.transitions_stop = true;
+	}
+	run.transitions_changed.notify_all();
+	transition_thread.join();
+	if (run.exit_reason == EXITREASON::NewInstance)
+	{
+		PublishHandover();
+	}
+	run.creation_hook.reset();
+	control_pipe.reset();
+	config_watcher.reset(); // Don't reload what we're about to save.
+	deferred_thread.join();
 
 	if (av_cookie)
 	{
@@ -597,13 +1687,24 @@ int WINAPI wWinMain(const HINSTANCE hInstance, HINSTANCE, wchar_t *, int)
 		}
 
 		// Restore default taskbar appearance
-		for (const auto &taskbar : run.taskbars)
+		if (const auto snapshot = std::atomic_load(&run.taskbars))
 		{
-			SetWindowBlur(taskbar.second.first, swca::ACCENT::ACCENT_NORMAL, NULL);
+			for (const auto &[_, taskbar] : snapshot->taskbars)
+			{
+				SetWindowBlur(taskbar, swca::ACCENT::ACCENT_NORMAL, NULL);
+			}
 		}
 	}
+	WaitForApplies();
 
+	EventTrace::Stop();
+	Error::ReportSuppressed();
+	Diagnostics::Unregister();
+#ifdef STARTUP_BENCHMARK
+	return written ? EXIT_SUCCESS : EXIT_FAILURE;
+#else
 	return EXIT_SUCCESS;
+#endif
 }
 
 #pragma endregion
\ No newline at end of file
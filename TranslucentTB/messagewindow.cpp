@@ -4,15 +4,38 @@
 #include "ttberror.hpp"
 #include "util.hpp"
 
+LRESULT MessageWindow::RawWindowProcedure(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam)
+{
+	if (uMsg == WM_NCCREATE)
+	{
+		// Window::Create gets passed the instance, remember it so that later messages don't need a lookup.
+		const auto create = reinterpret_cast<const CREATESTRUCT *>(lParam);
+		SetWindowLongPtr(hwnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(create->lpCreateParams));
+	}
+
+	// Messages sent before WM_NCCREATE or after WM_NCDESTROY don't have an instance.
+	const auto instance = reinterpret_cast<MessageWindow *>(GetWindowLongPtr(hwnd, GWLP_USERDATA));
+	if (uMsg == WM_NCDESTROY)
+	{
+		SetWindowLongPtr(hwnd, GWLP_USERDATA, 0);
+	}
+
+	return instance ? instance->WindowProcedure(hwnd, uMsg, wParam, lParam) : DefWindowProc(hwnd, uMsg, wParam, lParam);
+}
+
 LRESULT MessageWindow::WindowProcedure(const Window &window, unsigned int uMsg, WPARAM wParam, LPARAM lParam)
 {
-	const auto &callbackVector = m_CallbackMap[uMsg];
-	if (callbackVector.size() > 0)
+	auto it = std::lower_bound(m_Handlers.begin(), m_Handlers.end(), uMsg, [](const Handler &handler, const unsigned int &message)
+	{
+		return handler.message < message;
+	});
+
+	if (it != m_Handlers.end() && it->message == uMsg)
 	{
 		long result = 0;
-		for (const auto &[_, callback] : callbackVector)
+		for (; it != m_Handlers.end() && it->message == uMsg; ++it)
 		{
-			result = (std::max)(callback(wParam, lParam), result);
+			result = (std::max)(it->callback(wParam, lParam), result);
 		}
 		return result;
 	}
@@ -22,7 +45,7 @@ LRESULT MessageWindow::WindowProcedure(const Window &window, unsigned int uMsg,
 
 MessageWindow::MessageWindow(const std::wstring &className, const std::wstring &windowName, const HINSTANCE &hInstance, const wchar_t *iconResource) :
 	m_WindowClass(
-		std::bind(&MessageWindow::WindowProcedure, this, std::placeholders::_1, std::placeholders::_2, std::placeholders::_3, std::placeholders::_4),
+		RawWindowProcedure,
 		className,
 		iconResource,
 		0,
@@ -40,7 +63,13 @@ MessageWindow::MessageWindow(const std::wstring &className, const std::wstring &
 MessageWindow::CALLBACKCOOKIE MessageWindow::RegisterCallback(unsigned int message, const callback_t &callback)
 {
 	unsigned short secret = Util::GetRandomNumber<unsigned short>();
-	m_CallbackMap[message].emplace_back(secret, callback);
+
+	// After the other handlers of that message, so they keep getting called in registration order.
+	const auto it = std::upper_bound(m_Handlers.begin(), m_Handlers.end(), message, [](const unsigned int &message, const Handler &handler)
+	{
+		return message < handler.message;
+	});
+	m_Handlers.insert(it, { message, secret, callback });
 
 	return (static_cast<CALLBACKCOOKIE>(secret) << 32) + message;
 }
@@ -50,15 +79,15 @@ bool MessageWindow::UnregisterCallback(CALLBACKCOOKIE cookie)
 	unsigned int message = cookie & 0xFFFFFFFF;
 	unsigned short secret = (cookie >> 32) & 0xFFFF;
 
-	auto &callbackVector = m_CallbackMap[message];
-	for (auto &callbackPair : callbackVector)
+	const auto it = std::find_if(m_Handlers.begin(), m_Handlers.end(), [message, secret](const Handler &handler)
 	{
-		if (callbackPair.first == secret)
-		{
-			std::swap(callbackPair, callbackVector.back());
-			callbackVector.pop_back();
-			return true;
-		}
+		return handler.message == message && handler.secret == secret;
+	});
+
+	if (it != m_Handlers.end())
+	{
+		m_Handlers.erase(it);
+		return true;
 	}
 
 	return false;
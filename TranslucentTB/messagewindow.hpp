@@ -1,6 +1,5 @@
 #pragma once
 #include <functional>
-#include <unordered_map>
 #include <vector>
 
 #include "window.hpp"
@@ -14,9 +13,17 @@ protected:
 	using callback_t = std::function<long(WPARAM, LPARAM)>;
 
 private:
-	std::unordered_map<unsigned int, std::vector<std::pair<unsigned short, callback_t>>> m_CallbackMap;
+	struct Handler {
+		unsigned int message;
+		unsigned short secret;
+		callback_t callback;
+	};
+
+	// Sorted by message, so dispatching is a binary search, and messages nobody handles never allocate.
+	std::vector<Handler> m_Handlers;
 	WindowClass m_WindowClass;
 
+	static LRESULT CALLBACK RawWindowProcedure(HWND hwnd, UINT uMsg, WPARAM wParam, LPARAM lParam);
 	LRESULT WindowProcedure(const Window &window, unsigned int uMsg, WPARAM wParam, LPARAM lParam);
 
 public:
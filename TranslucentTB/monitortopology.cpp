@@ -0,0 +1,63 @@
+#include "monitortopology.hpp"
+#include <algorithm>
+#include <WinUser.h>
+
+#include "ttberror.hpp"
+
+std::shared_ptr<const std::vector<MonitorTopology::Monitor>> MonitorTopology::m_Monitors;
+
+BOOL MonitorTopology::EnumMonitorsProcess(const HMONITOR monitor, HDC, LPRECT, const LPARAM lParam)
+{
+	MONITORINFO info = { sizeof(info) };
+	if (GetMonitorInfo(monitor, &info))
+	{
+		reinterpret_cast<std::vector<Monitor> *>(lParam)->push_back({ monitor, info.rcMonitor, info.rcWork });
+	}
+	else
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to get monitor information.");
+	}
+
+	return true;
+}
+
+void MonitorTopology::Rebuild()
+{
+	auto monitors = std::make_shared<std::vector<Monitor>>();
+	if (!EnumDisplayMonitors(NULL, NULL, EnumMonitorsProcess, reinterpret_cast<LPARAM>(monitors.get())))
+	{
+		LastErrorHandle(Error::Level::Log, L"Failed to enumerate monitors.");
+	}
+
+	std::atomic_store(&m_Monitors, std::shared_ptr<const std::vector<Monitor>>(std::move(monitors)));
+}
+
+HMONITOR MonitorTopology::FromRect(const RECT &rect)
+{
+	const auto monitors = Monitors();
+	if (!monitors)
+	{
+		return nullptr;
+	}
+
+	// Same as MonitorFromRect: the one with the largest intersection.
+	HMONITOR best = nullptr;
+	long best_area = 0;
+	for (const Monitor &monitor : *monitors)
+	{
+		const long width = (std::min)(rect.right, monitor.bounds.right) - (std::max)(rect.left, monitor.bounds.left);
+		const long height = (std::min)(rect.bottom, monitor.bounds.bottom) - (std::max)(rect.top, monitor.bounds.top);
+		if (width > 0 && height > 0 && width * height > best_area)
+		{
+			best = monitor.handle;
+			best_area = width * height;
+		}
+	}
+
+	return best;
+}
+
+std::shared_ptr<const std::vector<MonitorTopology::Monitor>> MonitorTopology::Monitors()
+{
+	return std::atomic_load(&m_Monitors);
+}
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+#include "arch.h"
+#include <memory>
+#include <vector>
+#include <windef.h>
+
+// The monitors and their work areas, so that finding which monitor a window is on
+// doesn't need to ask the system. Only changes when the display configuration does.
+class MonitorTopology {
+
+public:
+	struct Monitor {
+		HMONITOR handle;
+		RECT bounds;
+		RECT work_area;
+	};
+
+	// Call on WM_DISPLAYCHANGE, work area changes and taskbars getting recreated.
+	static void Rebuild();
+
+	// The monitor a rectangle mostly is on, or nullptr if it isn't on any of them.
+	static HMONITOR FromRect(const RECT &rect);
+
+	static std::shared_ptr<const std::vector<Monitor>> Monitors();
+
+private:
+	static std::shared_ptr<const std::vector<Monitor>> m_Monitors; // Only access through std::atomic_load and std::atomic_store
+
+	static BOOL CALLBACK EnumMonitorsProcess(HMONITOR monitor, HDC, LPRECT, LPARAM lParam);
+
+};
\ No newline at end of file
@@ -0,0 +1,125 @@
+#include "patternmatcher.hpp"
+#include <algorithm>
+#include <queue>
+
+uint32_t PatternMatcher::transition(const uint32_t &node, const wchar_t &character) const
+{
+	const auto &transitions = m_Nodes[node].transitions;
+	const auto it = std::lower_bound(transitions.begin(), transitions.end(), character, [](const std::pair<wchar_t, uint32_t> &a, const wchar_t &b)
+	{
+		return a.first < b;
+	});
+
+	return it != transitions.end() && it->first == character ? it->second : 0;
+}
+
+void PatternMatcher::build()
+{
+	// Breadth first, so that fail links of shallower nodes are always computed first.
+	std::queue<uint32_t> queue;
+	for (const auto &[_, child] : m_Nodes[0].transitions)
+	{
+		queue.push(child);
+	}
+
+	while (!queue.empty())
+	{
+		const uint32_t node = queue.front();
+		queue.pop();
+
+		for (const auto &[character, child] : m_Nodes[node].transitions)
+		{
+			uint32_t fail = m_Nodes[node].fail;
+			while (fail != 0 && transition(fail, character) == 0)
+			{
+				fail = m_Nodes[fail].fail;
+			}
+
+			m_Nodes[child].fail = transition(fail, character);
+			m_Nodes[child].output |= m_Nodes[m_Nodes[child].fail].output;
+			m_Nodes[child].best = (std::min)(m_Nodes[child].best, m_Nodes[m_Nodes[child].fail].best);
+			queue.push(child);
+		}
+	}
+}
+
+PatternMatcher::PatternMatcher(const std::vector<std::wstring> &patterns) : m_Nodes(1)
+{
+	for (uint32_t i = 0; i < patterns.size(); i++)
+	{
+		const std::wstring &pattern = patterns[i];
+		uint32_t node = 0;
+		for (const wchar_t &character : pattern)
+		{
+			auto &transitions = m_Nodes[node].transitions;
+			const auto it = std::lower_bound(transitions.begin(), transitions.end(), character, [](const std::pair<wchar_t, uint32_t> &a, const wchar_t &b)
+			{
+				return a.first < b;
+			});
+
+			if (it != transitions.end() && it->first == character)
+			{
+				node = it->second;
+			}
+			else
+			{
+				const uint32_t child = static_cast<uint32_t>(m_Nodes.size());
+				transitions.insert(it, { character, child });
+				m_Nodes.emplace_back(); // Invalidates transitions, so do it last.
+				node = child;
+			}
+		}
+
+		// An empty pattern is found in every string, just like std::wstring::find.
+		m_Nodes[node].output = true;
+		m_Nodes[node].best = (std::min)(m_Nodes[node].best, i);
+	}
+
+	build();
+}
+
+bool PatternMatcher::matches(std::wstring_view text) const
+{
+	uint32_t node = 0;
+	if (m_Nodes[node].output)
+	{
+		return true;
+	}
+
+	for (const wchar_t &character : text)
+	{
+		uint32_t next;
+		while ((next = transition(node, character)) == 0 && node != 0)
+		{
+			node = m_Nodes[node].fail;
+		}
+
+		node = next;
+		if (m_Nodes[node].output)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+uint32_t PatternMatcher::best_match(std::wstring_view text) const
+{
+	uint32_t node = 0;
+	uint32_t best = m_Nodes[node].best;
+
+	for (const wchar_t &character : text)
+	{
+		uint32_t next;
+		while ((next = transition(node, character)) == 0 && node != 0)
+		{
+			node = m_Nodes[node].fail;
+		}
+
+		node = next;
+		best = (std::min)(best, m_Nodes[node].best);
+	}
+
+	return best;
+}
\ No newline at end of file
@@ -0,0 +1,38 @@
+#pragma once
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// Aho-Corasick automaton, finds if any of a set of patterns occurs in a text in a single pass over it.
+class PatternMatcher {
+
+public:
+	static constexpr uint32_t NO_MATCH = UINT32_MAX;
+
+private:
+	struct Node {
+		std::vector<std::pair<wchar_t, uint32_t>> transitions; // Sorted by character
+		uint32_t fail = 0;
+		bool output = false; // A pattern ends here, or at one of the nodes reachable through fail links.
+		uint32_t best = NO_MATCH; // Lowest index of those patterns.
+	};
+
+	std::vector<Node> m_Nodes;
+
+	uint32_t transition(const uint32_t &node, const wchar_t &character) const;
+	void build();
+
+public:
+	PatternMatcher(const std::vector<std::wstring> &patterns = { });
+
+	bool matches(std::wstring_view text) const;
+
+	// Lowest index of the patterns found in the text, or NO_MATCH. Always goes over the whole text.
+	uint32_t best_match(std::wstring_view text) const;
+	inline bool empty() const
+	{
+		return m_Nodes.size() == 1 && !m_Nodes[0].output;
+	}
+};
\ No newline at end of file
@@ -0,0 +1,93 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// Bounded lock-free queue for many producers and a single consumer (Vyukov's algorithm).
+// Producers fill a slot in place, so pushing never allocates. When it's full, pushing fails instead of blocking.
+template<typename T, std::size_t N>
+class ring_buffer {
+	static_assert(N != 0 && (N & (N - 1)) == 0, "Size must be a power of two");
+
+private:
+	struct Slot {
+		std::atomic_size_t sequence;
+		T value;
+	};
+
+	std::array<Slot, N> m_Slots;
+	alignas(64) std::atomic_size_t m_Head; // Next slot to be written
+	alignas(64) std::atomic_size_t m_Tail; // Next slot to be read
+
+public:
+	inline ring_buffer() : m_Head(0), m_Tail(0)
+	{
+		for (std::size_t i = 0; i < N; i++)
+		{
+			m_Slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	// Fill receives a T & to write to. Returns false if the buffer is full.
+	template<class Function>
+	inline bool try_push(Function &&fill)
+	{
+		std::size_t position = m_Head.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot &slot = m_Slots[position & (N - 1)];
+			const std::size_t sequence = slot.sequence.load(std::memory_order_acquire);
+			const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+
+			if (difference == 0)
+			{
+				if (m_Head.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+				{
+					fill(slot.value);
+					slot.sequence.store(position + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (difference < 0)
+			{
+				return false;
+			}
+			else
+			{
+				position = m_Head.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
+	// Consume receives a T & to read from. Returns false if there is nothing ready to be read.
+	// Only one thread at a time may call this.
+	template<class Function>
+	inline bool try_pop(Function &&consume)
+	{
+		const std::size_t position = m_Tail.load(std::memory_order_relaxed);
+		Slot &slot = m_Slots[position & (N - 1)];
+		if (slot.sequence.load(std::memory_order_acquire) != position + 1)
+		{
+			return false;
+		}
+
+		consume(slot.value);
+		slot.sequence.store(position + N, std::memory_order_release);
+		m_Tail.store(position + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	// Approximate, other threads might be pushing or popping at the same time.
+	inline std::size_t size() const
+	{
+		const std::size_t head = m_Head.load(std::memory_order_relaxed);
+		const std::size_t tail = m_Tail.load(std::memory_order_relaxed);
+		return head > tail ? head - tail : 0;
+	}
+
+	static constexpr std::size_t capacity()
+	{
+		return N;
+	}
+};
\ No newline at end of file
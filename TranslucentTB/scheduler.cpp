@@ -0,0 +1,93 @@
+#include "scheduler.hpp"
+#include <algorithm>
+#include <WinBase.h>
+
+std::atomic<Scheduler::clock::rep> Scheduler::m_BurstEnd = 0;
+std::atomic_uint8_t Scheduler::m_Pauses = 0;
+std::atomic_uint8_t Scheduler::m_Throttles = 0;
+DWORD Scheduler::m_Interval = IDLE_INTERVAL;
+Scheduler::clock::rep Scheduler::m_TrimmedBurst = 0;
+
+void Scheduler::NotifyActivity()
+{
+	m_BurstEnd = (clock::now() + BURST_DURATION).time_since_epoch().count();
+}
+
+bool Scheduler::SetPaused(const Pause &reason, const bool &paused)
+{
+	const uint8_t previous = paused ? m_Pauses.fetch_or(reason) : m_Pauses.fetch_and(static_cast<uint8_t>(~reason));
+	return previous != 0 && !Paused();
+}
+
+bool Scheduler::Paused()
+{
+	return m_Pauses != 0;
+}
+
+void Scheduler::SetThrottled(const Throttle &reason, const bool &throttled)
+{
+	if (throttled)
+	{
+		m_Throttles.fetch_or(reason);
+	}
+	else
+	{
+		m_Throttles.fetch_and(static_cast<uint8_t>(~reason));
+	}
+}
+
+bool Scheduler::Throttled()
+{
+	return m_Throttles != 0;
+}
+
+DWORD Scheduler::SettleTime(const Config &config)
+{
+	return m_Throttles != 0 ? config.SLEEP_TIME * THROTTLE_FACTOR : config.SLEEP_TIME;
+}
+
+DWORD Scheduler::NextWait(const Config &config)
+{
+	if (Paused())
+	{
+		return INFINITE;
+	}
+
+	const DWORD factor = Throttled() ? THROTTLE_FACTOR : 1;
+	const DWORD fast = (std::max)(static_cast<DWORD>(config.SLEEP_TIME), static_cast<DWORD>(1)) * factor;
+	if (clock::now().time_since_epoch().count() < m_BurstEnd)
+	{
+		m_Interval = fast;
+	}
+	else
+	{
+		// Doubles every time, so that we get to the idle rate quickly but not abruptly.
+		m_Interval = (std::min)((std::max)(m_Interval, fast) * 2, IDLE_INTERVAL * factor);
+	}
+
+	// Events wake the worker up anyway, but it still has to wake up to trim.
+	if (config.EVENT_DRIVEN)
+	{
+		if (config.LEAN_MEMORY && m_TrimmedBurst != m_BurstEnd)
+		{
+			const auto remaining = clock::time_point(clock::duration(m_BurstEnd)) + TRIM_DELAY - clock::now();
+			return static_cast<DWORD>((std::max)(std::chrono::duration_cast<std::chrono::milliseconds>(remaining).count(), static_cast<long long>(0)));
+		}
+
+		return INFINITE;
+	}
+
+	return m_Interval;
+}
+
+bool Scheduler::ShouldTrim(const Config &config)
+{
+	const clock::rep burst = m_BurstEnd;
+	if (!config.LEAN_MEMORY || !config.EVENT_DRIVEN || Paused() || burst == m_TrimmedBurst || clock::now() < clock::time_point(clock::duration(burst)) + TRIM_DELAY)
+	{
+		return false;
+	}
+
+	m_TrimmedBurst = burst;
+	return true;
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+#pragma once
+#include "arch.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <windef.h>
+
+#include "config.hpp"
+
+// Decides when the worker evaluates: at SLEEP_TIME for a short while after something happened,
+// then slower and slower while nothing does, slower still to save power, and not at all while
+// nobody can see the taskbar.
+class Scheduler {
+
+public:
+	enum Pause : uint8_t {
+		SessionLocked = 1 << 0,
+		DisplayOff = 1 << 1,
+		SessionDisconnected = 1 << 2
+	};
+
+	enum Throttle : uint8_t {
+		OnBattery = 1 << 0,
+		EnergySaver = 1 << 1
+	};
+
+	// Something that might change the taskbar appearance happened, like Start opening or a window maximising.
+	static void NotifyActivity();
+
+	// Returns true if that resumed the worker, which then needs an evaluation request.
+	static bool SetPaused(const Pause &reason, const bool &paused);
+	static bool Paused();
+
+	static void SetThrottled(const Throttle &reason, const bool &throttled);
+	static bool Throttled();
+
+	// How long to let bursts of events settle before evaluating, when event-driven.
+	static DWORD SettleTime(const Config &config);
+
+	// How long the worker should wait for an evaluation request before evaluating anyway. Only call from the worker.
+	static DWORD NextWait(const Config &config);
+
+	// True once per quiet period in lean mode, when it's time to give memory back. Only call from the worker.
+	// Polling refills the caches every second, so this only happens when event-driven.
+	static bool ShouldTrim(const Config &config);
+
+private:
+	using clock = std::chrono::steady_clock;
+
+	// How long to stay at the fast rate after activity, and the slowest rate we decay to.
+	static constexpr std::chrono::milliseconds BURST_DURATION = std::chrono::seconds(2);
+	static constexpr DWORD IDLE_INTERVAL = 1000;
+
+	// How much slower everything gets when throttled.
+	static constexpr DWORD THROTTLE_FACTOR = 4;
+
+	// How long nothing has to happen before caches get dropped in lean mode.
+	static constexpr std::chrono::milliseconds TRIM_DELAY = std::chrono::minutes(5);
+
+	static std::atomic<clock::rep> m_BurstEnd;
+	static std::atomic_uint8_t m_Pauses;
+	static std::atomic_uint8_t m_Throttles;
+	static DWORD m_Interval;
+	static clock::rep m_TrimmedBurst; // Burst end at the time of the last trim, only used by the worker
+
+};
\ No newline at end of file
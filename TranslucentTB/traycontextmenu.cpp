@@ -7,9 +7,16 @@ long TrayContextMenu::TrayCallback(WPARAM, LPARAM lParam)
 {
 	if (lParam == WM_LBUTTONUP || lParam == WM_RBUTTONUP)
 	{
+		const HMENU menu = LoadMenu(m_Instance, m_MenuResource);
+		if (!menu)
+		{
+			LastErrorHandle(Error::Level::Error, L"Failed to load context menu.");
+			return 0;
+		}
+
 		for (const auto &refreshFunction : m_RefreshFunctions)
 		{
-			refreshFunction();
+			refreshFunction(menu);
 		}
 
 		POINT pt;
@@ -20,14 +27,20 @@ long TrayContextMenu::TrayCallback(WPARAM, LPARAM lParam)
 
 		if (!SetForegroundWindow(m_Window))
 		{
-			Log::OutputMessage(L"Failed to set window as foreground window.");
+			Log::OutputFormatted(L"Failed to set window as foreground window.");
 		}
 
 		SetLastError(0);
-		unsigned int item = TrackPopupMenu(GetSubMenu(m_Menu, 0), TPM_RETURNCMD | TPM_LEFTALIGN | TPM_NONOTIFY, pt.x, pt.y, 0, m_Window, NULL);
-		if (!item && GetLastError() != 0)
+		unsigned int item = TrackPopupMenu(GetSubMenu(menu, 0), TPM_RETURNCMD | TPM_LEFTALIGN | TPM_NONOTIFY, pt.x, pt.y, 0, m_Window, NULL);
+		const DWORD error = GetLastError();
+		if (!DestroyMenu(menu))
+		{
+			LastErrorHandle(Error::Level::Log, L"Failed to destroy menu");
+		}
+
+		if (!item && error != 0)
 		{
-			LastErrorHandle(Error::Level::Log, L"Failed to open context menu.");
+			ErrorHandle(HRESULT_FROM_WIN32(error), Error::Level::Log, L"Failed to open context menu.");
 			return 0;
 		}
 
@@ -44,22 +57,14 @@ long TrayContextMenu::TrayCallback(WPARAM, LPARAM lParam)
 }
 
 TrayContextMenu::TrayContextMenu(MessageWindow &window, wchar_t *iconResource, wchar_t *menuResource, const HINSTANCE &hInstance) :
-	TrayIcon(window, iconResource, 0, hInstance)
+	TrayIcon(window, iconResource, 0, hInstance),
+	m_Instance(hInstance),
+	m_MenuResource(menuResource)
 {
-	m_Menu = LoadMenu(hInstance, menuResource);
-	if (!m_Menu)
-	{
-		LastErrorHandle(Error::Level::Fatal, L"Failed to load context menu.");
-	}
-
-	m_Cookie = RegisterTrayCallback(std::bind(&TrayContextMenu::TrayCallback, this, std::placeholders::_1, std::placeholders::_2));
+	m_Cookie = RegisterTrayCallback([this](const WPARAM wParam, const LPARAM lParam) { return TrayCallback(wParam, lParam); });
 }
 
 TrayContextMenu::~TrayContextMenu()
 {
 	m_Window.UnregisterCallback(m_Cookie);
-	if (!DestroyMenu(m_Menu))
-	{
-		LastErrorHandle(Error::Level::Log, L"Failed to destroy menu");
-	}
 }
\ No newline at end of file
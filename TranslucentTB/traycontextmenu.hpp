@@ -15,12 +15,14 @@ protected:
 	using callback_t = std::function<void()>;
 
 private:
-	HMENU m_Menu;
+	// The menu is only loaded while it's opened, nobody looks at it the rest of the time.
+	HINSTANCE m_Instance;
+	wchar_t *m_MenuResource;
 	std::unordered_map<unsigned int, std::vector<std::pair<unsigned short, callback_t>>> m_MenuCallbackMap;
 	long TrayCallback(WPARAM, LPARAM);
 	MessageWindow::CALLBACKCOOKIE m_Cookie;
 
-	std::vector<std::function<void()>> m_RefreshFunctions;
+	std::vector<std::function<void(HMENU)>> m_RefreshFunctions;
 
 public:
 	TrayContextMenu(MessageWindow &window, wchar_t *iconResource, wchar_t *menuResource, const HINSTANCE &hInstance = GetModuleHandle(NULL));
@@ -91,7 +93,10 @@ public:
 			RegisterContextMenuCallback(item, std::bind(&Util::InvertBool, std::ref(value)));
 		}
 
-		m_RefreshFunctions.push_back(std::bind(&TrayContextMenu::RefreshBool, item, m_Menu, std::ref(value), effect));
+		m_RefreshFunctions.emplace_back([item, &value, effect](const HMENU menu)
+		{
+			RefreshBool(item, menu, value, effect);
+		});
 	}
 
 	template<class T>
@@ -107,15 +112,15 @@ public:
 		unsigned int min = min_p->second;
 		unsigned int max = max_p->second;
 
-		m_RefreshFunctions.emplace_back([this, min, max, &value, &map]
+		m_RefreshFunctions.emplace_back([min, max, &value, &map](const HMENU menu)
 		{
-			RefreshEnum(m_Menu, min, max, map.at(value));
+			RefreshEnum(menu, min, max, map.at(value));
 		});
 	}
 
 	inline void RegisterCustomRefresh(const std::function<void(HMENU menu)> &function)
 	{
-		m_RefreshFunctions.push_back(std::bind(function, m_Menu));
+		m_RefreshFunctions.push_back(function);
 	}
 
 	~TrayContextMenu();
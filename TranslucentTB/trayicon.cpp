@@ -10,11 +10,11 @@ long TrayIcon::RegisterIcon(...)
 {
 	if (!Shell_NotifyIcon(NIM_ADD, &m_IconData))
 	{
-		Log::OutputMessage(L"Failed to notify shell of icon addition.");
+		Log::OutputFormatted(L"Failed to notify shell of icon addition.");
 	}
 	if (!Shell_NotifyIcon(NIM_SETVERSION, &m_IconData))
 	{
-		Log::OutputMessage(L"Failed to notify shell of icon version.");
+		Log::OutputFormatted(L"Failed to notify shell of icon version.");
 	}
 
 	return 0;
@@ -36,14 +36,14 @@ TrayIcon::TrayIcon(MessageWindow &window, wchar_t *iconResource, const unsigned
 
 	RegisterIcon();
 
-	m_Cookie = m_Window.RegisterCallback(WM_TASKBARCREATED, std::bind(&TrayIcon::RegisterIcon, this));
+	m_Cookie = m_Window.RegisterCallback(WM_TASKBARCREATED, [this](...) { return RegisterIcon(); });
 }
 
 TrayIcon::~TrayIcon()
 {
 	if (!Shell_NotifyIcon(NIM_DELETE, &m_IconData))
 	{
-		Log::OutputMessage(L"Failed to notify shell of icon deletion.");
+		Log::OutputFormatted(L"Failed to notify shell of icon deletion.");
 	}
 	m_Window.UnregisterCallback(m_Cookie);
 	if (!DestroyIcon(m_IconData.hIcon))
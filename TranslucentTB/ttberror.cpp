@@ -1,76 +1,153 @@
 #include "ttberror.hpp"
+#include <algorithm>
+#include <atomic>
 #include <comdef.h>
 #include <exception>
 #include <iomanip>
 #include <sstream>
 #include <string>
+#include <sysinfoapi.h>
+#include <thread>
 #include <vector>
 #include <winerror.h>
 #include <WinUser.h>
+#include <winrt/base.h>
 
 #include "autofree.hpp"
 #include "common.hpp"
+#include "ringbuffer.hpp"
 #include "ttblog.hpp"
 #include "util.hpp"
 #include "win32.hpp"
 #include "window.hpp"
 
-bool Error::Handle(const HRESULT &error, const Level &level, const wchar_t *const message, const wchar_t *const file, const int &line, const char *const function)
+std::mutex Error::m_SuppressionLock;
+std::unordered_map<Error::Site, Error::Suppression, Error::SiteHash> Error::m_Suppressions;
+
+class Error::Reporter {
+private:
+	// Failures come in bursts when a process dies, same size as the log buffer.
+	ring_buffer<Deferred, 256> m_Queue;
+	std::mutex m_DrainLock; // Held by whoever is draining the queue
+	winrt::handle m_WakeEvent;
+	std::atomic_bool m_Running;
+	std::atomic_bool m_Pending; // Something was queued since the last drain started
+	std::thread m_Thread;
+
+	void Run();
+
+public:
+	Reporter();
+	bool Push(const Deferred &deferred);
+	void Drain();
+	void Wake();
+	~Reporter();
+
+	inline Reporter(const Reporter &) = delete;
+	inline Reporter &operator =(const Reporter &) = delete;
+};
+
+Error::Reporter::Reporter() :
+	m_WakeEvent(CreateEvent(NULL, FALSE, FALSE, NULL)),
+	m_Running(true),
+	m_Pending(false),
+	m_Thread(&Reporter::Run, this)
+{ }
+
+void Error::Reporter::Run()
 {
-	if (FAILED(error))
+	DWORD timeout = INFINITE;
+	while (m_Running)
 	{
-		const std::wstring message_str(message);
-		const std::wstring error_message = ExceptionFromHRESULT(error);
-		std::wostringstream boxbuffer;
-		if (level != Level::Log && level != Level::Debug)
+		if (m_WakeEvent)
 		{
-			boxbuffer << message_str << L"\n\n";
-
-			if (level == Level::Fatal)
-			{
-				boxbuffer << L"Program will exit.\n\n";
-			}
-
-			boxbuffer << error_message;
+			WaitForSingleObject(m_WakeEvent.get(), timeout);
 		}
-
-		// https://bugs.llvm.org/show_bug.cgi?id=38295
-		std::wstring functionW = win32::CharToWchar(function);
-		if (functionW.empty())
+		else
 		{
-			functionW = L"[failed to convert function name to UTF-16]";
+			// If the event couldn't be created, this just degrades to a timer.
+			Sleep(1000);
 		}
 
-		std::wostringstream err;
-		err << message_str << L' ' << error_message <<
-			L" (" << file << L':' << line << L" at function " << functionW << L')';
+		// Cleared before draining, so that anything queued after wakes us up again.
+		m_Pending = false;
+		Drain();
+
+		// Only wakes up on its own while a suppression window has something to log once it's over.
+		timeout = FlushExpiredSuppressions();
+	}
+}
+
+bool Error::Reporter::Push(const Deferred &deferred)
+{
+	const bool pushed = m_Queue.try_push([&deferred](Deferred &slot)
+	{
+		slot = deferred;
+	});
+
+	// Logs get batched by the log writer anyways, so the first one is enough to wake up for.
+	if (pushed && (!m_Pending.exchange(true) || deferred.level == Level::Error || m_Queue.size() >= m_Queue.capacity() / 2))
+	{
+		Wake();
+	}
+
+	return pushed;
+}
+
+void Error::Reporter::Wake()
+{
+	SetEvent(m_WakeEvent.get());
+}
+
+void Error::Reporter::Drain()
+{
+	std::lock_guard guard(m_DrainLock);
+
+	Deferred deferred;
+	while (m_Queue.try_pop([&deferred](const Deferred &slot)
+	{
+		deferred = slot;
+	}))
+	{
+		Report(deferred);
+	}
+}
 
-		switch (level)
+Error::Reporter::~Reporter()
+{
+	m_Running = false;
+	Wake();
+	m_Thread.join();
+
+	// Anything that got in after the last loop.
+	Drain();
+}
+
+bool Error::Handle(const HRESULT &error, const Level &level, const std::wstring &message, const wchar_t *const file, const int &line, const char *const function)
+{
+	if (FAILED(error))
+	{
+		ReportNow({ error, level, message.c_str(), file, line, function });
+		return false;
+	}
+	else
+	{
+		return true;
+	}
+}
+
+bool Error::HandleLiteral(const HRESULT &error, const Level &level, const wchar_t *const message, const wchar_t *const file, const int &line, const char *const function)
+{
+	if (FAILED(error))
+	{
+		const Deferred deferred = { error, level, message, file, line, function };
+		if ((level == Level::Log || level == Level::Error) && GetReporter().Push(deferred))
 		{
-		case Level::Debug:
-			err << L'\n';
-			OutputDebugString(err.str().c_str());
-			break;
-		case Level::Log:
-			Log::OutputMessage(err.str());
-			break;
-		case Level::Error:
-			Log::OutputMessage(err.str());
-			MessageBox(Window::NullWindow, boxbuffer.str().c_str(), NAME L" - Error", MB_ICONWARNING | MB_OK | MB_SETFOREGROUND);
-			break;
-		case Level::Fatal:
-			Log::OutputMessage(err.str());
-			MessageBox(Window::NullWindow, boxbuffer.str().c_str(), NAME L" - Fatal error", MB_ICONERROR | MB_OK | MB_SETFOREGROUND | MB_TOPMOST);
-			RaiseFailFastException(NULL, NULL, FAIL_FAST_GENERATE_EXCEPTION_ADDRESS);	// Calling abort() will generate a dialog box,
-																						// but we already have our own. Raising a fail-fast
-																						// exception skips it but also allows WER to do its
-																						// job.
-			break;
-		default:
-			throw std::invalid_argument("level was not one of known values");
-			break;
+			return false;
 		}
 
+		// Rather be slow than lose it when the queue is full.
+		ReportNow(deferred);
 		return false;
 	}
 	else
@@ -87,4 +164,181 @@ std::wstring Error::ExceptionFromHRESULT(const HRESULT &result)
 	stream << L"Exception from HRESULT: " << (count ? Util::Trim(error.get()) : L"[failed to get error message for HRESULT]") <<
 		L" (0x" << std::setw(sizeof(HRESULT) * 2) << std::setfill(L'0') << std::hex << result << L')';
 	return stream.str();
+}
+
+void Error::ReportSuppressed()
+{
+	Flush();
+
+	std::lock_guard guard(m_SuppressionLock);
+	for (auto &[site, suppression] : m_Suppressions)
+	{
+		if (suppression.count != 0)
+		{
+			LogSuppressed(site, suppression);
+			suppression.count = 0;
+		}
+	}
+}
+
+Error::Reporter &Error::GetReporter()
+{
+	static Reporter reporter;
+	return reporter;
+}
+
+void Error::ReportNow(const Deferred &deferred)
+{
+	if (deferred.level == Level::Fatal)
+	{
+		Flush(); // So that the log shows what led up to it.
+	}
+
+	Report(deferred);
+}
+
+void Error::Report(const Deferred &deferred)
+{
+	const auto &[error, level, message, file, line, function] = deferred;
+
+	// Do this before anything else, the point is to not pay for formatting.
+	if (level == Level::Log && IsSuppressed({ file, line, error }, message))
+	{
+		return;
+	}
+
+	const std::wstring message_str(message);
+	const std::wstring error_message = ExceptionFromHRESULT(error);
+	std::wostringstream boxbuffer;
+	if (level != Level::Log && level != Level::Debug)
+	{
+		boxbuffer << message_str << L"\n\n";
+
+		if (level == Level::Fatal)
+		{
+			boxbuffer << L"Program will exit.\n\n";
+		}
+
+		boxbuffer << error_message;
+	}
+
+	// https://bugs.llvm.org/show_bug.cgi?id=38295
+	std::wstring functionW = win32::CharToWchar(function);
+	if (functionW.empty())
+	{
+		functionW = L"[failed to convert function name to UTF-16]";
+	}
+
+	std::wostringstream err;
+	err << message_str << L' ' << error_message <<
+		L" (" << file << L':' << line << L" at function " << functionW << L')';
+
+	switch (level)
+	{
+	case Level::Debug:
+		err << L'\n';
+		OutputDebugString(err.str().c_str());
+		break;
+	case Level::Log:
+		Log::OutputMessage(err.str(), level);
+		break;
+	case Level::Error:
+		Log::OutputMessage(err.str(), level);
+
+		// Holds up the queue until dismissed, but that also keeps the process from exiting before the user saw it.
+		MessageBox(Window::NullWindow, boxbuffer.str().c_str(), NAME L" - Error", MB_ICONWARNING | MB_OK | MB_SETFOREGROUND);
+		break;
+	case Level::Fatal:
+		Log::OutputMessage(err.str(), level);
+		Log::Flush(); // We won't get another chance.
+		MessageBox(Window::NullWindow, boxbuffer.str().c_str(), NAME L" - Fatal error", MB_ICONERROR | MB_OK | MB_SETFOREGROUND | MB_TOPMOST);
+		RaiseFailFastException(NULL, NULL, FAIL_FAST_GENERATE_EXCEPTION_ADDRESS);	// Calling abort() will generate a dialog box,
+																					// but we already have our own. Raising a fail-fast
+																					// exception skips it but also allows WER to do its
+																					// job.
+		break;
+	default:
+		throw std::invalid_argument("level was not one of known values");
+		break;
+	}
+}
+
+void Error::Flush()
+{
+	GetReporter().Drain();
+}
+
+bool Error::IsSuppressed(const Site &site, const wchar_t *const message)
+{
+	const uint64_t now = GetTickCount64();
+
+	std::unique_lock guard(m_SuppressionLock);
+	auto [it, inserted] = m_Suppressions.try_emplace(site);
+	Suppression &suppression = it->second;
+	if (!inserted && now - suppression.window_start < SUPPRESSION_WINDOW)
+	{
+		// The reporter thread is what logs the count once the window is over, let it know there's one to wait for.
+		if (suppression.count++ == 0)
+		{
+			guard.unlock();
+			GetReporter().Wake();
+		}
+
+		return true;
+	}
+
+	// Either never seen before, or the window is over and this one gets logged again.
+	if (suppression.count != 0)
+	{
+		LogSuppressed(site, suppression);
+	}
+
+	suppression.window_start = now;
+	suppression.count = 0;
+	if (inserted)
+	{
+		suppression.message = message;
+	}
+
+	return false;
+}
+
+DWORD Error::FlushExpiredSuppressions()
+{
+	const uint64_t now = GetTickCount64();
+	uint64_t next = UINT64_MAX;
+
+	std::lock_guard guard(m_SuppressionLock);
+	for (auto it = m_Suppressions.begin(); it != m_Suppressions.end();)
+	{
+		const uint64_t elapsed = now - it->second.window_start;
+		if (elapsed >= SUPPRESSION_WINDOW)
+		{
+			if (it->second.count != 0)
+			{
+				LogSuppressed(it->first, it->second);
+			}
+
+			// The next one starts a new window anyways.
+			it = m_Suppressions.erase(it);
+		}
+		else
+		{
+			// Windows with nothing suppressed get forgotten whenever we wake up, no need to wake up for them.
+			if (it->second.count != 0)
+			{
+				next = (std::min)(next, SUPPRESSION_WINDOW - elapsed);
+			}
+
+			it++;
+		}
+	}
+
+	return next != UINT64_MAX ? static_cast<DWORD>(next) : INFINITE;
+}
+
+void Error::LogSuppressed(const Site &site, const Suppression &suppression)
+{
+	Log::OutputFormatted(L"%ls (0x%08lX at %ls:%d) happened %u more times since it was last logged.",
+		suppression.message.c_str(), static_cast<unsigned long>(site.error), site.file, site.line, suppression.count);
 }
\ No newline at end of file
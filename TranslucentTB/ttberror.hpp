@@ -1,6 +1,11 @@
 #pragma once
 #include "arch.h"
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <tchar.h>
 #include <windef.h>
 #include <winerror.h>
@@ -15,8 +20,80 @@ public:
 		Debug	// Log to debug output. For use in file log implementation.
 	};
 
-	static bool Handle(const HRESULT &error, const Level &level, const wchar_t *const message, const wchar_t *const file, const int &line, const char *const function);
+	// With a literal message, Log and Error failures are only queued, and a reporter thread does the
+	// formatting, logging and message boxes. Fatal and Debug are still handled right away.
+	template<std::size_t N>
+	inline static bool Handle(const HRESULT &error, const Level &level, const wchar_t (&message)[N], const wchar_t *const file, const int &line, const char *const function)
+	{
+		return HandleLiteral(error, level, message, file, line, function);
+	}
+
+	// Any other message might be gone by the time the reporter gets to it, so these are handled right away.
+	static bool Handle(const HRESULT &error, const Level &level, const std::wstring &message, const wchar_t *const file, const int &line, const char *const function);
+
 	static std::wstring ExceptionFromHRESULT(const HRESULT &result);
+
+	// Logs how many errors were suppressed and haven't been reported yet.
+	static void ReportSuppressed();
+
+	// Reports everything still queued.
+	static void Flush();
+
+private:
+	struct Deferred {
+		HRESULT error;
+		Level level;
+		const wchar_t *message;
+		const wchar_t *file;
+		int line;
+		const char *function;
+	};
+
+	class Reporter;
+
+	static bool HandleLiteral(const HRESULT &error, const Level &level, const wchar_t *const message, const wchar_t *const file, const int &line, const char *const function);
+	static void ReportNow(const Deferred &deferred);
+
+	static Reporter &GetReporter();
+	static void Report(const Deferred &deferred);
+
+	// The same Level::Log failure (same place, same error) is only logged once per window. Those usually come
+	// from elevated or dying processes, and would otherwise get logged on every evaluation. How many were
+	// suppressed gets logged once the window is over, by the reporter thread.
+	static constexpr uint64_t SUPPRESSION_WINDOW = 60000; // In milliseconds
+
+	struct Site {
+		const wchar_t *file; // Always a literal from __FILE__, so comparing pointers is enough.
+		int line;
+		HRESULT error;
+
+		inline bool operator ==(const Site &right) const
+		{
+			return file == right.file && line == right.line && error == right.error;
+		}
+	};
+
+	struct SiteHash {
+		inline std::size_t operator()(const Site &site) const noexcept
+		{
+			return std::hash<const wchar_t *>()(site.file) ^ (std::hash<int>()(site.line) << 1) ^ (std::hash<HRESULT>()(site.error) << 2);
+		}
+	};
+
+	struct Suppression {
+		uint64_t window_start;
+		uint32_t count;
+		std::wstring message;
+	};
+
+	static std::mutex m_SuppressionLock;
+	static std::unordered_map<Site, Suppression, SiteHash> m_Suppressions;
+
+	static bool IsSuppressed(const Site &site, const wchar_t *const message);
+	static void LogSuppressed(const Site &site, const Suppression &suppression);
+
+	// Logs and forgets the windows that are over. Returns in how long the next one with something to log is over.
+	static DWORD FlushExpiredSuppressions();
 };
 
 #define ErrorHandle(x, y, z) (Error::Handle((x), (y), (z), _T(__FILE__), __LINE__, __FUNCSIG__))
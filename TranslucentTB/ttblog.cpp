@@ -1,15 +1,18 @@
 #include "ttblog.hpp"
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
 #include <ctime>
 #include <cwchar>
 #include <fileapi.h>
 #include <fstream>
+#include <iterator>
 #include <PathCch.h>
 #include <processthreadsapi.h>
 #include <sstream>
+#include <synchapi.h>
 #include <thread>
-#ifndef STORE
 #include <vector>
-#endif
 #include <WinBase.h>
 #include <winerror.h>
 #include <winnt.h>
@@ -17,6 +20,7 @@
 
 #include "autofree.hpp"
 #include "common.hpp"
+#include "config.hpp"
 #include "win32.hpp"
 #include "window.hpp"
 #ifdef STORE
@@ -26,6 +30,16 @@
 std::mutex Log::m_LogLock;
 std::optional<winrt::file_handle> Log::m_FileHandle;
 std::wstring Log::m_File;
+std::atomic_uint32_t Log::m_Dropped;
+std::wstring Log::m_Folder;
+std::wstring Log::m_BaseName;
+unsigned int Log::m_FileIndex;
+uint32_t Log::m_FileSize;
+bool Log::m_Binary;
+BinaryLog::Encoder Log::m_Encoder;
+std::wstring Log::m_Batch;
+std::wstring Log::m_DebugBuffer;
+std::vector<BinaryLog::Argument> Log::m_Arguments;
 
 std::pair<HRESULT, std::wstring> Log::InitStream()
 {
@@ -87,17 +101,44 @@ std::pair<HRESULT, std::wstring> Log::InitStream()
 		// Remove the difference.
 		creationTimestamp.QuadPart -= 11644473600;
 
-		log_filename = std::to_wstring(creationTimestamp.QuadPart) + L".log";
+		log_filename = std::to_wstring(creationTimestamp.QuadPart);
 	}
 	else
 	{
 		// Fallback to current time
 		std::time_t unix_epoch = std::time(0);
-		log_filename = std::to_wstring(unix_epoch) + L".log";
+		log_filename = std::to_wstring(unix_epoch);
+	}
+
+	m_Folder = log_folder;
+	m_BaseName = std::move(log_filename);
+	m_Binary = Config::Current()->BINARY_LOG;
+	m_FileIndex = 0;
+
+	const auto result = OpenFile();
+	PruneOldFiles();
+	return result;
+
+#ifdef STORE
+	}
+	catch (const winrt::hresult_error &error)
+	{
+		return { error.code(), L"Failed to determine temporary folder location!" };
+	}
+#endif
+}
+
+std::pair<HRESULT, std::wstring> Log::OpenFile()
+{
+	std::wstring log_filename = m_BaseName;
+	if (m_FileIndex != 0)
+	{
+		log_filename += L'-' + std::to_wstring(m_FileIndex);
 	}
+	log_filename += m_Binary ? BinaryLog::EXTENSION : TEXT_EXTENSION;
 
 	AutoFree::DebugLocal<wchar_t> log_file;
-	hr = PathAllocCombine(log_folder, log_filename.c_str(), PATHCCH_ALLOW_LONG_PATHS, log_file.put());
+	HRESULT hr = PathAllocCombine(m_Folder.c_str(), log_filename.c_str(), PATHCCH_ALLOW_LONG_PATHS, log_file.put());
 	if (FAILED(hr))
 	{
 		return { hr, L"Failed to combine log folder location and log file name!" };
@@ -109,28 +150,161 @@ std::pair<HRESULT, std::wstring> Log::InitStream()
 		return { HRESULT_FROM_WIN32(GetLastError()), L"Failed to create and open log file!" };
 	}
 
-	DWORD bytesWritten;
-	if (!WriteFile(m_FileHandle->get(), L"\uFEFF", sizeof(wchar_t), &bytesWritten, NULL))
+	m_File = log_file.get();
+	m_FileSize = 0;
+
+	// Strings are interned per file, so that each file can be decoded on its own.
+	if (m_Binary)
+	{
+		m_Encoder.reset();
+	}
+	else
 	{
-		LastErrorHandle(Error::Level::Debug, L"Failed to write byte-order marker.");
+		Write(L"\uFEFF", sizeof(wchar_t));
 	}
 
-	m_File = log_file.get();
 	return { S_OK, L"" };
+}
 
-#ifdef STORE
+void Log::PruneOldFiles()
+{
+	struct LogFile {
+		uint64_t time;
+		std::wstring name;
+	};
+
+	std::vector<LogFile> files;
+	for (const wchar_t *const extension : { TEXT_EXTENSION, BinaryLog::EXTENSION })
+	{
+		WIN32_FIND_DATA data;
+		const HANDLE find = FindFirstFileEx((m_Folder + L"\\*" + extension).c_str(), FindExInfoBasic, &data, FindExSearchNameMatch, NULL, 0);
+		if (find == INVALID_HANDLE_VALUE)
+		{
+			continue;
+		}
+
+		do
+		{
+			if (!(data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			{
+				files.push_back({ (static_cast<uint64_t>(data.ftLastWriteTime.dwHighDateTime) << 32) | data.ftLastWriteTime.dwLowDateTime, m_Folder + L'\\' + data.cFileName });
+			}
+		}
+		while (FindNextFile(find, &data));
+
+		FindClose(find);
 	}
-	catch (const winrt::hresult_error &error)
+
+	if (files.size() <= MAX_FILE_COUNT)
 	{
-		return { error.code(), L"Failed to determine temporary folder location!" };
+		return;
 	}
-#endif
+
+	// Newest first
+	std::sort(files.begin(), files.end(), [](const LogFile &a, const LogFile &b)
+	{
+		return a.time > b.time;
+	});
+
+	for (auto it = files.begin() + MAX_FILE_COUNT; it != files.end(); it++)
+	{
+		if (it->name != m_File && !DeleteFile(it->name.c_str()))
+		{
+			LastErrorHandle(Error::Level::Debug, L"Failed to delete old log file.");
+		}
+	}
+}
+
+void Log::Write(const void *const data, const std::size_t &size)
+{
+	DWORD bytesWritten = 0;
+	if (!WriteFile(m_FileHandle->get(), data, static_cast<DWORD>(size), &bytesWritten, NULL))
+	{
+		LastErrorHandle(Error::Level::Debug, L"Writing to log file failed.");
+	}
+
+	m_FileSize += bytesWritten;
+}
+
+ring_buffer<Log::Entry, 256> &Log::GetBuffer()
+{
+	static ring_buffer<Entry, 256> buffer;
+	return buffer;
+}
+
+Log::Writer &Log::GetWriter()
+{
+	static Writer writer;
+	return writer;
+}
+
+Log::Writer::Writer() :
+	m_WakeEvent(CreateEvent(NULL, FALSE, FALSE, NULL)),
+	m_Running(true),
+	m_Pending(false),
+	m_Thread(&Writer::Run, this)
+{ }
+
+void Log::Writer::Run()
+{
+	while (m_Running)
+	{
+		// Nothing to write until woken up.
+		Wait(INFINITE);
+
+		// Give what follows the first message a chance to be written with it, unless the buffer fills up meanwhile.
+		if (m_Running)
+		{
+			Wait(BATCH_TIME);
+		}
+
+		// Cleared before draining, so that anything queued after wakes us up again.
+		m_Pending = false;
+
+		std::lock_guard guard(m_LogLock);
+		Drain();
+	}
+}
+
+void Log::Writer::Wait(const DWORD &timeout)
+{
+	if (m_WakeEvent)
+	{
+		WaitForSingleObject(m_WakeEvent.get(), timeout);
+	}
+	else
+	{
+		// If the event couldn't be created, this just degrades to a timer.
+		Sleep(BATCH_TIME);
+	}
+}
+
+void Log::Writer::Queued(const bool &urgent)
+{
+	if (!m_Pending.exchange(true) || urgent)
+	{
+		Wake();
+	}
+}
+
+void Log::Writer::Wake()
+{
+	SetEvent(m_WakeEvent.get());
 }
 
-void Log::OutputMessage(const std::wstring &message)
+Log::Writer::~Writer()
 {
+	m_Running = false;
+	Wake();
+	m_Thread.join();
+
+	// Anything that got in after the last loop.
 	std::lock_guard guard(m_LogLock);
+	Drain();
+}
 
+void Log::Drain()
+{
 	if (!init_done())
 	{
 		auto [hr, err_message] = InitStream();
@@ -150,32 +324,155 @@ void Log::OutputMessage(const std::wstring &message)
 		}
 	}
 
-	OutputDebugString((message + L'\n').c_str());
+	m_Batch.clear();
 
-	if (*m_FileHandle)
+	const auto debug_output = [](std::wstring_view text)
 	{
-		std::time_t current_time = std::time(0);
+		m_DebugBuffer.assign(text);
+		m_DebugBuffer += L'\n';
+		OutputDebugString(m_DebugBuffer.c_str());
+	};
+
+	const auto append = [&debug_output](const std::time_t &time, const uint8_t &level, std::wstring_view text)
+	{
+		debug_output(text);
+		if (m_Binary)
+		{
+			m_Encoder.text(time, level, text);
+		}
+		else
+		{
+			m_Batch += L'(';
+			m_Batch += BinaryLog::FormatTime(time);
+			m_Batch += L") ";
+			m_Batch += text;
+			m_Batch += L"\r\n";
+		}
+	};
+
+	const bool debugger = IsDebuggerPresent();
+	while (GetBuffer().try_pop([&append, &debug_output, &debugger](const Entry &entry)
+	{
+		if (!entry.format)
+		{
+			append(entry.time, entry.level, std::wstring_view(entry.text, entry.length));
+		}
+		else if (m_Binary)
+		{
+			// Formatting is the expensive part, so only do it if someone is actually looking at debug output.
+			m_Encoder.message(entry.time, entry.level, entry.format, entry.arguments, entry.length);
+			if (debugger)
+			{
+				BinaryLog::Unpack(entry.arguments, entry.length, m_Arguments);
+				debug_output(BinaryLog::Format(entry.format, m_Arguments));
+			}
+		}
+		else
+		{
+			BinaryLog::Unpack(entry.arguments, entry.length, m_Arguments);
+			append(entry.time, entry.level, BinaryLog::Format(entry.format, m_Arguments));
+		}
+	})) { }
 
-		std::wostringstream buffer;
-		buffer << L'(' << _wctime(&current_time);
-		buffer.seekp(-1, std::ios_base::end); // Seek behind the newline created by _wctime
-		buffer << L") " << message << L"\r\n";
+	if (const uint32_t dropped = m_Dropped.exchange(0))
+	{
+		append(std::time(0), static_cast<uint8_t>(Error::Level::Log), std::to_wstring(dropped) + L" log messages were dropped because the log buffer was full.");
+	}
 
-		const std::wstring error = buffer.str();
+	if (*m_FileHandle)
+	{
+		if (m_Binary)
+		{
+			const auto &buffer = m_Encoder.buffer();
+			if (!buffer.empty())
+			{
+				Write(buffer.data(), buffer.size());
+				m_Encoder.clear_buffer();
+			}
+		}
+		else if (!m_Batch.empty())
+		{
+			Write(m_Batch.c_str(), m_Batch.length() * sizeof(wchar_t));
+		}
 
-		DWORD bytesWritten;
-		if (!WriteFile(m_FileHandle->get(), error.c_str(), error.length() * sizeof(wchar_t), &bytesWritten, NULL))
+		if (m_FileSize >= MAX_FILE_SIZE)
 		{
-			LastErrorHandle(Error::Level::Debug, L"Writing to log file failed.");
+			m_FileIndex++;
+			if (const auto [hr, err_message] = OpenFile(); FAILED(hr))
+			{
+				ErrorHandle(hr, Error::Level::Debug, err_message);
+			}
+
+			PruneOldFiles();
 		}
 	}
 }
 
+void Log::Queued(const bool &pushed)
+{
+	if (!pushed)
+	{
+		m_Dropped++;
+	}
+
+	// Write early if we're getting close to dropping messages.
+	GetWriter().Queued(!pushed || GetBuffer().size() >= GetBuffer().capacity() / 2);
+}
+
+void Log::OutputMessage(std::wstring_view message, const Error::Level &level)
+{
+	const std::time_t time = std::time(0);
+	Queued(GetBuffer().try_push([&message, &level, &time](Entry &entry)
+	{
+		entry.time = time;
+		entry.level = static_cast<uint8_t>(level);
+		entry.format = nullptr;
+		entry.length = static_cast<uint16_t>((std::min)(message.length(), MAX_MESSAGE_LENGTH - 1));
+		std::copy_n(message.data(), entry.length, entry.text);
+		entry.text[entry.length] = L'\0';
+	}));
+}
+
+void Log::OutputFormatted(const wchar_t *const format, ...)
+{
+	const std::time_t time = std::time(0);
+
+	va_list args;
+	va_start(args, format);
+	Queued(GetBuffer().try_push([&format, &args, &time](Entry &entry)
+	{
+		entry.time = time;
+		entry.level = static_cast<uint8_t>(Error::Level::Log);
+
+		if (Config::Current()->BINARY_LOG)
+		{
+			va_list copy;
+			va_copy(copy, args);
+			const std::size_t size = BinaryLog::Pack(format, copy, entry.arguments, sizeof(entry.arguments));
+			va_end(copy);
+
+			if (size != 0)
+			{
+				entry.format = format;
+				entry.length = static_cast<uint16_t>(size);
+				return;
+			}
+		}
+
+		// Text mode, or the arguments can't be packed.
+		entry.format = nullptr;
+		const int length = _vsnwprintf_s(entry.text, MAX_MESSAGE_LENGTH, _TRUNCATE, format, args);
+		entry.length = static_cast<uint16_t>(length >= 0 ? length : std::wcslen(entry.text));
+	}));
+	va_end(args);
+}
+
 void Log::Flush()
 {
 	std::lock_guard guard(m_LogLock);
 
-	if (!FlushFileBuffers(m_FileHandle->get()))
+	Drain();
+	if (*m_FileHandle && !FlushFileBuffers(m_FileHandle->get()))
 	{
 		LastErrorHandle(Error::Level::Debug, L"Flusing log file buffer failed.");
 	}
@@ -1,20 +1,94 @@
 #pragma once
 #include "arch.h"
+#include <atomic>
+#include <cstdint>
+#include <ctime>
 #include <mutex>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <utility>
 #include <optional>
+#include <vector>
 #include <windef.h>
 #include <winrt/base.h>
 
+#include "binarylog.hpp"
+#include "ringbuffer.hpp"
+#include "ttberror.hpp"
+
 class Log {
 
 private:
-	static std::mutex m_LogLock;
+	// Messages longer than this get truncated.
+	static constexpr std::size_t MAX_MESSAGE_LENGTH = 500;
+
+	// Once a file reaches this size, continue in a new one. Only keep that many files around.
+	static constexpr uint32_t MAX_FILE_SIZE = 4 * 1024 * 1024;
+	static constexpr std::size_t MAX_FILE_COUNT = 5;
+	static constexpr wchar_t TEXT_EXTENSION[] = L".log";
+
+	struct Entry {
+		std::time_t time;
+		uint8_t level; // Error::Level
+		const wchar_t *format; // If set, arguments contains the packed arguments for it instead of text having the message.
+		uint16_t length; // In characters for text, in bytes for arguments
+		union {
+			wchar_t text[MAX_MESSAGE_LENGTH];
+			uint8_t arguments[MAX_MESSAGE_LENGTH * sizeof(wchar_t)];
+		};
+	};
+
+	// Writes queued messages in batches, either when the buffer starts filling up or a bit after the first one
+	// got queued. Sleeps for as long as nothing is.
+	class Writer {
+	private:
+		static constexpr DWORD BATCH_TIME = 1000; // In milliseconds
+
+		winrt::handle m_WakeEvent;
+		std::atomic_bool m_Running;
+		std::atomic_bool m_Pending; // Something was queued since the last drain started
+		std::thread m_Thread;
+
+		void Run();
+		void Wait(const DWORD &timeout);
+
+	public:
+		Writer();
+		void Queued(const bool &urgent);
+		void Wake();
+		~Writer();
+
+		inline Writer(const Writer &) = delete;
+		inline Writer &operator =(const Writer &) = delete;
+	};
+
+	static std::mutex m_LogLock; // Held by whoever is draining the buffer
 	static std::optional<winrt::file_handle> m_FileHandle;
 	static std::wstring m_File;
+	static std::atomic_uint32_t m_Dropped;
+
+	// Only used with m_LogLock held
+	static std::wstring m_Folder;
+	static std::wstring m_BaseName;
+	static unsigned int m_FileIndex;
+	static uint32_t m_FileSize;
+	static bool m_Binary;
+	static BinaryLog::Encoder m_Encoder;
+	static std::wstring m_Batch;        // Kept around to not allocate every time
+	static std::wstring m_DebugBuffer;
+	static std::vector<BinaryLog::Argument> m_Arguments;
+
+	// As functions because static initialization order, hooks can log before main.
+	static ring_buffer<Entry, 256> &GetBuffer();
+	static Writer &GetWriter();
 
 	static std::pair<HRESULT, std::wstring> InitStream();
+	static std::pair<HRESULT, std::wstring> OpenFile();
+	static void PruneOldFiles();
+	static void Write(const void *const data, const std::size_t &size);
+	static void Queued(const bool &pushed);
+	static void Drain(); // m_LogLock must be held
 
 public:
 	inline static bool init_done()
@@ -25,6 +99,15 @@ public:
 	{
 		return m_File;
 	}
-	static void OutputMessage(const std::wstring &message);
+
+	// Never blocks on I/O. If the buffer is full, the message is dropped and counted.
+	// For one-off text: messages that repeat should use OutputFormatted, so that binary logs only store their format once.
+	static void OutputMessage(std::wstring_view message, const Error::Level &level = Error::Level::Log);
+
+	// printf-style, formats straight into the buffer without allocating. The format must be a string literal,
+	// because in binary mode it's only formatted later by the writer (or not at all, by LogDecoder).
+	static void OutputFormatted(const wchar_t *const format, ...);
+
+	// Writes everything queued so far to disk before returning.
 	static void Flush();
 };
\ No newline at end of file
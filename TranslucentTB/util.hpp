@@ -1,19 +1,110 @@
 #pragma once
 #include <algorithm>
 #include <cstdint>
+#include <cstddef>
 #include <cwctype>
 #include <limits>
 #include <random>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
+
+#if defined(_M_IX86) || defined(_M_AMD64)
+# include <emmintrin.h>
+# define TTB_SSE2
+#endif
 
 class Util {
 
+private:
+	// Most strings we compare (class and executable names) are ASCII, which can be lowercased without towlower.
+	inline static wchar_t ToLowerChar(const wchar_t &c)
+	{
+		if (c < 0x80)
+		{
+			return c >= L'A' && c <= L'Z' ? c | 0x20 : c;
+		}
+		else
+		{
+			return static_cast<wchar_t>(std::towlower(c));
+		}
+	}
+
+#ifdef TTB_SSE2
+	// Blocks of 8 characters. Blocks with a non-ASCII character are left to ToLowerChar.
+	inline static bool IsAsciiBlock(const __m128i &block)
+	{
+		const __m128i high = _mm_and_si128(block, _mm_set1_epi16(static_cast<short>(0xFF80)));
+		return _mm_movemask_epi8(_mm_cmpeq_epi16(high, _mm_setzero_si128())) == 0xFFFF;
+	}
+
+	inline static __m128i ToLowerAsciiBlock(const __m128i &block)
+	{
+		const __m128i upper = _mm_and_si128(_mm_cmpgt_epi16(block, _mm_set1_epi16(L'A' - 1)), _mm_cmplt_epi16(block, _mm_set1_epi16(L'Z' + 1)));
+		return _mm_or_si128(block, _mm_and_si128(upper, _mm_set1_epi16(0x20)));
+	}
+#endif
+
+	inline static bool EqualsIgnoreCase(const wchar_t *l, const wchar_t *r, const std::size_t &length)
+	{
+		std::size_t i = 0;
+#ifdef TTB_SSE2
+		for (; i + 8 <= length; i += 8)
+		{
+			const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i *>(l + i));
+			const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i *>(r + i));
+			if (IsAsciiBlock(_mm_or_si128(a, b)))
+			{
+				if (_mm_movemask_epi8(_mm_cmpeq_epi16(ToLowerAsciiBlock(a), ToLowerAsciiBlock(b))) != 0xFFFF)
+				{
+					return false;
+				}
+			}
+			else
+			{
+				for (std::size_t j = i; j < i + 8; j++)
+				{
+					if (ToLowerChar(l[j]) != ToLowerChar(r[j]))
+					{
+						return false;
+					}
+				}
+			}
+		}
+#endif
+
+		for (; i < length; i++)
+		{
+			if (ToLowerChar(l[i]) != ToLowerChar(r[i]))
+			{
+				return false;
+			}
+		}
+
+		return true;
+	}
+
 public:
 	// Converts a string to its lowercase variant
 	inline static void ToLowerInplace(std::wstring &data)
 	{
-		std::transform(data.begin(), data.end(), data.begin(), std::towlower);
+		std::size_t i = 0;
+#ifdef TTB_SSE2
+		for (; i + 8 <= data.length(); i += 8)
+		{
+			__m128i *const block = reinterpret_cast<__m128i *>(data.data() + i);
+			if (const __m128i value = _mm_loadu_si128(block); IsAsciiBlock(value))
+			{
+				_mm_storeu_si128(block, ToLowerAsciiBlock(value));
+			}
+			else
+			{
+				std::transform(data.begin() + i, data.begin() + i + 8, data.begin() + i, ToLowerChar);
+			}
+		}
+#endif
+
+		std::transform(data.begin() + i, data.end(), data.begin() + i, ToLowerChar);
 	}
 
 	// Converts a string to its lowercase variant
@@ -26,26 +117,43 @@ public:
 	template<size_t s>
 	inline static bool IgnoreCaseStringEquals(const std::wstring &l, const wchar_t (&r)[s])
 	{
-		return std::equal(l.begin(), l.end(), r, r + s - 1, [](const wchar_t &a, const wchar_t &b) -> bool
-		{
-			return b != L'\0' && std::towlower(a) == std::towlower(b);
-		});
+		return l.length() == s - 1 && EqualsIgnoreCase(l.data(), r, s - 1);
 	}
 
 	inline static bool IgnoreCaseStringEquals(const std::wstring &l, const std::wstring &r)
 	{
-		return std::equal(l.begin(), l.end(), r.begin(), r.end(), [](const wchar_t &a, const wchar_t &b) -> bool
+		return l.length() == r.length() && EqualsIgnoreCase(l.data(), r.data(), l.length());
+	}
+
+	// Same as hashing the lowercase string, without making a lowercase copy.
+	inline static std::size_t IgnoreCaseStringHash(const std::wstring &str)
+	{
+		// FNV-1a
+		std::size_t hash, prime;
+		if constexpr (sizeof(std::size_t) == 8)
 		{
-			return std::towlower(a) == std::towlower(b);
-		});
+			hash = static_cast<std::size_t>(14695981039346656037ULL);
+			prime = static_cast<std::size_t>(1099511628211ULL);
+		}
+		else
+		{
+			hash = static_cast<std::size_t>(2166136261U);
+			prime = static_cast<std::size_t>(16777619U);
+		}
+
+		for (const wchar_t &c : str)
+		{
+			hash = (hash ^ static_cast<std::size_t>(ToLowerChar(c))) * prime;
+		}
+
+		return hash;
 	}
 
 private:
 	struct string_hash {
 		inline std::size_t operator()(const std::wstring &k) const
 		{
-			static const std::hash<std::wstring> hasher;
-			return hasher(ToLower(k));
+			return IgnoreCaseStringHash(k);
 		}
 	};
 
@@ -61,6 +169,9 @@ public:
 	template<typename T>
 	using string_map = std::unordered_map<std::wstring, T, string_hash, string_compare>;
 
+	// Case-insensitive std::unordered_set of strings.
+	using string_set = std::unordered_set<std::wstring, string_hash, string_compare>;
+
 	template<typename K, typename V, class Compare = std::less<V>>
 	struct map_value_compare {
 	private:
@@ -157,6 +268,20 @@ public:
 		value = !value;
 	}
 
+	// Rough heap usage of a string beyond its own size, for the diagnostics report. Short strings are stored inline.
+	inline static std::size_t MemoryUsage(const std::wstring &str)
+	{
+		static const std::size_t inline_capacity = std::wstring().capacity();
+		return str.capacity() > inline_capacity ? (str.capacity() + 1) * sizeof(wchar_t) : 0;
+	}
+
+	// Rough heap usage of a node based container, not counting what its elements point to.
+	template<class Container>
+	inline static std::size_t NodeMemoryUsage(const Container &container)
+	{
+		return container.size() * (sizeof(typename Container::value_type) + 2 * sizeof(void *)) + container.bucket_count() * sizeof(void *);
+	}
+
 private:
 	// Gets a static instance of a Mersenne Twister engine. Can't be put directly in
 	// GetRandomNumber because every different template instantion will get a different static variable.
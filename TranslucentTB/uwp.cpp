@@ -1,26 +1,80 @@
 #include "uwp.hpp"
+#include <chrono>
+#include <stdexcept>
+#include <winrt/Windows.Foundation.Collections.h>
 #include <winrt/Windows.Storage.h>
 
+std::once_flag UWP::m_PrefetchFlag;
+std::shared_future<winrt::hstring> UWP::m_TemporaryFolder;
+std::shared_future<winrt::hstring> UWP::m_RoamingFolder;
+std::shared_future<winrt::Windows::ApplicationModel::StartupTask> UWP::m_StartupTask;
+
+void UWP::Prefetch()
+{
+	std::call_once(m_PrefetchFlag, StartPrefetch);
+}
+
 winrt::Windows::Foundation::IAsyncOperation<winrt::Windows::ApplicationModel::StartupTask> UWP::GetApplicationStartupTask()
 {
-	static const auto task = (co_await winrt::Windows::ApplicationModel::StartupTask::GetForCurrentPackageAsync()).GetAt(0);
-	return task;
+	Prefetch();
+	if (m_StartupTask.wait_for(std::chrono::seconds::zero()) != std::future_status::ready)
+	{
+		co_await winrt::resume_background();
+	}
+
+	co_return m_StartupTask.get();
 }
 
-winrt::hstring UWP::GetApplicationFolderPath(const FolderType &type)
+winrt::Windows::ApplicationModel::StartupTask UWP::TryGetApplicationStartupTask()
 {
-	static const auto application_data = winrt::Windows::Storage::ApplicationData::Current();
+	Prefetch();
+	if (m_StartupTask.wait_for(std::chrono::seconds::zero()) == std::future_status::ready)
+	{
+		try
+		{
+			return m_StartupTask.get();
+		}
+		catch (const winrt::hresult_error &)
+		{
+			// GetApplicationStartupTask rethrows it for the caller to report.
+		}
+	}
+
+	return nullptr;
+}
 
+winrt::hstring UWP::GetApplicationFolderPath(const FolderType &type)
+{
+	Prefetch();
 	switch (type)
 	{
 	case FolderType::Temporary:
-		return application_data.TemporaryFolder().Path();
+		return m_TemporaryFolder.get();
 
 	case FolderType::Roaming:
-		return application_data.RoamingFolder().Path();
+		return m_RoamingFolder.get();
 
 	// Apparently we can cast any integer to an enum class, so yeah...
 	default:
 		throw std::invalid_argument("type was not one of the known values");
 	}
+}
+
+void UWP::StartPrefetch()
+{
+	// Separate threads so that the log folder doesn't wait for the startup task, and so on.
+	m_TemporaryFolder = std::async(std::launch::async, []
+	{
+		return winrt::Windows::Storage::ApplicationData::Current().TemporaryFolder().Path();
+	}).share();
+
+	m_RoamingFolder = std::async(std::launch::async, []
+	{
+		return winrt::Windows::Storage::ApplicationData::Current().RoamingFolder().Path();
+	}).share();
+
+	m_StartupTask = std::async(std::launch::async, []
+	{
+		return winrt::Windows::ApplicationModel::StartupTask::GetForCurrentPackageAsync().get().GetAt(0);
+	}).share();
 }
\ No newline at end of file
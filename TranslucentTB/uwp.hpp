@@ -1,12 +1,21 @@
 #pragma once
+#include <future>
+#include <mutex>
 #include <string>
 #include <winrt/Windows.ApplicationModel.h>
 
 class UWP {
 
 public:
+	// Starts resolving the folder paths and the startup task, all at once in the background.
+	// Everything below waits on those instead of activating on first use.
+	static void Prefetch();
+
 	static winrt::Windows::Foundation::IAsyncOperation<winrt::Windows::ApplicationModel::StartupTask> GetApplicationStartupTask();
 
+	// Null if the startup task isn't resolved yet (or failed to).
+	static winrt::Windows::ApplicationModel::StartupTask TryGetApplicationStartupTask();
+
 	enum class FolderType {
 		Temporary,
 		Roaming
@@ -14,4 +23,11 @@ public:
 
 	static winrt::hstring GetApplicationFolderPath(const FolderType &type);
 
+private:
+	static std::once_flag m_PrefetchFlag;
+	static std::shared_future<winrt::hstring> m_TemporaryFolder;
+	static std::shared_future<winrt::hstring> m_RoamingFolder;
+	static std::shared_future<winrt::Windows::ApplicationModel::StartupTask> m_StartupTask;
+
+	static void StartPrefetch();
 };
\ No newline at end of file
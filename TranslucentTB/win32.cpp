@@ -30,10 +30,11 @@ BOOL win32::EnumThreadWindowsProc(HWND hwnd, LPARAM lParam)
 	Window wnd(hwnd);
 	bool &needs_wait = *reinterpret_cast<bool *>(lParam);
 
-	if (*wnd.title() == L"Color Picker")
+	if (wnd.title() == L"Color Picker")
 	{
 		// 1068 == IDB_CANCEL
-		wnd.send_message(WM_COMMAND, MAKEWPARAM(1068, BN_CLICKED));
+		// Posted, the caller waits for the picker thread anyway.
+		wnd.post_message(WM_COMMAND, MAKEWPARAM(1068, BN_CLICKED));
 
 		needs_wait = true;
 		return false;
@@ -1,127 +1,688 @@
 #include "window.hpp"
-#include <optional>
+#include <algorithm>
 #include <ShObjIdl.h>
-#include <winrt/base.h>
-#include <vector>
+#include <string_view>
+#include <utility>
 
 #include "createinstance.hpp"
 #include "common.hpp"
+#include "diagnostics.hpp"
 #include "eventhook.hpp"
+#include "monitortopology.hpp"
 #include "ttberror.hpp"
+#include "util.hpp"
+#include "win32.hpp"
 
-std::mutex Window::m_ClassNamesLock;
-std::unordered_map<Window, std::shared_ptr<std::wstring>> Window::m_ClassNames;
+// Before the cache, so that it's destroyed after what it hands strings to.
+std::mutex Window::m_InternLock;
+std::unordered_map<std::wstring_view, std::weak_ptr<const std::wstring>> Window::m_InternedStrings;
 
-std::mutex Window::m_FilenamesLock;
-std::unordered_map<Window, std::shared_ptr<std::wstring>> Window::m_Filenames;
+std::mutex Window::m_CacheLock;
+flat_map<HWND, Window::CachedProperties> Window::m_Cache;
+std::unordered_map<DWORD, Window::ProcessName> Window::m_ProcessNames;
+std::size_t Window::m_ProcessPruneThreshold = MIN_PROCESS_PRUNE_THRESHOLD;
+GUID Window::m_CurrentDesktop = UNKNOWN_DESKTOP;
+uint64_t Window::m_DesktopGeneration = 0;
 
-std::mutex Window::m_TitlesLock;
-std::unordered_map<Window, std::shared_ptr<std::wstring>> Window::m_Titles;
+// What the string properties of the null window are, since it has no cache entry to hold them.
+static const std::wstring empty_string;
 
 const Window Window::NullWindow = nullptr;
 const Window Window::BroadcastWindow = HWND_BROADCAST;
 const Window Window::MessageOnlyWindow = HWND_MESSAGE;
 
-std::shared_ptr<const std::wstring> Window::title() const
+Window::interned_t Window::Intern(std::wstring &&str)
 {
-	std::lock_guard guard(m_TitlesLock);
+	std::lock_guard guard(m_InternLock);
+	if (const auto it = m_InternedStrings.find(str); it != m_InternedStrings.end())
+	{
+		if (interned_t interned = it->second.lock())
+		{
+			return interned;
+		}
+
+		// Its last user is about to release it, take over the entry.
+		m_InternedStrings.erase(it);
+	}
 
-	if (m_Titles.count(m_WindowHandle) == 0)
+	interned_t interned(new std::wstring(std::move(str)), ReleaseInterned);
+	m_InternedStrings.emplace(*interned, interned);
+	return interned;
+}
+
+void Window::ReleaseInterned(const std::wstring *str)
+{
 	{
-		std::shared_ptr<std::wstring> windowTitle = std::make_shared<std::wstring>();
-		int titleSize = GetWindowTextLength(m_WindowHandle) + 1; // For the null terminator
-		windowTitle->resize(titleSize);
+		std::lock_guard guard(m_InternLock);
 
-		int copiedChars = GetWindowText(m_WindowHandle, windowTitle->data(), titleSize);
-		if (!copiedChars)
+		// The string might have been interned again since, in which case the entry belongs to the new one.
+		if (const auto it = m_InternedStrings.find(*str); it != m_InternedStrings.end() && it->second.expired())
 		{
-			LastErrorHandle(Error::Level::Log, L"Getting title of a window failed.");
-			windowTitle->erase();
-			return m_Titles[m_WindowHandle] = std::move(windowTitle);
+			m_InternedStrings.erase(it);
 		}
+	}
 
-		windowTitle->resize(copiedChars);
-		return m_Titles[m_WindowHandle] = std::move(windowTitle);
+	delete str;
+}
+
+Window::CachedProperties *Window::FindCached(const HWND &handle)
+{
+	CachedProperties *const cached = m_Cache.find(handle);
+	if (!cached)
+	{
+		return nullptr;
 	}
-	else
+
+	if (cached->owner != Window(handle).thread_id())
+	{
+		// Another window got the handle, or it's gone and we missed the destroy event.
+		Forget(handle);
+		return nullptr;
+	}
+
+	cached->referenced = true;
+	return cached;
+}
+
+Window::CachedProperties &Window::CacheEntry(const HWND &handle)
+{
+	const DWORD owner = Window(handle).thread_id();
+	if (CachedProperties *const cached = m_Cache.find(handle))
+	{
+		if (cached->owner != owner)
+		{
+			*cached = { };
+			cached->owner = owner;
+		}
+
+		cached->referenced = true;
+		return *cached;
+	}
+
+	if (m_Cache.size() >= CACHE_CAPACITY)
+	{
+		EvictUnused();
+	}
+
+	CachedProperties &cached = m_Cache[handle];
+	cached.owner = owner;
+	cached.referenced = true;
+	Diagnostics::Set(Diagnostics::Counter::WindowCacheSize, m_Cache.size());
+	return cached;
+}
+
+void Window::EvictUnused()
+{
+	// Like CLOCK: windows used since the last sweep get a second chance, the rest goes, along with windows that are gone.
+	const auto sweep = []
 	{
-		return m_Titles.at(m_WindowHandle);
+		return m_Cache.erase_if([](const HWND &handle, CachedProperties &cached)
+		{
+			const bool keep = cached.referenced && cached.owner == Window(handle).thread_id();
+			cached.referenced = false;
+			return !keep;
+		});
+	};
+
+	std::size_t evicted = sweep();
+	if (evicted == 0)
+	{
+		evicted = sweep(); // Everything was in use, so no favorites.
 	}
+
+	Diagnostics::Increment(Diagnostics::Counter::CacheEvictions, evicted);
+	Diagnostics::Set(Diagnostics::Counter::WindowCacheSize, m_Cache.size());
 }
 
-std::shared_ptr<const std::wstring> Window::classname() const
+void Window::Invalidate(const HWND &handle, const uint8_t &properties)
 {
-	std::lock_guard guard(m_ClassNamesLock);
+	if (CachedProperties *const cached = m_Cache.find(handle))
+	{
+		cached->valid &= ~properties;
+	}
+}
 
-	if (m_ClassNames.count(m_WindowHandle) == 0)
+void Window::Forget(const HWND &handle)
+{
+	m_Cache.erase(handle);
+	Diagnostics::Set(Diagnostics::Counter::WindowCacheSize, m_Cache.size());
+}
+
+Window::interned_t Window::LookupProcessName(const DWORD &pid)
+{
+	if (const auto it = m_ProcessNames.find(pid); it != m_ProcessNames.end())
 	{
-		std::shared_ptr<std::wstring> className = std::make_shared<std::wstring>();
-		className->resize(257);	// According to docs, maximum length of a class name is 256, but it's ambiguous
-								// wether this includes the null terminator or not.
+		if (WaitForSingleObject(it->second.process.get(), 0) == WAIT_TIMEOUT)
+		{
+			return it->second.filename;
+		}
+		else
+		{
+			// The process exited, this PID can now belong to something else.
+			m_ProcessNames.erase(it);
+		}
+	}
 
-		int count = GetClassName(m_WindowHandle, className->data(), 257);
-		if (count)
+	return nullptr;
+}
+
+void Window::PruneProcessNames()
+{
+	for (auto it = m_ProcessNames.begin(); it != m_ProcessNames.end();)
+	{
+		if (WaitForSingleObject(it->second.process.get(), 0) != WAIT_TIMEOUT)
 		{
-			className->resize(count);
-			return m_ClassNames[m_WindowHandle] = std::move(className);
+			it = m_ProcessNames.erase(it);
 		}
 		else
 		{
-			LastErrorHandle(Error::Level::Log, L"Getting class name of a window failed.");
-			className->erase();
-			return m_ClassNames[m_WindowHandle] = std::move(className);
+			it++;
+		}
+	}
+
+	// Amortize the sweeps, so that a lot of long living processes don't make us sweep on every insertion.
+	// Recomputed every time, so that it comes back down once they exit.
+	m_ProcessPruneThreshold = (std::max)(MIN_PROCESS_PRUNE_THRESHOLD, m_ProcessNames.size() * 2);
+}
+
+void Window::ForgetCurrentDesktop()
+{
+	m_CurrentDesktop = UNKNOWN_DESKTOP;
+	m_DesktopGeneration++;
+}
+
+void Window::ClearMonitorCache()
+{
+	std::lock_guard guard(m_CacheLock);
+	m_Cache.for_each([](const HWND &, CachedProperties &cached)
+	{
+		cached.valid &= ~Monitor;
+	});
+}
+
+void Window::ReleaseCache()
+{
+	std::lock_guard guard(m_CacheLock);
+	m_Cache.release();
+	m_ProcessNames = { };
+	m_ProcessPruneThreshold = MIN_PROCESS_PRUNE_THRESHOLD;
+	Diagnostics::Set(Diagnostics::Counter::WindowCacheSize, 0);
+}
+
+std::size_t Window::MemoryUsage()
+{
+	std::lock_guard guard(m_CacheLock);
+	std::size_t usage = m_Cache.capacity() * sizeof(std::pair<HWND, CachedProperties>);
+	m_Cache.for_each([&usage](const HWND &, const CachedProperties &cached)
+	{
+		usage += Util::MemoryUsage(cached.title);
+	});
+
+	usage += Util::NodeMemoryUsage(m_ProcessNames);
+
+	// Locking the entries could release the last reference while we hold the lock, so go by the keys.
+	static const std::size_t inline_capacity = std::wstring().capacity();
+	std::lock_guard internGuard(m_InternLock);
+	usage += Util::NodeMemoryUsage(m_InternedStrings);
+	for (const auto &[str, weak] : m_InternedStrings)
+	{
+		// The string and its control block, along with the string's buffer if it didn't fit inline.
+		usage += sizeof(std::wstring) + 4 * sizeof(void *);
+		if (str.length() > inline_capacity)
+		{
+			usage += (str.length() + 1) * sizeof(wchar_t);
+		}
+	}
+
+	return usage;
+}
+
+std::vector<Window::StableProperties> Window::ExportStableProperties()
+{
+	std::vector<StableProperties> properties;
+
+	std::lock_guard guard(m_CacheLock);
+	properties.reserve(m_Cache.size());
+	m_Cache.for_each([&properties](const HWND &handle, const CachedProperties &cached)
+	{
+		StableProperties &entry = properties.emplace_back();
+		entry.handle = handle;
+		entry.owner = cached.owner;
+		if (cached.valid & ClassName)
+		{
+			entry.classname = *cached.classname;
+		}
+
+		if (cached.valid & FileName)
+		{
+			entry.filename = *cached.filename;
+		}
+
+		if (cached.valid & Classification)
+		{
+			entry.kind = cached.kind;
+		}
+	});
+
+	return properties;
+}
+
+void Window::ImportStableProperties(const std::vector<StableProperties> &properties)
+{
+	std::lock_guard guard(m_CacheLock);
+	for (const StableProperties &entry : properties)
+	{
+		if (entry.owner == 0 || entry.owner != Window(entry.handle).thread_id())
+		{
+			continue;
+		}
+
+		CachedProperties &cached = CacheEntry(entry.handle);
+		cached.referenced = false; // Like it was never used, so it goes first if the cache fills up.
+		if (entry.classname)
+		{
+			cached.classname = Intern(std::wstring(*entry.classname));
+			cached.valid |= ClassName;
+		}
+
+		if (entry.filename)
+		{
+			cached.filename = Intern(std::wstring(*entry.filename));
+			cached.valid |= FileName;
+		}
+
+		if (entry.kind)
+		{
+			cached.kind = *entry.kind;
+			cached.valid |= Classification;
 		}
 	}
+}
+
+void Window::PrepareDesktopManager()
+{
+	GetDesktopManager();
+}
+
+std::wstring Window::fetch_title() const
+{
+	std::wstring windowTitle;
+	int titleSize = GetWindowTextLength(m_WindowHandle) + 1; // For the null terminator
+	windowTitle.resize(titleSize);
+
+	int copiedChars = GetWindowText(m_WindowHandle, windowTitle.data(), titleSize);
+	if (!copiedChars)
+	{
+		LastErrorHandle(Error::Level::Log, L"Getting title of a window failed.");
+		windowTitle.erase();
+		return windowTitle;
+	}
+
+	windowTitle.resize(copiedChars);
+	return windowTitle;
+}
+
+std::wstring Window::fetch_classname() const
+{
+	std::wstring className;
+	className.resize(257);	// According to docs, maximum length of a class name is 256, but it's ambiguous
+							// wether this includes the null terminator or not.
+
+	int count = GetClassName(m_WindowHandle, className.data(), 257);
+	if (count)
+	{
+		className.resize(count);
+	}
 	else
 	{
-		return m_ClassNames.at(m_WindowHandle);
+		LastErrorHandle(Error::Level::Log, L"Getting class name of a window failed.");
+		className.erase();
+	}
+
+	return className;
+}
+
+std::wstring Window::FetchFileName(const HANDLE &process)
+{
+	// Only used once per process, but no need to allocate a huge buffer each time.
+	thread_local std::wstring buffer(LONG_PATH, L'\0');
+
+	DWORD path_Size = LONG_PATH;
+	if (!QueryFullProcessImageName(process, 0, buffer.data(), &path_Size))
+	{
+		LastErrorHandle(Error::Level::Log, L"Getting file name of a window failed.");
+		return { };
+	}
+
+	const std::wstring_view path(buffer.data(), path_Size);
+	return std::wstring(path.substr(path.find_last_of(LR"(/\)") + 1));
+}
+
+const std::wstring &Window::title() const
+{
+	if (!m_WindowHandle)
+	{
+		return empty_string;
 	}
+
+	{
+		std::lock_guard guard(m_CacheLock);
+		if (const CachedProperties *const cached = FindCached(m_WindowHandle); cached && cached->valid & Title)
+		{
+			Diagnostics::Increment(Diagnostics::Counter::WindowCacheHits);
+			return cached->title;
+		}
+	}
+
+	Diagnostics::Increment(Diagnostics::Counter::WindowCacheMisses);
+
+	// Don't hold the lock while asking the window, it might take a while.
+	std::wstring windowTitle = fetch_title();
+
+	std::lock_guard guard(m_CacheLock);
+	CachedProperties &cached = CacheEntry(m_WindowHandle);
+	cached.title = std::move(windowTitle);
+	cached.valid |= Title;
+	return cached.title;
 }
 
-std::shared_ptr<const std::wstring> Window::filename() const
+const std::wstring &Window::classname() const
 {
-	std::lock_guard guard(m_FilenamesLock);
+	if (!m_WindowHandle)
+	{
+		return empty_string;
+	}
 
-	if (m_Filenames.count(m_WindowHandle) == 0)
 	{
-		DWORD pid;
-		GetWindowThreadProcessId(m_WindowHandle, &pid);
-		std::shared_ptr<std::wstring> exeName = std::make_shared<std::wstring>();
+		std::lock_guard guard(m_CacheLock);
+		if (const CachedProperties *const cached = FindCached(m_WindowHandle); cached && cached->valid & ClassName)
+		{
+			Diagnostics::Increment(Diagnostics::Counter::WindowCacheHits);
+			return *cached->classname;
+		}
+	}
+
+	Diagnostics::Increment(Diagnostics::Counter::WindowCacheMisses);
 
-		const winrt::handle processHandle(OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, pid));
-		if (!processHandle)
+	std::wstring className = fetch_classname();
+
+	std::lock_guard guard(m_CacheLock);
+	CachedProperties &cached = CacheEntry(m_WindowHandle);
+	cached.classname = Intern(std::move(className));
+	cached.valid |= ClassName;
+	return *cached.classname;
+}
+
+const std::wstring &Window::filename() const
+{
+	if (!m_WindowHandle)
+	{
+		return empty_string;
+	}
+
+	{
+		std::lock_guard guard(m_CacheLock);
+		if (const CachedProperties *const cached = FindCached(m_WindowHandle); cached && cached->valid & FileName)
 		{
-			LastErrorHandle(Error::Level::Log, L"Getting process handle of a window failed.");
-			return m_Filenames[m_WindowHandle] = std::move(exeName);
+			Diagnostics::Increment(Diagnostics::Counter::WindowCacheHits);
+			return *cached->filename;
 		}
+	}
 
-		DWORD path_Size = LONG_PATH;
-		exeName->resize(path_Size);
+	Diagnostics::Increment(Diagnostics::Counter::WindowCacheMisses);
 
-		if (!QueryFullProcessImageName(processHandle.get(), 0, exeName->data(), &path_Size))
+	DWORD pid = 0;
+	GetWindowThreadProcessId(m_WindowHandle, &pid);
+	{
+		std::lock_guard guard(m_CacheLock);
+		if (interned_t filename = LookupProcessName(pid))
 		{
-			LastErrorHandle(Error::Level::Log, L"Getting file name of a window failed.");
-			exeName->erase();
-			return m_Filenames[m_WindowHandle] = std::move(exeName);
+			CachedProperties &cached = CacheEntry(m_WindowHandle);
+			cached.filename = std::move(filename);
+			cached.valid |= FileName;
+			return *cached.filename;
 		}
+	}
+
+	// SYNCHRONIZE is needed to know when the process exits, if we can't get it don't remember the process.
+	bool rememberProcess = true;
+	winrt::handle processHandle(OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION | SYNCHRONIZE, false, pid));
+	if (!processHandle)
+	{
+		rememberProcess = false;
+		processHandle.attach(OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, false, pid));
+	}
 
-		exeName->resize(path_Size);
-		exeName->erase(0, exeName->find_last_of(LR"(/\)") + 1);
-		return m_Filenames[m_WindowHandle] = std::move(exeName);
+	std::wstring exeName;
+	if (processHandle)
+	{
+		exeName = FetchFileName(processHandle.get());
 	}
 	else
 	{
-		return m_Filenames.at(m_WindowHandle);
+		LastErrorHandle(Error::Level::Log, L"Getting process handle of a window failed.");
+	}
+
+	std::lock_guard guard(m_CacheLock);
+	CachedProperties &cached = CacheEntry(m_WindowHandle);
+	cached.filename = Intern(std::move(exeName));
+	cached.valid |= FileName;
+
+	if (rememberProcess && !cached.filename->empty())
+	{
+		if (m_ProcessNames.size() >= m_ProcessPruneThreshold)
+		{
+			PruneProcessNames();
+		}
+
+		m_ProcessNames[pid] = { std::move(processHandle), cached.filename };
+	}
+
+	return *cached.filename;
+}
+
+Window::Kind Window::fetch_kind() const
+{
+	// Copied, since fetching the class name might evict the entry holding it. Only done once per window anyways.
+	const std::wstring filename = this->filename();
+	if (Util::IgnoreCaseStringEquals(filename, L"SearchUI.exe") || Util::IgnoreCaseStringEquals(filename, L"SearchApp.exe"))
+	{
+		return Kind::Search;
+	}
+	else if (Util::IgnoreCaseStringEquals(filename, L"StartMenuExperienceHost.exe"))
+	{
+		return Kind::StartHost;
+	}
+
+	static const bool timeline_av = win32::IsAtLeastBuild(MIN_FLUENT_BUILD);
+	const std::wstring &classname = this->classname();
+	if (timeline_av ? (classname == CORE_WINDOW && Util::IgnoreCaseStringEquals(filename, L"Explorer.exe")) : (classname == L"MultitaskingViewFrame"))
+	{
+		return Kind::Timeline;
+	}
+
+	return Kind::Normal;
+}
+
+Window::Kind Window::kind() const
+{
+	{
+		std::lock_guard guard(m_CacheLock);
+		if (const CachedProperties *const cached = FindCached(m_WindowHandle); cached && cached->valid & Classification)
+		{
+			Diagnostics::Increment(Diagnostics::Counter::WindowCacheHits);
+			return cached->kind;
+		}
+	}
+
+	Diagnostics::Increment(Diagnostics::Counter::WindowCacheMisses);
+
+	const Kind kind = fetch_kind();
+	if (m_WindowHandle)
+	{
+		std::lock_guard guard(m_CacheLock);
+		CachedProperties &cached = CacheEntry(m_WindowHandle);
+		cached.kind = kind;
+		cached.valid |= Classification;
+	}
+
+	return kind;
+}
+
+HMONITOR Window::monitor() const
+{
+	{
+		std::lock_guard guard(m_CacheLock);
+		if (const CachedProperties *const cached = FindCached(m_WindowHandle); cached && cached->valid & Monitor)
+		{
+			Diagnostics::Increment(Diagnostics::Counter::WindowCacheHits);
+			return cached->monitor;
+		}
+	}
+
+	Diagnostics::Increment(Diagnostics::Counter::WindowCacheMisses);
+
+	// The location hook invalidates this, so the rectangle is always where the window currently is.
+	// Minimised windows aren't on any monitor, the system knows where they get restored to.
+	HMONITOR monitor = nullptr;
+	if (RECT rect; GetWindowRect(m_WindowHandle, &rect))
+	{
+		monitor = MonitorTopology::FromRect(rect);
+	}
+
+	if (!monitor)
+	{
+		monitor = MonitorFromWindow(m_WindowHandle, MONITOR_DEFAULTTOPRIMARY);
+	}
+
+	if (m_WindowHandle)
+	{
+		std::lock_guard guard(m_CacheLock);
+		CachedProperties &cached = CacheEntry(m_WindowHandle);
+		cached.monitor = monitor;
+		cached.valid |= Monitor;
+	}
+
+	return monitor;
+}
+
+std::optional<long> Window::send_message_timeout(unsigned int message, unsigned int timeout, unsigned int wparam, long lparam) const
+{
+	DWORD_PTR result;
+	if (!SendMessageTimeout(m_WindowHandle, message, wparam, lparam, SMTO_ABORTIFHUNG, timeout, &result))
+	{
+		// Aborting because the window is hung doesn't set an error.
+		const DWORD error = GetLastError();
+		if (error == ERROR_SUCCESS || error == ERROR_TIMEOUT)
+		{
+			// Counted so that hung shells can be spotted.
+			Diagnostics::Increment(Diagnostics::Counter::MessageTimeouts);
+			ErrorHandle(HRESULT_FROM_WIN32(ERROR_TIMEOUT), Error::Level::Log, L"Sending a message timed out, the window might be hung.");
+		}
+		else
+		{
+			ErrorHandle(HRESULT_FROM_WIN32(error), Error::Level::Log, L"Sending a message failed.");
+		}
+
+		return std::nullopt;
+	}
+
+	return static_cast<long>(result);
+}
+
+bool Window::cloaked() const
+{
+	{
+		std::lock_guard guard(m_CacheLock);
+		if (const CachedProperties *const cached = FindCached(m_WindowHandle); cached && cached->valid & Cloaked)
+		{
+			Diagnostics::Increment(Diagnostics::Counter::WindowCacheHits);
+			return cached->cloaked;
+		}
+	}
+
+	Diagnostics::Increment(Diagnostics::Counter::WindowCacheMisses);
+
+	const bool cloaked = get_attribute<BOOL>(DWMWA_CLOAKED);
+	if (m_WindowHandle)
+	{
+		std::lock_guard guard(m_CacheLock);
+		CachedProperties &cached = CacheEntry(m_WindowHandle);
+		cached.cloaked = cloaked;
+		cached.valid |= Cloaked;
 	}
+
+	return cloaked;
+}
+
+IVirtualDesktopManager *Window::GetDesktopManager()
+{
+	// One per thread, since a COM pointer can't be used from another apartment than the one that made it
+	// (the worker is an STA, the others are in the MTA).
+	thread_local const auto desktop_manager = create_instance<IVirtualDesktopManager>(CLSID_VirtualDesktopManager);
+	return desktop_manager.get();
+}
+
+GUID Window::desktop_id() const
+{
+	{
+		std::lock_guard guard(m_CacheLock);
+		if (const CachedProperties *const cached = FindCached(m_WindowHandle); cached && cached->valid & Desktop)
+		{
+			Diagnostics::Increment(Diagnostics::Counter::WindowCacheHits);
+			return cached->desktop;
+		}
+	}
+
+	Diagnostics::Increment(Diagnostics::Counter::WindowCacheMisses);
+
+	// Windows that haven't been assigned a desktop yet fail, remember that as unknown.
+	GUID desktop = UNKNOWN_DESKTOP;
+	if (IVirtualDesktopManager *const desktop_manager = GetDesktopManager(); !desktop_manager || FAILED(desktop_manager->GetWindowDesktopId(m_WindowHandle, &desktop)))
+	{
+		desktop = UNKNOWN_DESKTOP;
+	}
+
+	if (m_WindowHandle)
+	{
+		std::lock_guard guard(m_CacheLock);
+		CachedProperties &cached = CacheEntry(m_WindowHandle);
+		cached.desktop = desktop;
+		cached.valid |= Desktop;
+	}
+
+	return desktop;
 }
 
 bool Window::on_current_desktop() const
 {
-	static auto desktop_manager = create_instance<IVirtualDesktopManager>(CLSID_VirtualDesktopManager);
+	// Usually just a GUID compare. A mismatch might be a window shown on all desktops, so ask in that case.
+	const GUID desktop = desktop_id();
+	uint64_t generation;
+	{
+		std::lock_guard guard(m_CacheLock);
+		if (desktop != UNKNOWN_DESKTOP && desktop == m_CurrentDesktop)
+		{
+			return true;
+		}
+
+		generation = m_DesktopGeneration;
+	}
+
+	IVirtualDesktopManager *const desktop_manager = GetDesktopManager();
 
 	BOOL on_current_desktop;
 	if (desktop_manager && ErrorHandle(desktop_manager->IsWindowOnCurrentVirtualDesktop(m_WindowHandle, &on_current_desktop), Error::Level::Log, L"Verifying if a window is on the current virtual desktop failed."))
 	{
+		if (on_current_desktop && desktop != UNKNOWN_DESKTOP)
+		{
+			std::lock_guard guard(m_CacheLock);
+			if (generation == m_DesktopGeneration)
+			{
+				m_CurrentDesktop = desktop;
+			}
+		}
+
 		return on_current_desktop;
 	}
 	else
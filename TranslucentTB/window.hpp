@@ -1,26 +1,125 @@
 #pragma once
+#include <cstdint>
 #include <dwmapi.h>
+#include <guiddef.h>
 #include <memory>
 #include <mutex>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
+#include <winrt/base.h>
 
 #include "findwindowiterator.hpp"
+#include "flatmap.hpp"
 #include "windowclass.hpp"
 
+struct IVirtualDesktopManager;
+
 class EventHook; // Forward declare to avoid circular deps
 
 class Window {
 
+public:
+	// What the foreground logic cares about, a window never changes kind.
+	enum class Kind : uint8_t {
+		Normal,
+		Search,    // Cortana or Windows Search
+		Timeline,  // Task view or Timeline
+		StartHost  // Start menu, StartMenuExperienceHost.exe
+	};
+
+	// Anything above this isn't a kind, like one read from another instance. Keep it the last one.
+	static constexpr Kind LAST_KIND = Kind::StartHost;
+
+	// Handles get recycled and destroy events can get lost, so don't let the cache grow forever.
+	static constexpr std::size_t CACHE_CAPACITY = 4096;
+
+	// What of the cache is still right in another process, so that an instance replacing us starts warm.
+	// The rest changes too quickly to be worth handing over.
+	struct StableProperties {
+		HWND handle;
+		DWORD owner;
+		std::optional<std::wstring> classname;
+		std::optional<std::wstring> filename;
+		std::optional<Kind> kind;
+	};
+
 private:
-	static std::mutex m_ClassNamesLock;
-	static std::unordered_map<Window, std::shared_ptr<std::wstring>> m_ClassNames;
+	// Class and executable names, shared between every window that has the same.
+	using interned_t = std::shared_ptr<const std::wstring>;
+
+	enum Property : uint8_t {
+		Title = 1 << 0,
+		ClassName = 1 << 1,
+		FileName = 1 << 2,
+		Monitor = 1 << 3,
+		Cloaked = 1 << 4,
+		Desktop = 1 << 5,
+		Classification = 1 << 6,
+		AllProperties = Title | ClassName | FileName | Monitor | Cloaked | Desktop | Classification
+	};
+
+	// Everything we know about a window, so that a single lookup gets it all.
+	struct CachedProperties {
+		uint8_t valid = 0; // Which properties have been fetched, combination of Property flags.
+		bool cloaked = false;
+		HMONITOR monitor = nullptr;
+		GUID desktop = { };                      // Virtual desktop, UNKNOWN_DESKTOP if unknown
+		Kind kind = Kind::Normal;
+		interned_t classname;
+		interned_t filename;
+		std::wstring title;                      // Not interned, because those change constantly
+		DWORD owner = 0;                         // Thread owning the window, a recycled handle has another one
+		bool referenced = false;                 // Used since the last eviction sweep
+	};
+
+	// One process usually owns a lot of windows, so remember executable names per process.
+	// We keep a handle to the process, which both stops the PID from being reused and tells us when it exited.
+	struct ProcessName {
+		winrt::handle process;
+		interned_t filename;
+	};
+
+	static std::mutex m_CacheLock;
+	static flat_map<HWND, CachedProperties> m_Cache;
+	static std::unordered_map<DWORD, ProcessName> m_ProcessNames;
+	static constexpr std::size_t MIN_PROCESS_PRUNE_THRESHOLD = 64;
+	static std::size_t m_ProcessPruneThreshold;
+
+	static constexpr GUID UNKNOWN_DESKTOP = { };
+
+	// Learned from windows the desktop manager says are on the current virtual desktop, UNKNOWN_DESKTOP if unknown.
+	// The generation changes every time it's forgotten, so that an answer from before doesn't get stored.
+	static GUID m_CurrentDesktop;
+	static uint64_t m_DesktopGeneration;
+
+	// Windows of the same class or process share their string. It is dropped once nothing uses it anymore, since some
+	// classes get a generated name for every window. Keyed by views of the strings themselves, guarded by m_InternLock.
+	static std::mutex m_InternLock;
+	static std::unordered_map<std::wstring_view, std::weak_ptr<const std::wstring>> m_InternedStrings;
+
+	static interned_t Intern(std::wstring &&str);
+	static void ReleaseInterned(const std::wstring *str);
 
-	static std::mutex m_FilenamesLock;
-	static std::unordered_map<Window, std::shared_ptr<std::wstring>> m_Filenames;
+	// m_CacheLock must be held when calling those
+	static CachedProperties *FindCached(const HWND &handle);
+	static CachedProperties &CacheEntry(const HWND &handle);
+	static void EvictUnused();
+	static void Invalidate(const HWND &handle, const uint8_t &properties);
+	static void Forget(const HWND &handle);
+	static interned_t LookupProcessName(const DWORD &pid);
+	static void PruneProcessNames();
+	static void ForgetCurrentDesktop();
 
-	static std::mutex m_TitlesLock;
-	static std::unordered_map<Window, std::shared_ptr<std::wstring>> m_Titles;
+	// Only valid on the calling thread.
+	static IVirtualDesktopManager *GetDesktopManager();
+
+	Kind fetch_kind() const;
+	std::wstring fetch_title() const;
+	std::wstring fetch_classname() const;
+	static std::wstring FetchFileName(const HANDLE &process);
 
 	friend class Hooks;
 
@@ -81,10 +180,15 @@ public:
 	}
 
 	constexpr Window(const HWND &handle = Window::NullWindow) noexcept : m_WindowHandle(handle) { };
-	std::shared_ptr<const std::wstring> title() const;
-	std::shared_ptr<const std::wstring> classname() const;
-	std::shared_ptr<const std::wstring> filename() const;
+	// Cached, and returned by reference so that hits don't copy or touch a reference count. Only valid until the
+	// cache entry of the window changes or goes away: use them right away, and copy them to keep them.
+	const std::wstring &title() const;
+	const std::wstring &classname() const;
+	const std::wstring &filename() const;
+	Kind kind() const;
+	GUID desktop_id() const;
 	bool on_current_desktop() const;
+	bool cloaked() const;
 	inline unsigned int state() const
 	{
 		const WINDOWPLACEMENT result = placement();
@@ -102,11 +206,12 @@ public:
 	{
 		return IsWindow(m_WindowHandle);
 	}
-	WINDOWPLACEMENT placement() const;
-	inline HMONITOR monitor() const
+	inline DWORD thread_id() const
 	{
-		return MonitorFromWindow(m_WindowHandle, MONITOR_DEFAULTTOPRIMARY);
+		return GetWindowThreadProcessId(m_WindowHandle, nullptr);
 	}
+	WINDOWPLACEMENT placement() const;
+	HMONITOR monitor() const;
 	inline long send_message(unsigned int message, unsigned int wparam = 0, long lparam = 0) const
 	{
 		return SendMessage(m_WindowHandle, message, wparam, lparam);
@@ -115,6 +220,29 @@ public:
 	{
 		return send_message(RegisterWindowMessage(message.c_str()), wparam, lparam);
 	}
+	// Gives up if the window is hung or doesn't answer in time, in which case std::nullopt is returned.
+	std::optional<long> send_message_timeout(unsigned int message, unsigned int timeout, unsigned int wparam = 0, long lparam = 0) const;
+	inline std::optional<long> send_message_timeout(const std::wstring &message, unsigned int timeout, unsigned int wparam = 0, long lparam = 0) const
+	{
+		return send_message_timeout(RegisterWindowMessage(message.c_str()), timeout, wparam, lparam);
+	}
+	// Doesn't wait for the window to process the message, when it's owned by another thread.
+	inline bool send_notify_message(unsigned int message, unsigned int wparam = 0, long lparam = 0) const
+	{
+		return SendNotifyMessage(m_WindowHandle, message, wparam, lparam);
+	}
+	inline bool send_notify_message(const std::wstring &message, unsigned int wparam = 0, long lparam = 0) const
+	{
+		return send_notify_message(RegisterWindowMessage(message.c_str()), wparam, lparam);
+	}
+	inline bool post_message(unsigned int message, unsigned int wparam = 0, long lparam = 0) const
+	{
+		return PostMessage(m_WindowHandle, message, wparam, lparam);
+	}
+	inline bool post_message(const std::wstring &message, unsigned int wparam = 0, long lparam = 0) const
+	{
+		return post_message(RegisterWindowMessage(message.c_str()), wparam, lparam);
+	}
 	inline HWND handle() const noexcept
 	{
 		return m_WindowHandle;
@@ -135,6 +263,24 @@ public:
 	template<typename T>
 	T get_attribute(const DWMWINDOWATTRIBUTE &attrib) const;
 
+	// Monitors of every window need to be fetched again after a display change.
+	static void ClearMonitorCache();
+
+	// Creates a virtual desktop manager ahead of time, so that the first on_current_desktop doesn't wait for its
+	// server to load. Each thread still gets its own instance.
+	static void PrepareDesktopManager();
+
+	// Forgets every cached property and process name, to give the memory back.
+	static void ReleaseCache();
+
+	// Rough heap usage of the cache, for the diagnostics report.
+	static std::size_t MemoryUsage();
+
+	static std::vector<StableProperties> ExportStableProperties();
+
+	// Windows that changed owner since the export are skipped.
+	static void ImportStableProperties(const std::vector<StableProperties> &properties);
+
 	friend struct std::hash<Window>;
 };
 
@@ -0,0 +1,54 @@
+#include "windowstatesnapshot.hpp"
+#include <WinUser.h>
+
+template<typename T, typename Function>
+T WindowStateSnapshot::get(const Window &window, const Property &property, T State::*member, Function &&fetch)
+{
+	State &state = m_States[window.handle()];
+	if (!(state.valid & property))
+	{
+		state.*member = fetch();
+		state.valid |= property;
+	}
+
+	return state.*member;
+}
+
+bool WindowStateSnapshot::visible(const Window &window)
+{
+	return get(window, Visible, &State::visible, [&window]
+	{
+		return window.visible();
+	});
+}
+
+bool WindowStateSnapshot::maximised(const Window &window)
+{
+	// Same as checking the placement, without copying the whole structure out.
+	return get(window, Maximised, &State::maximised, [&window]
+	{
+		return IsZoomed(window) != FALSE;
+	});
+}
+
+bool WindowStateSnapshot::cloaked(const Window &window)
+{
+	return get(window, Cloaked, &State::cloaked, [&window]
+	{
+		return window.cloaked();
+	});
+}
+
+HMONITOR WindowStateSnapshot::monitor(const Window &window)
+{
+	return get(window, Monitor, &State::monitor, [&window]
+	{
+		return window.monitor();
+	});
+}
+
+bool WindowStateSnapshot::is_maximised(const Window &window)
+{
+	// Invisible covers invalid windows too. Most windows are rejected by the first two checks.
+	return visible(window) && maximised(window) && GetAncestor(window, GA_ROOT) == window.handle() && !cloaked(window);
+}
\ No newline at end of file
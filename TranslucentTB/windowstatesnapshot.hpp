@@ -0,0 +1,44 @@
+#pragma once
+#include "arch.h"
+#include <cstdint>
+#include <windef.h>
+
+#include "flatmap.hpp"
+#include "window.hpp"
+
+// What a single pass needs to know about windows, fetched at most once per window during that pass.
+// Everything is fetched lazily, so callers should put the cheapest check that rejects a window first.
+// Only use it for a single pass on a single thread, it never notices windows changing.
+class WindowStateSnapshot {
+
+private:
+	enum Property : uint8_t {
+		Visible = 1 << 0,
+		Maximised = 1 << 1,
+		Cloaked = 1 << 2,
+		Monitor = 1 << 3
+	};
+
+	struct State {
+		uint8_t valid = 0; // Which properties have been fetched, combination of Property flags.
+		bool visible = false;
+		bool maximised = false;
+		bool cloaked = false;
+		HMONITOR monitor = nullptr;
+	};
+
+	flat_map<HWND, State> m_States;
+
+	template<typename T, typename Function>
+	T get(const Window &window, const Property &property, T State::*member, Function &&fetch);
+
+public:
+	bool visible(const Window &window);    // Reads the window style, cheap
+	bool maximised(const Window &window);  // Reads the window style, cheap
+	bool cloaked(const Window &window);    // DWM call, unless in the window cache
+	HMONITOR monitor(const Window &window);
+
+	// Visible, maximised, top-level and not cloaked. Blacklisting is left to the caller.
+	bool is_maximised(const Window &window);
+
+};
\ No newline at end of file
@@ -0,0 +1,240 @@
+#include "windowtracker.hpp"
+#include <algorithm>
+#include <dwmapi.h>
+#include <utility>
+
+#include "blacklist.hpp"
+#include "diagnostics.hpp"
+#include "eventtrace.hpp"
+
+std::mutex WindowTracker::m_Lock;
+std::unordered_map<Window, HMONITOR> WindowTracker::m_Windows;
+std::unordered_map<HMONITOR, std::vector<Window>> WindowTracker::m_Monitors;
+std::function<void()> WindowTracker::m_ChangedCallback;
+std::atomic_uint64_t WindowTracker::m_Generation = 0;
+std::mutex WindowTracker::m_ScanLock;
+bool WindowTracker::m_Scanning = false;
+std::unordered_map<Window, HMONITOR> WindowTracker::m_ScanChanges;
+
+bool WindowTracker::IsMaximisedWindow(const Window &window, WindowStateSnapshot &state)
+{
+	// Only top-level windows can be maximised in a way that matters to us.
+	// Checking on_current_desktop is deferred to HasMaximisedWindow, because it's a COM call.
+	return state.is_maximised(window) && !Blacklist::IsBlacklisted(window);
+}
+
+bool WindowTracker::RemoveUnlocked(const Window &window)
+{
+	const auto it = m_Windows.find(window);
+	if (it == m_Windows.end())
+	{
+		return false;
+	}
+
+	auto &windows = m_Monitors[it->second];
+	const auto position = std::find(windows.begin(), windows.end(), window);
+	if (position != windows.end())
+	{
+		std::swap(*position, windows.back());
+		windows.pop_back();
+	}
+
+	m_Windows.erase(it);
+	return true;
+}
+
+void WindowTracker::NotifyChanged()
+{
+	m_Generation++;
+	if (m_ChangedCallback)
+	{
+		m_ChangedCallback();
+	}
+}
+
+BOOL WindowTracker::EnumWindowsProcess(const HWND hWnd, LPARAM lParam)
+{
+	const Window window(hWnd);
+	ScanState &scan = *reinterpret_cast<ScanState *>(lParam);
+	if (IsMaximisedWindow(window, scan.state))
+	{
+		scan.windows.emplace(window, scan.state.monitor(window));
+	}
+
+	return true;
+}
+
+void WindowTracker::Rescan()
+{
+	const Diagnostics::Span span(Diagnostics::Stage::WindowScan);
+	std::lock_guard scan_guard(m_ScanLock);
+
+	{
+		std::lock_guard guard(m_Lock);
+		m_Scanning = true;
+	}
+
+	// The hooks keep updating the index meanwhile, those changes get merged back in below.
+	ScanState scan;
+	EnumWindows(&EnumWindowsProcess, reinterpret_cast<LPARAM>(&scan));
+	std::unordered_map<Window, HMONITOR> &windows = scan.windows;
+
+	{
+		std::lock_guard guard(m_Lock);
+
+		// Anything that changed while enumerating is newer than what the enumeration saw.
+		for (const auto &[window, monitor] : m_ScanChanges)
+		{
+			if (monitor)
+			{
+				windows[window] = monitor;
+			}
+			else
+			{
+				windows.erase(window);
+			}
+		}
+		m_ScanChanges.clear();
+		m_Scanning = false;
+
+		std::unordered_map<HMONITOR, std::vector<Window>> monitors;
+		for (const auto &[window, monitor] : windows)
+		{
+			monitors[monitor].push_back(window);
+		}
+
+		if (EventTrace::Recording())
+		{
+			EventTrace::Rescan(windows);
+		}
+
+		m_Windows = std::move(windows);
+		m_Monitors = std::move(monitors);
+	}
+
+	NotifyChanged();
+}
+
+void WindowTracker::Update(const Window &window)
+{
+	// Do the checks outside of the lock, they can be slow.
+	WindowStateSnapshot state;
+	const bool maximised = IsMaximisedWindow(window, state);
+	const HMONITOR monitor = maximised ? state.monitor(window) : nullptr;
+
+	bool changed;
+	{
+		std::lock_guard guard(m_Lock);
+		if (m_Scanning)
+		{
+			m_ScanChanges[window] = monitor;
+		}
+
+		const auto it = m_Windows.find(window);
+		if (maximised)
+		{
+			if (it != m_Windows.end() && it->second == monitor)
+			{
+				changed = false;
+			}
+			else
+			{
+				RemoveUnlocked(window);
+				m_Windows.emplace(window, monitor);
+				m_Monitors[monitor].push_back(window);
+				changed = true;
+			}
+		}
+		else
+		{
+			changed = it != m_Windows.end() && RemoveUnlocked(window);
+		}
+	}
+
+	if (changed)
+	{
+		if (EventTrace::Recording())
+		{
+			EventTrace::Maximised(window, monitor);
+		}
+
+		NotifyChanged();
+	}
+}
+
+void WindowTracker::Remove(const Window &window)
+{
+	bool changed;
+	{
+		std::lock_guard guard(m_Lock);
+		if (m_Scanning)
+		{
+			m_ScanChanges[window] = nullptr;
+		}
+
+		changed = RemoveUnlocked(window);
+	}
+
+	if (changed)
+	{
+		if (EventTrace::Recording())
+		{
+			EventTrace::Maximised(window, nullptr);
+		}
+
+		NotifyChanged();
+	}
+}
+
+bool WindowTracker::HasMaximisedWindow(const HMONITOR &monitor)
+{
+	// Copied so that the desktop checks don't hold up the hooks, into storage kept around so that it doesn't allocate.
+	static thread_local std::vector<Window> windows;
+	{
+		std::lock_guard guard(m_Lock);
+
+		const auto it = m_Monitors.find(monitor);
+		if (it == m_Monitors.end() || it->second.empty())
+		{
+			return false;
+		}
+
+		windows.assign(it->second.begin(), it->second.end());
+	}
+
+	// DWMWA_CLOAKED should take care of checking if it's on the current desktop.
+	// But that's undocumented behavior, so still check it. There usually is only a handful
+	// of maximised windows per monitor, and the check usually is a GUID compare, so this is cheap.
+	return std::any_of(windows.begin(), windows.end(), [](const Window &window)
+	{
+		return window.on_current_desktop();
+	});
+}
+
+void WindowTracker::MaximisedWindows(const HMONITOR &monitor, std::vector<Window> &windows)
+{
+	windows.clear();
+	{
+		std::lock_guard guard(m_Lock);
+		if (const auto it = m_Monitors.find(monitor); it != m_Monitors.end())
+		{
+			windows.assign(it->second.begin(), it->second.end());
+		}
+	}
+
+	windows.erase(std::remove_if(windows.begin(), windows.end(), [](const Window &window)
+	{
+		return !window.on_current_desktop();
+	}), windows.end());
+}
+
+uint64_t WindowTracker::Generation()
+{
+	return m_Generation;
+}
+
+void WindowTracker::SetChangedCallback(const std::function<void()> &callback)
+{
+	// Only set once during startup, before the message loop runs, so no locking needed.
+	m_ChangedCallback = callback;
+}
\ No newline at end of file
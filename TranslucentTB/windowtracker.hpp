@@ -0,0 +1,64 @@
+#pragma once
+#include "arch.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <windef.h>
+
+#include "window.hpp"
+#include "windowstatesnapshot.hpp"
+
+// Keeps track of which monitors have a maximised window, so that we don't
+// have to go through every single window on the system on each evaluation.
+class WindowTracker {
+
+public:
+	// Rebuilds the whole index from scratch. Use when the blacklist or monitors changed.
+	static void Rescan();
+
+	// Re-evaluates a single window and updates the index.
+	static void Update(const Window &window);
+
+	// Removes a window from the index.
+	static void Remove(const Window &window);
+
+	// Checks if a monitor has at least one maximised window on the current virtual desktop.
+	static bool HasMaximisedWindow(const HMONITOR &monitor);
+
+	// The maximised windows of a monitor that are on the current virtual desktop. Replaces what windows had,
+	// so that callers can keep reusing the same storage.
+	static void MaximisedWindows(const HMONITOR &monitor, std::vector<Window> &windows);
+
+	// Called every time the index changes.
+	static void SetChangedCallback(const std::function<void()> &callback);
+
+	// Incremented every time the index changes.
+	static uint64_t Generation();
+
+private:
+	static std::mutex m_Lock;
+	static std::unordered_map<Window, HMONITOR> m_Windows;
+	static std::unordered_map<HMONITOR, std::vector<Window>> m_Monitors;
+	static std::function<void()> m_ChangedCallback;
+	static std::atomic_uint64_t m_Generation;
+
+	// Rescans run on the worker while the hooks update the index on the main thread. While one enumerates,
+	// Update and Remove also note what they did here (null when not maximised), guarded by m_Lock.
+	static std::mutex m_ScanLock;
+	static bool m_Scanning;
+	static std::unordered_map<Window, HMONITOR> m_ScanChanges;
+
+	struct ScanState {
+		std::unordered_map<Window, HMONITOR> windows;
+		WindowStateSnapshot state;
+	};
+
+	static bool IsMaximisedWindow(const Window &window, WindowStateSnapshot &state);
+	static bool RemoveUnlocked(const Window &window);
+	static void NotifyChanged();
+	static BOOL CALLBACK EnumWindowsProcess(HWND hWnd, LPARAM lParam);
+
+};
\ No newline at end of file
@@ -0,0 +1,303 @@
+#include "../TranslucentTB/arch.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memoryapi.h>
+#include <processthreadsapi.h>
+#include <profileapi.h>
+#include <synchapi.h>
+#include <WinUser.h>
+#include <winrt/base.h>
+
+#include "../TranslucentTB/diagnostics.hpp"
+#include "../TranslucentTB/resource.h"
+#include "../TranslucentTB/window.hpp"
+#include "../TranslucentTB/windowclass.hpp"
+
+// Creates storms of top-level windows, to see how TranslucentTB keeps up with them.
+// Usage: WindowStorm [--windows N] [--create N] [--retitle N] [--maximise N] [--duration S] [--probe MS]
+// Rates are per second. TranslucentTB has to be running in the same session, its counters are read from
+// the shared memory published by Diagnostics. For the latency probes to mean anything, the maximised
+// appearance has to be enabled and different from the regular one, and --maximise should be 0, otherwise
+// the taskbar often already is in its maximised state when a probe happens.
+
+struct Options {
+	std::size_t windows = 1000;  // Population kept alive, the oldest window is destroyed for every new one past it
+	double create = 500.0;
+	double retitle = 2000.0;
+	double maximise = 0.0;
+	unsigned int duration = 30;
+	unsigned int probe = 500;    // Time between latency probes, 0 disables them
+};
+
+struct Snapshot {
+	uint64_t counters[static_cast<std::size_t>(Diagnostics::Counter::Count)];
+	uint64_t cpu_time; // In 100 ns units
+};
+
+static constexpr unsigned int PROBE_TIMEOUT = 1000;
+
+bool ParseArguments(const int &argc, wchar_t *argv[], Options &options)
+{
+	if (argc % 2 == 0)
+	{
+		return false;
+	}
+
+	for (int i = 1; i < argc; i += 2)
+	{
+		const std::wstring_view name = argv[i];
+		const wchar_t *const value = argv[i + 1];
+		if (name == L"--windows")
+		{
+			options.windows = std::max<std::size_t>(std::wcstoul(value, nullptr, 10), 1);
+		}
+		else if (name == L"--create")
+		{
+			options.create = std::wcstod(value, nullptr);
+		}
+		else if (name == L"--retitle")
+		{
+			options.retitle = std::wcstod(value, nullptr);
+		}
+		else if (name == L"--maximise")
+		{
+			options.maximise = std::wcstod(value, nullptr);
+		}
+		else if (name == L"--duration")
+		{
+			options.duration = std::wcstoul(value, nullptr, 10);
+		}
+		else if (name == L"--probe")
+		{
+			options.probe = std::wcstoul(value, nullptr, 10);
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int64_t Now()
+{
+	LARGE_INTEGER value;
+	QueryPerformanceCounter(&value);
+	return value.QuadPart;
+}
+
+Snapshot TakeSnapshot(const Diagnostics::SharedData &shared, const HANDLE &process)
+{
+	Snapshot snapshot;
+	for (std::size_t i = 0; i < static_cast<std::size_t>(Diagnostics::Counter::Count); i++)
+	{
+		snapshot.counters[i] = shared.counters[i].load(std::memory_order_relaxed);
+	}
+
+	FILETIME creation, exit, kernel, user;
+	if (GetProcessTimes(process, &creation, &exit, &kernel, &user))
+	{
+		const auto to_uint = [](const FILETIME &time)
+		{
+			return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+		};
+		snapshot.cpu_time = to_uint(kernel) + to_uint(user);
+	}
+	else
+	{
+		snapshot.cpu_time = 0;
+	}
+
+	return snapshot;
+}
+
+void PumpMessages()
+{
+	MSG msg;
+	while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
+	{
+		TranslateMessage(&msg);
+		DispatchMessage(&msg);
+	}
+}
+
+int wmain(int argc, wchar_t *argv[])
+{
+	Options options;
+	if (!ParseArguments(argc, argv, options))
+	{
+		std::wcerr << L"Usage: WindowStorm [--windows N] [--create N] [--retitle N] [--maximise N] [--duration S] [--probe MS]" << std::endl;
+		return 1;
+	}
+
+	winrt::handle mapping(OpenFileMapping(FILE_MAP_READ, FALSE, Diagnostics::SHARED_MEMORY_NAME));
+	if (!mapping)
+	{
+		std::wcerr << L"TranslucentTB doesn't seem to be running in this session." << std::endl;
+		return 1;
+	}
+
+	const auto shared = static_cast<const Diagnostics::SharedData *>(MapViewOfFile(mapping.get(), FILE_MAP_READ, 0, 0, sizeof(Diagnostics::SharedData)));
+	if (!shared || shared->version != Diagnostics::SHARED_MEMORY_VERSION)
+	{
+		std::wcerr << L"Failed to read the counters of TranslucentTB, is it the same version as this tool?" << std::endl;
+		return 1;
+	}
+
+	const winrt::handle process(OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, shared->process_id));
+	if (!process)
+	{
+		std::wcerr << L"Failed to open the TranslucentTB process, CPU time won't be reported." << std::endl;
+	}
+
+	const WindowClass window_class(DefWindowProc, L"TTBWindowStorm", MAKEINTRESOURCE(MAINICON));
+
+	const auto create_window = [&window_class](const std::wstring &title, const int &x, const int &y)
+	{
+		const Window window = Window::Create(0, window_class, title, WS_OVERLAPPEDWINDOW, x, y, 300, 200);
+		ShowWindow(window, SW_SHOWNOACTIVATE);
+		return window;
+	};
+
+	std::mt19937 random;
+	std::deque<Window> windows;
+	const Window probe = create_window(L"WindowStorm probe", 0, 0);
+
+	const int64_t frequency = shared->frequency;
+	const int64_t start = Now();
+	const int64_t end = start + frequency * options.duration;
+	uint64_t created = 0, retitled = 0, maximised = 0;
+
+	std::vector<double> latencies;
+	uint64_t probes_missed = 0;
+	int64_t probe_sent = 0;    // When the pending probe was sent, 0 if none is pending
+	int64_t next_probe = start;
+
+	const Snapshot before = TakeSnapshot(*shared, process.get());
+	for (int64_t now = start; now < end; now = Now())
+	{
+		const double elapsed = static_cast<double>(now - start) / frequency;
+		bool idle = true;
+
+		// Each stream catches up with its rate, so that short stalls don't lower the total.
+		for (; created < static_cast<uint64_t>(elapsed * options.create); created++)
+		{
+			if (windows.size() >= options.windows)
+			{
+				DestroyWindow(windows.front());
+				windows.pop_front();
+			}
+
+			windows.push_back(create_window(L"Storm window " + std::to_wstring(created), 20 + static_cast<int>(created % 64) * 10, 20 + static_cast<int>(created % 48) * 10));
+			idle = false;
+		}
+
+		for (; retitled < static_cast<uint64_t>(elapsed * options.retitle) && !windows.empty(); retitled++)
+		{
+			SetWindowText(windows[random() % windows.size()], (L"Retitled storm window " + std::to_wstring(retitled)).c_str());
+			idle = false;
+		}
+
+		for (; maximised < static_cast<uint64_t>(elapsed * options.maximise) && !windows.empty(); maximised++)
+		{
+			const Window &window = windows[random() % windows.size()];
+			ShowWindow(window, IsZoomed(window) ? SW_SHOWNOACTIVATE : SW_SHOWMAXIMIZED);
+			idle = false;
+		}
+
+		if (options.probe != 0)
+		{
+			if (probe_sent == 0 && now >= next_probe)
+			{
+				// Alternates between maximised and restored, both should make the taskbar change.
+				probe_sent = Now();
+				ShowWindow(probe, IsZoomed(probe) ? SW_RESTORE : SW_MAXIMIZE);
+			}
+			else if (probe_sent != 0)
+			{
+				const int64_t applied = shared->last_apply.load(std::memory_order_relaxed);
+				const bool answered = applied > probe_sent;
+				const bool timed_out = now - probe_sent > frequency * PROBE_TIMEOUT / 1000;
+				if (answered)
+				{
+					latencies.push_back(static_cast<double>(applied - probe_sent) * 1000.0 / frequency);
+				}
+				else if (timed_out)
+				{
+					probes_missed++;
+				}
+
+				if (answered || timed_out)
+				{
+					probe_sent = 0;
+					next_probe = now + frequency * options.probe / 1000;
+				}
+			}
+		}
+
+		PumpMessages();
+		if (idle)
+		{
+			Sleep(1);
+		}
+	}
+	const Snapshot after = TakeSnapshot(*shared, process.get());
+
+	for (const Window &window : windows)
+	{
+		DestroyWindow(window);
+	}
+	DestroyWindow(probe);
+
+	const auto delta = [&before, &after](const Diagnostics::Counter &counter)
+	{
+		return after.counters[static_cast<std::size_t>(counter)] - before.counters[static_cast<std::size_t>(counter)];
+	};
+
+	const uint64_t events = delta(Diagnostics::Counter::HookCallbacks);
+	std::wcout << L"Created " << created << L", retitled " << retitled << L", maximised or restored " << maximised << L" windows in " << options.duration << L" s" << std::endl;
+	std::wcout << L"Hook callbacks: " << events << L" (" << delta(Diagnostics::Counter::HookCallbacksFiltered) << L" filtered)" << std::endl;
+	std::wcout << L"SWCA calls: " << delta(Diagnostics::Counter::SwcaCalls) << L" (" << delta(Diagnostics::Counter::SwcaSkipped) << L" skipped)" << std::endl;
+	std::wcout << L"Evaluations skipped: " << delta(Diagnostics::Counter::EvaluationsSkipped) << std::endl;
+	std::wcout << L"Messages that timed out: " << delta(Diagnostics::Counter::MessageTimeouts) << std::endl;
+	std::wcout << L"Cached windows: " << after.counters[static_cast<std::size_t>(Diagnostics::Counter::WindowCacheSize)] << L", verdicts: "
+		<< after.counters[static_cast<std::size_t>(Diagnostics::Counter::BlacklistCacheSize)] << L" (" << delta(Diagnostics::Counter::CacheEvictions) << L" evicted)" << std::endl;
+
+	std::wcout << std::fixed << std::setprecision(2);
+	if (process)
+	{
+		const double cpu_ms = (after.cpu_time - before.cpu_time) / 10000.0;
+		std::wcout << L"TranslucentTB CPU time: " << cpu_ms << L" ms";
+		if (events != 0)
+		{
+			std::wcout << L", " << cpu_ms * 1000.0 / events << L" us per event";
+		}
+		std::wcout << std::endl;
+	}
+
+	if (!latencies.empty())
+	{
+		std::sort(latencies.begin(), latencies.end());
+		const auto percentile = [&latencies](const double &p)
+		{
+			return latencies[std::min(static_cast<std::size_t>(p * latencies.size()), latencies.size() - 1)];
+		};
+		std::wcout << L"Maximise to taskbar update (ms): p50 " << percentile(0.5) << L", p95 " << percentile(0.95) << L", max " << latencies.back() << std::endl;
+	}
+
+	if (options.probe != 0)
+	{
+		std::wcout << L"Probes: " << latencies.size() << L" answered, " << probes_missed << L" without a taskbar update in " << PROBE_TIMEOUT << L" ms" << std::endl;
+	}
+
+	return 0;
+}
\ No newline at end of file